@@ -9,19 +9,180 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
+#include <zlib.h>
+
+/* SIMD intrinsics for the byte scanning kernels, the vector code paths are
+ * only built with compilers that support per function target attributes and
+ * are picked at runtime */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define KILO_SIMD_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define KILO_SIMD_NEON
+#include <arm_neon.h>
+#endif
 
 // defines ---------------------------------------------------------------- {{{1
 
 #define KILO_VERSION "0.0.1"
 /* set tab stop as a constant */
 #define KILO_TAB_STOP 8
+/* bytes and columns between two checkpoints of the width index of a row,
+ * rows shorter than this have none and are walked from the start */
+#define KILO_WIDTH_STEP 64
+/* maximum number of rows in one block of the row storage, inserting a row
+ * moves at most this many erow structs, files are indexed with one entry
+ * (a byte offset) per block */
+#define KILO_BLOCK_ROWS 512
+/* number of unmodified blocks that are kept materialized, rows of blocks
+ * beyond that are dropped and re-read from the file mapping on demand */
+#define KILO_BLOCK_CACHE 256
+/* lines shorter than this are stored inside the row itself, without any
+ * allocation (sized so that an erow is 56 bytes) */
+#define KILO_ROW_INLINE 16
+/* size of the chunks the row arena hands out slots from */
+#define KILO_ARENA_CHUNK (1 << 20)
+/* number of screens above and below the visible one whose rendered rows are
+ * kept cached, render buffers of rows further away are freed */
+#define KILO_RENDER_SLACK 2
+/* size of the terminal input buffer, all pending input up to this size is
+ * pulled in with a single read() */
+#define KILO_INBUF_SIZE 4096
+/* milliseconds to wait for the rest of an escape sequence before a lone
+ * <esc> is assumed */
+#define KILO_ESC_TIMEOUT 50
+/* milliseconds to wait for the terminal to answer a cursor position query */
+#define KILO_QUERY_TIMEOUT 1000
+/* seconds a message stays in the message bar */
+#define KILO_MESSAGE_SECS 5
+/* maximum number of threads indexing a file in the background */
+#define KILO_LOAD_THREADS 8
+/* a file is split between loader threads in chunks of at least this size */
+#define KILO_LOAD_CHUNK (16 << 20)
+/* loader threads hand over the index in pieces, the first piece of a chunk
+ * covers few lines so that the first screen shows up quickly, later pieces
+ * grow up to the maximum */
+#define KILO_LOAD_PIECE_MIN 1024
+#define KILO_LOAD_PIECE_MAX 65536
+/* magic bytes and suffix of the sidecar index file */
+#define KILO_INDEX_MAGIC "KILOIDX1"
+#define KILO_INDEX_SUFFIX ".kidx"
+/* gzip files are inflated in spans of at least this many bytes of text, a
+ * span starts at a deflate block boundary where inflating can resume, and
+ * this many spans are kept inflated besides the ones rows point into */
+#define KILO_GZ_SPAN (4 << 20)
+#define KILO_GZ_CACHE 16
+/* bytes of text the index pass inflates at a time, and the history deflate
+ * refers back into - a span keeps this much of the text before it */
+#define KILO_GZ_CHUNK (256 << 10)
+#define KILO_GZ_WINDOW 32768
+/* most address space reserved for the text of a gzip file, deflate
+ * compresses by at most 1032:1 */
+#define KILO_GZ_RATIO 1032
+#define KILO_GZ_RESERVE_MAX (1ULL << 44)
+/* journal of the edits next to the opened file, replayed when the file is
+ * opened after a session that did not end, and the most milliseconds the
+ * journaled edits wait to be synced to disk */
+#define KILO_SWAP_MAGIC "KILOSWP1"
+#define KILO_SWAP_SUFFIX ".kswp"
+#define KILO_SWAP_SYNC_MS 200
+/* maximum number of threads searching the whole file at once */
+#define KILO_FIND_THREADS 64
+/* a whole-file search splits the rows into tasks of about this many bytes,
+ * threads take one task after the other until none are left */
+#define KILO_FIND_TASK (8 << 20)
+/* at most this many matches of a whole-file search are indexed, more are
+ * only counted */
+#define KILO_FIND_MAX_MATCHES (1 << 24)
+/* states a lazy DFA of a regex keeps, when it needs more they are all
+ * dropped and built again as they are used */
+#define KILO_REGEX_STATES 1024
+/* limits on the size of a regex */
+#define KILO_REGEX_MAX_INST 20000
+#define KILO_REGEX_MAX_DEPTH 100
+#define KILO_REGEX_MAX_REPEAT 1000
+/* longest literal prefix of a regex used to skip to the lines that can
+ * match */
+#define KILO_REGEX_PREFIX 64
+/* number of compiled regexes kept for repeated searches */
+#define KILO_REGEX_CACHE 8
+/* buffers written with one writev() when a file is saved (IOV_MAX on
+ * Linux), and the largest piece of the mapping queued as one buffer */
+#define KILO_SAVE_IOV 1024
+#define KILO_SAVE_CHUNK (1 << 30)
+/* times Ctrl-Q has to be pressed to quit with unsaved changes */
+#define KILO_QUIT_TIMES 3
+/* bytes of undo records allocated at once, the default limit of bytes the
+ * whole undo log may take (the oldest edits are forgotten beyond it) and
+ * the pause in milliseconds after which typing starts a new undo step */
+#define KILO_UNDO_CHUNK (64 << 10)
+#define KILO_UNDO_LIMIT (64 << 20)
+#define KILO_UNDO_GROUP_MS 1000
+/* milliseconds between status bar updates while a file is indexed */
+#define KILO_LOAD_STATUS_MS 100
+/* default limit of frames per second (-r), quicker keys and background
+ * events (e.g. lines appended in follow mode) are coalesced into one frame
+ * showing the latest state */
+#define KILO_MAX_FPS 60
+/* bytes read from a followed file with one read() */
+#define KILO_FOLLOW_READ (64 << 10)
+/* default screen size in headless mode */
+#define KILO_HEADLESS_ROWS 24
+#define KILO_HEADLESS_COLS 80
+/* maximum number of file descriptors the event loop watches besides stdin,
+ * every buffer that is indexed or followed takes one, every client attached
+ * to the daemon two */
+#define KILO_MAX_WATCH 256
+/* maximum number of views the screen is split into */
+#define KILO_MAX_VIEWS 8
+/* longest message a client may send, a hello carries the file names */
+#define KILO_MSG_MAX (1 << 20)
+/* how long a client waits for a daemon it started to listen */
+#define KILO_ATTACH_MS 2000
+/* the profiler keeps the durations of every timed section in histograms of
+ * this many power of two buckets (1 us up to about 8 seconds), and draws
+ * bars of at most KILO_PROF_BAR characters for them at exit */
+#define KILO_PROF_BUCKETS 24
+#define KILO_PROF_BAR 40
+
+/* timers around the hot path sections, they cost a predicted branch while
+ * profiling is off - building with -DKILO_NO_PROFILE removes them, the HUD
+ * and the trace */
+#ifndef KILO_NO_PROFILE
+#define PROF_BEGIN(span) do { if (E.prof.on) editorProfBegin(span); } while (0)
+#define PROF_END(span) do { if (E.prof.on) editorProfEnd(span); } while (0)
+#define PROF_FRAME(bytes) do { if (E.prof.on) editorProfFrame(bytes); } while (0)
+#define PROF_ALLOC() editorProfAlloc()
+#else
+#define PROF_BEGIN(span) do { } while (0)
+#define PROF_END(span) do { } while (0)
+#define PROF_FRAME(bytes) do { } while (0)
+#define PROF_ALLOC() do { } while (0)
+#endif
 
 /* CTRL_KEY macro does a bitwise AND of character with the value 00011111 in
  * binary = sets the upper 3 bits of character to 0 (Ctrl key strips bits 5 and 6
@@ -33,6 +194,9 @@
 /* crete key constants for further use
  * use numbers out of normal character range - e.g. 1000+ */
 enum editorKey {                                                         // {{{2
+    /* backspace does not have a human readable backslash representation,
+     * it is sent as 127 */
+    BACKSPACE = 127,
     ARROW_UP = 1000,
     ARROW_DOWN,
     ARROW_RIGHT,
@@ -44,6 +208,41 @@ enum editorKey {                                                         // {{{2
     PAGE_DOWN
 };
 
+/* highlight class of a rendered character, mapped to a color when the row
+ * is drawn */
+enum editorHighlight {                                                   // {{{2
+    HL_NORMAL = 0,
+    HL_COMMENT,
+    HL_MLCOMMENT,
+    HL_KEYWORD1,
+    HL_KEYWORD2,
+    HL_STRING,
+    HL_NUMBER
+};
+
+/* state of the lexer at the end of a row, the state the next row starts
+ * in - only multi-line comments carry over from one row to the next */
+enum hlState {                                                           // {{{2
+    HL_STATE_NORMAL = 0,
+    HL_STATE_COMMENT
+};
+
+/* the end states kept per row may be marked stale - the row changed (or
+ * the row above it was deleted) since the state was computed, the old
+ * state is kept next to the flag and compared with the new one */
+#define HL_STALE 0x80
+/* end state of a row that was never lexed */
+#define HL_UNKNOWN 0xff
+
+/* attribute a run of a screen line is drawn with, the foreground color
+ * (SGR code 30-37, 0 for the default color) with the ATTR_INVERSE flag */
+#define ATTR_DEFAULT 0
+#define ATTR_INVERSE 0x100
+
+/* flags of a filetype in the highlight database */
+#define HL_HIGHLIGHT_NUMBERS (1 << 0)
+#define HL_HIGHLIGHT_STRINGS (1 << 1)
+
 // data ------------------------------------------------------------------- {{{1
 
 /* editor row - line of text as a pointer to a dynamically allocated character
@@ -54,42 +253,1001 @@ typedef struct erow {                                                    // {{{2
     int size;
     /* size of render */
     int rsize;
-    /* actual line characters */
+    /* bytes available at chars (including the null byte), 0 while chars
+     * points into the file mapping */
+    int cap;
+    /* non-zero if render is missing or out of date with chars */
+    unsigned char dirty;
+    /* enum rowStore */
+    unsigned char store;
+    /* lexer state (enum hlState) the row was highlighted with, hl is out of
+     * date once the row above ends in another state */
+    unsigned char hlstart;
+    /* non-zero if render has characters that are not one byte and one
+     * column (multibyte or wide), columns are not render offsets then */
+    unsigned char wide;
+    /* actual line characters, where they live is given by store - only
+     * mapped rows are not null terminated */
     char *chars;
-    /* rendered line characters */
+    /* rendered line characters, built lazily on first draw, the same
+     * pointer as chars if the line has nothing to expand */
     char *render;
+    /* highlight class (enum editorHighlight) of every rendered character,
+     * built when the row is drawn and freed with render, NULL if there is
+     * none */
+    unsigned char *hl;
+    /* checkpoints mapping chars offsets and columns of a long rendered row,
+     * built and freed with render, NULL for short rows and rows that render
+     * as they are */
+    struct rowwidth *width;
+    /* where the screen lines of the row start in soft wrap mode, built and
+     * freed with render, NULL if the row was not drawn wrapped or is one
+     * byte per column */
+    struct rowwrap *wrap;
+    /* the characters of short lines, chars points here for ROW_INLINE */
+    char inl[KILO_ROW_INLINE];
 } erow;
 
+/* a position in a row - a byte offset that starts a character and the
+ * column that character starts at */
+struct widthpoint {                                                      // {{{2
+    int off, col;
+};
+
+/* width index of a row - byte checkpoint k is the character holding byte
+ * k * KILO_WIDTH_STEP of chars, column checkpoint k the character of render
+ * covering column k * KILO_WIDTH_STEP, so converting between the two walks
+ * at most one step from a checkpoint */
+struct rowwidth {                                                        // {{{2
+    int nbyte, ncol;
+    /* the column checkpoints start at p[colbase] */
+    int colbase;
+    struct widthpoint p[];
+};
+
+/* wrap points of a row in soft wrap mode - p[k] is the character screen
+ * line k of the row starts with, for a screen cols columns wide */
+struct rowwrap {                                                         // {{{2
+    int cols;
+    int n;
+    struct widthpoint p[];
+};
+
+/* where the characters of a row live */
+enum rowStore {                                                          // {{{2
+    /* borrowed from the read-only file mapping */
+    ROW_MAPPED,
+    /* inside the row itself */
+    ROW_INLINE,
+    /* a slot in the row arena, freed only with the whole arena */
+    ROW_ARENA,
+    /* an individual heap block, for rows edited past their slot */
+    ROW_HEAP
+};
+
+/* chunk of the row arena, slots are handed out from data front to back */
+struct arenachunk {                                                      // {{{2
+    struct arenachunk *next;
+    size_t used, size;
+    char data[];
+};
+
+/* block of consecutive rows, the rows of the file are stored as a list of
+ * these blocks instead of one flat array so that inserting or deleting a row
+ * in the middle of a huge file only moves the rows of a single block */
+struct rowblock {                                                        // {{{2
+    /* rows used in this block, at most KILO_BLOCK_ROWS */
+    int numrows;
+    /* the rows, room for KILO_BLOCK_ROWS of them, NULL if the block is not
+     * materialized - its rows are then read from the mapping on access */
+    erow *row;
+    /* the lines of the block in the file mapping, [base, end) - this is the
+     * sparse line index, NULL for blocks not loaded from the mapping */
+    char *base, *end;
+    /* set when rows were inserted, deleted, moved or edited, the block no
+     * longer matches [base, end) and cannot be dropped */
+    int modified;
+    /* line table of an unmodified block from the mapping, NULL if it is not
+     * built - a structure of arrays with the start (relative to base), the
+     * length and the flags of every line, the text stays in the mapping, so
+     * whole-file passes read a few bytes per line instead of an erow */
+    size_t *lineoff;
+    int *linesize;
+    unsigned char *lineflags;
+    /* display width of the widest line, -1 if not known */
+    int maxwidth;
+    /* lexer state at the end of every line (enum hlState, HL_STALE or
+     * HL_UNKNOWN), NULL if none is known - kept when the rows and the line
+     * table are dropped, it is all that is needed to start highlighting in
+     * the middle of the file */
+    unsigned char *hlstate;
+    /* non-zero if some line of the block may be stale or unknown */
+    int hlstale;
+};
+
+/* flags of a line in the line table */
+enum lineFlag {                                                          // {{{2
+    /* the line has tabs, it renders to something else than its chars */
+    LINE_TAB = 1 << 0,
+    /* the line has bytes that are not ASCII, its columns are not its bytes */
+    LINE_WIDE = 1 << 1
+};
+
+/* sparse index entries found by a loader thread, handed over to the main
+ * thread which appends them as (not materialized) row blocks */
+struct loadpiece {                                                       // {{{2
+    struct loadpiece *next;
+    int numentries;
+    /* per entry: the lines [base, end) and how many there are, at most
+     * KILO_BLOCK_ROWS */
+    char **base;
+    char **end;
+    int *lines;
+};
+
+/* part of the file indexed by one loader thread */
+struct loadchunk {                                                       // {{{2
+    char *begin, *end;
+    /* pieces found so far and not yet taken by the main thread */
+    struct loadpiece *head, *tail;
+    /* set when the thread reached the end of the chunk */
+    int done;
+    pthread_t thread;
+    /* the loader of the chunk, threads never go through E.buf, it changes
+     * with the active view */
+    struct editorLoader *load;
+    /* the gzip file a chunk of a compressed file is inflated from, NULL
+     * for a chunk of the mapping */
+    struct editorGzip *gz;
+};
+
+/* background file loading state */
+struct editorLoader {                                                    // {{{2
+    /* non-zero while a file is being indexed */
+    int active;
+    struct loadchunk chunk[KILO_LOAD_THREADS];
+    int numchunks;
+    /* chunk whose pieces are appended next, chunks are stitched together
+     * in file order */
+    int next;
+    /* protects the piece lists, the done flags and cancel */
+    pthread_mutex_t lock;
+    /* set to make the threads stop early */
+    int cancel;
+    /* the threads write to this pipe whenever they publish a piece */
+    int notify[2];
+    /* time of the last status bar update */
+    double lastupdate;
+    /* bytes of the mapping whose rows are appended, from its start */
+    size_t indexed;
+    /* index entries collected for the sidecar file, offsets into the
+     * mapping and line counts */
+    uint64_t *idxoff;
+    uint32_t *idxlines;
+    int idxlen, idxcap;
+};
+
+/* resume point of a gzip file - inflating starts again at a deflate block
+ * boundary with the bits left over of the byte before and the text before
+ * it as the history */
+struct gzspan {                                                          // {{{2
+    /* the span starts at byte _out_ of the text and byte _in_ of the
+     * compressed file, _bits_ bits of byte in - 1 are not consumed yet */
+    uint64_t out, in;
+    int bits;
+    /* the KILO_GZ_WINDOW bytes of text before out, deflated */
+    unsigned char *window;
+    int winlen;
+    /* the text of the span is inflated into the reserved range, pins keep
+     * it there - rows pointing into it and searches running over it */
+    int resident;
+    int pins;
+    /* tick of the last use, the least recently used span goes first */
+    unsigned long used;
+};
+
+/* a gzip file - the text is inflated into a reserved address range that
+ * stands in for the file mapping, but only the spans that are used are
+ * inflated and backed by memory, so the text can be far larger than it */
+struct editorGzip {                                                      // {{{2
+    /* the mapping of the compressed file */
+    unsigned char *data;
+    size_t len;
+    /* the reserved range the text is inflated into */
+    char *text;
+    size_t reserved;
+    /* the spans found so far, in order of the text */
+    struct gzspan *span;
+    int numspans, spancap;
+    /* bytes of text found so far, once done all of them - the last span
+     * ends there */
+    uint64_t total;
+    int done;
+    /* set if the data is corrupt or truncated, the text ends before it */
+    int error;
+    /* spans inflated and the use counter */
+    int resident;
+    unsigned long tick;
+    /* protects all of the above, spans are inflated by the main thread and
+     * the search threads while the index pass adds more */
+    pthread_mutex_t lock;
+};
+
+/* follow mode - lines appended to the opened file are read as they come
+ * (like tail -f) */
+struct editorFollow {                                                    // {{{2
+    /* descriptor the new data is read from, -1 if not following */
+    int fd;
+    /* inotify instance watching the file */
+    int inotify;
+    /* bytes of the file that are already rows */
+    off_t offset;
+    /* non-zero if the last row was not terminated by a newline yet, the
+     * next data continues it */
+    int partial;
+    /* time of the last status bar update */
+    double lastupdate;
+};
+
+/* node of the syntax tree of a regex */
+enum reNode {                                                            // {{{2
+    RE_NODE_SET,
+    RE_NODE_EMPTY,
+    RE_NODE_BEGIN,
+    RE_NODE_END,
+    RE_NODE_CAT,
+    RE_NODE_ALT,
+    RE_NODE_REPEAT
+};
+
+struct renode {                                                          // {{{2
+    enum reNode type;
+    /* operands of CAT and ALT, a is the one of REPEAT */
+    int a, b;
+    /* byte set of SET */
+    int set;
+    /* bounds of REPEAT, max is -1 if there is none */
+    int min, max;
+};
+
+/* instructions of the NFA programs a regex is compiled to */
+enum reOp {                                                              // {{{2
+    /* consume a byte of set x */
+    RE_BYTE,
+    /* continue at both x and y */
+    RE_SPLIT,
+    /* continue at x */
+    RE_JMP,
+    /* zero width, hold at the start and end of a line (in the direction
+     * the program scans) */
+    RE_BEGIN,
+    RE_END,
+    RE_MATCH
+};
+
+struct reinst {                                                          // {{{2
+    enum reOp op;
+    int x, y;
+};
+
+struct reprog {                                                          // {{{2
+    /* the program starts at instruction 0 */
+    struct reinst *inst;
+    int numinst, cap;
+};
+
+enum dfaFlag {                                                           // {{{2
+    /* a match ends here */
+    DFA_MATCH = 1 << 0,
+    /* a match ends here if the line ends here */
+    DFA_EOLMATCH = 1 << 1,
+    /* a match ended at the end of the line before */
+    DFA_MATCHPREV = 1 << 2,
+    /* no thread is left */
+    DFA_DEAD = 1 << 3
+};
+
+/* a lazily built DFA running one program of a regex, its states are sets of
+ * NFA instructions, at most KILO_REGEX_STATES of them are kept */
+struct redfa {                                                           // {{{2
+    struct regex *re;
+    struct reprog *prog;
+    /* non-zero if a match may start anywhere, the start of the program is
+     * added to every state then */
+    int unanchored;
+    int numstates, capstates;
+    /* transitions, numclasses per state, -1 if not built yet */
+    int *trans;
+    unsigned char *flags;
+    /* the instructions of the states, state s has setlen[s] of them at
+     * pool + setoff[s] */
+    int *setoff, *setlen;
+    int *pool;
+    int poollen, poolcap;
+    /* open addressing hash table of the states, index + 1 (0 is free) */
+    int *hash;
+    /* start state at the start of a line (1) and elsewhere (0), -1 if
+     * not built yet */
+    int start[2];
+    /* number of times the states were dropped */
+    int flushes;
+    /* bytes that keep the scan in the start state (not at the start of a
+     * line), they are skipped without looking at the transitions, and the
+     * entry of that state (-1 if the table is not usable) - built when
+     * flushes was skipflushes */
+    unsigned char skip[256];
+    int skipentry, skipflushes;
+    /* scratch space for building a state, instructions are marked with
+     * the current generation when they are added */
+    int *list, *stack;
+    unsigned *mark;
+    unsigned gen;
+};
+
+/* the automata one thread matches a regex with */
+struct rematcher {                                                       // {{{2
+    struct regex *re;
+    /* unanchored forward (finds the line of the first match), unanchored
+     * reverse (finds the leftmost start) and anchored forward (finds the
+     * longest match from a start) */
+    struct redfa fwd, rev, anch;
+};
+
+/* a compiled regex */
+struct regex {                                                           // {{{2
+    char *pattern;
+    /* byte sets, 256 bits each */
+    uint32_t (*set)[8];
+    int numsets;
+    /* the program of the pattern and of the reversed pattern */
+    struct reprog fwd, rev;
+    /* bytes no set tells apart share a class, the DFAs have one transition
+     * per class */
+    unsigned char classof[256];
+    int numclasses;
+    /* literal bytes every match starts with */
+    char prefix[KILO_REGEX_PREFIX];
+    int prefixlen;
+    /* automata of the main thread (0) and the search threads, kept for
+     * repeated searches */
+    struct rematcher *matcher[KILO_FIND_THREADS + 1];
+    /* when it was last used, for the cache of compiled patterns */
+    unsigned long lastuse;
+};
+
+/* state of the regex parser */
+struct reparser {                                                        // {{{2
+    const char *p;
+    struct regex *re;
+    struct renode *node;
+    int numnodes, capnodes;
+    int capsets;
+    /* nesting depth of the groups */
+    int depth;
+    /* first error, NULL if there is none */
+    const char *error;
+};
+
+/* what a search looks for - a plain string or a compiled regex, with the
+ * automata of the thread running the search */
+struct searchQuery {                                                     // {{{2
+    const char *str;
+    int len;
+    /* NULL for a plain string */
+    struct regex *re;
+    struct rematcher *m;
+};
+
+/* state of an incremental search, kept between the keys typed at the
+ * prompt */
+struct editorSearch {                                                    // {{{2
+    /* cursor and view when the search started, restored on escape */
+    int cx, cy, rowoff, rowsub, coloff;
+    /* the query the current match belongs to, NULL before the first key */
+    char *query;
+    /* non-zero if the query is a regex (Ctrl-R toggles) */
+    int regex;
+    /* why the query is not a valid regex, NULL if it is */
+    const char *error;
+    /* the current match, matchrow is -1 if the query was not found */
+    int matchrow, matchcol, matchlen;
+    /* non-zero if the match is before the start position (the search
+     * wrapped around the end of the file) */
+    int wrapped;
+    /* non-zero once all matches are to be counted (Ctrl-A), the count
+     * follows the query from then on */
+    int countall;
+    /* set while the query was not found in the rows indexed so far and the
+     * file is still being indexed - the rows from _searched_ on are
+     * searched as they arrive, and the search wraps around to the rows
+     * before _wraprow_ only after the last of them */
+    int pending, searched, wraprow;
+    /* the prompt shown, it carries the match count */
+    char prompt[80];
+};
+
+/* a match found by a whole-file search */
+struct editorMatch {                                                     // {{{2
+    int row, col;
+};
+
+/* the blocks [b0, b1) of the rows, searched by one task of a whole-file
+ * search */
+struct findtask {                                                        // {{{2
+    int b0, b1;
+    /* index of the first row of block b0 */
+    int row0;
+    /* the matches stored so far, in file order */
+    struct editorMatch *match;
+    int nummatches, cap;
+    /* set when no more matches can be stored */
+    int full;
+    /* all the matches found, stored or not */
+    long long count;
+};
+
+/* whole-file search - the rows are split into tasks that a pool of threads
+ * takes one by one, the matches of the tasks are concatenated in file order
+ * into a sorted match index */
+struct editorFindAll {                                                   // {{{2
+    /* non-zero while the threads are searching */
+    int active;
+    /* what is searched for, the threads add their own automata */
+    char *query;
+    struct searchQuery q;
+    struct findtask *task;
+    int numtasks;
+    /* next task to be taken and the number of tasks done */
+    int next, done;
+    /* number of matches the tasks may still store */
+    long long budget;
+    /* set when some matches could not be stored */
+    int truncated;
+    /* protects next, done, budget, truncated and cancel */
+    pthread_mutex_t lock;
+    /* set to make the threads stop early */
+    int cancel;
+    pthread_t thread[KILO_FIND_THREADS];
+    int numthreads;
+    /* matcher slot of the next thread that starts, protected by lock */
+    int nextslot;
+    /* the threads write to this pipe whenever they finish a task */
+    int notify[2];
+    /* set once all tasks are done, the result is the number of matches and
+     * the match index (NULL if not all matches could be stored) */
+    int ready;
+    /* set if the file was still being indexed, the count is started again
+     * once it is complete */
+    int partial;
+    /* the buffer searched, the threads never go through E.buf */
+    struct editorBuffer *buf;
+    long long count;
+    struct editorMatch *match;
+    int nummatches;
+};
+
+/* kind of edit an undo record holds */
+enum undoOp {
+    UNDO_INSERT,
+    UNDO_DELETE
+};
+
+/* one edit in the undo log - _text_ was inserted at or deleted from _row_,
+ * _col_, the text of a deletion made with backspace is stored last
+ * character first so that it can grow in place */
+struct undorec {                                                         // {{{2
+    unsigned char op;
+    unsigned char reversed;
+    /* non-zero for the first record of an undo step, undo reverts all
+     * records up to and including one with step set */
+    unsigned char step;
+    int row, col;
+    int len;
+    /* offset of the record before in the same chunk, -1 for the first */
+    int prev;
+    char text[];
+};
+
+/* chunk of the undo log, records are packed 4 byte aligned into data */
+struct undochunk {                                                       // {{{2
+    struct undochunk *prev, *next;
+    /* offset of the last record, -1 if there is none yet */
+    int last;
+    /* bytes of data used and allocated */
+    int used, size;
+    char data[];
+};
+
+/* the undo log, a list of chunks from the oldest edits to the newest */
+struct undolog {                                                         // {{{2
+    struct undochunk *first, *last;
+    /* the last applied record, a NULL chunk if all edits are undone - the
+     * records after it can be redone */
+    struct undochunk *cur;
+    int curoff;
+    /* bytes allocated for the chunks and the most they may take */
+    size_t bytes, limit;
+    /* time of the last recorded edit */
+    double lastedit;
+    /* set after undo and redo, the next edit starts a new record */
+    int seal;
+};
+
+/* rows of the file being saved, queued as buffers for writev() */
+struct savewriter {                                                      // {{{2
+    int fd;
+    struct iovec iov[KILO_SAVE_IOV];
+    int niov;
+    /* bytes written so far */
+    size_t bytes;
+    /* errno of the first failed write, 0 if none failed */
+    int error;
+};
+
+/* header of the swap file, the version of the file the journaled edits
+ * apply to - followed by the records */
+struct swapheader {                                                      // {{{2
+    char magic[8];
+    uint64_t filesize;
+    int64_t mtime_sec, mtime_nsec;
+};
+
+/* one journaled edit, followed by _len_ bytes of text - _check_ is a hash
+ * of the other fields and the text, a torn record at the end of the
+ * journal fails it */
+struct swaprec {                                                         // {{{2
+    uint32_t check;
+    /* UNDO_INSERT or UNDO_DELETE */
+    uint32_t op;
+    int32_t row, col;
+    uint32_t len;
+};
+
+/* the thread writing the output to the terminal - a slow terminal blocks
+ * it instead of the editor */
+struct editorTermOut {                                                   // {{{2
+    int running;
+    pthread_t thread;
+    /* descriptor the output goes to, stdout or the socket of a client */
+    int fd;
+    /* protects busy and stop, signalled when they change */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* set while the thread writes the len bytes of buf, the editor does not
+     * touch them meanwhile */
+    int busy;
+    /* set by the editor to end the thread, and by the thread once it
+     * ended */
+    int stop, stopped;
+    char *buf;
+    int len, cap;
+    /* written to once the output is gone, watched by the event loop */
+    int notify[2];
+};
+
+/* the swap file of the opened file and the thread writing it */
+struct editorSwap {                                                      // {{{2
+    /* non-zero if edits are journaled, not without a file name or when the
+     * swap file belongs to another session */
+    int enabled;
+    /* set while a journal is replayed, its edits are not journaled again */
+    int replaying;
+    struct swapheader hdr;
+    /* non-zero while the writer thread runs */
+    int running;
+    pthread_t thread;
+    /* protects the pending records, the flags and error */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* records not written yet */
+    char *pending;
+    size_t pendlen, pendcap;
+    /* set to make the writer stop, with discard it does not write what is
+     * pending */
+    int stop, discard;
+    /* the locked swap file, -1 if none is open */
+    int fd;
+    /* its name while the writer thread runs */
+    char *path;
+    /* errno of the write that failed, journaling stops then */
+    int error;
+};
+
+/* header of the sidecar index file, followed by numentries uint64_t block
+ * offsets and numentries uint32_t line counts */
+struct indexheader {                                                     // {{{2
+    char magic[8];
+    /* size and modification time of the indexed file, the sidecar is only
+     * used while they match */
+    uint64_t filesize;
+    int64_t mtime_sec, mtime_nsec;
+    uint64_t numentries;
+};
+
+/* filetype of the highlight database - how files of the type are
+ * recognized and lexed */
+struct editorSyntax {                                                    // {{{2
+    /* name shown in the status bar */
+    char *filetype;
+    /* patterns matched against the file name, entries starting with a dot
+     * are file extensions, NULL terminated */
+    char **filematch;
+    /* keywords, secondary keywords end with a pipe, NULL terminated */
+    char **keywords;
+    /* comment delimiters, empty strings if the type has no such comments */
+    char *singleline_comment_start;
+    char *multiline_comment_start;
+    char *multiline_comment_end;
+    /* HL_HIGHLIGHT_* */
+    int flags;
+};
+
+/* hot path sections timed by the profiler */
+enum profSpan {                                                          // {{{2
+    /* editorReadKey() in the main loop, mostly waiting for a key */
+    PROF_READKEY = 0,
+    /* editorProcessKeypress(), reading the key and acting on it */
+    PROF_KEY,
+    PROF_SCROLL,
+    /* building the rows to draw and the escape sequences of the frame */
+    PROF_DRAW,
+    /* the write() of the frame to the terminal */
+    PROF_WRITE,
+    PROF_SPANS
+};
+
+/* timers, counters and the trace of the profiler */
+struct editorProfile {                                                   // {{{2
+    /* non-zero while the sections are timed (the HUD is shown or a trace is
+     * written), read by the allocation counter in every thread */
+    int on;
+    /* non-zero while the HUD replaces the message bar */
+    int hud;
+    /* non-zero once anything was timed, the histograms are printed at
+     * exit then */
+    int used;
+    /* Chrome trace (JSON array of events) being written, NULL if none */
+    FILE *trace;
+    /* time profiling started, trace timestamps count from it */
+    double epoch;
+    /* when the running sections started and how long the last ones took,
+     * in seconds */
+    double start[PROF_SPANS];
+    double last[PROF_SPANS];
+    double total[PROF_SPANS];
+    /* bucket k counts the durations in [2^k, 2^(k+1)) microseconds, bucket
+     * 0 also the shorter ones */
+    unsigned long hist[PROF_SPANS][KILO_PROF_BUCKETS];
+    unsigned long count[PROF_SPANS];
+    /* allocations so far and when the last frame was sent, the bytes and
+     * allocations of the last frame */
+    unsigned long allocs, frameallocs;
+    unsigned long lastallocs;
+    size_t lastbytes;
+    /* frames sent and their bytes and allocations in total */
+    unsigned long frames, totalallocs;
+    size_t totalbytes;
+};
+
+/* a view of a buffer on a part of the screen - the state of the active
+ * view (the one with the cursor) is kept in E while it is active, and
+ * copied back here when another view becomes active */
+struct editorView {                                                      // {{{2
+    struct editorBuffer *buf;
+    /* screen line the view starts at, its status bar is drawn below its
+     * screenrows text rows */
+    int top;
+    int screenrows;
+    int cx, cy, rx, rowoff, coloff, wrap, rowsub, ry;
+    int rendlo, rendhi;
+    int framerowoff, framerowsub;
+    int jumpwait, jumppct;
+};
+
+/* an opened file, or the buffer of a new one - the rows and everything kept
+ * about them, the views showing the file share one buffer */
+struct editorBuffer {                                                    // {{{2
+    /* references to the buffer - one of the buffer list while it is in
+     * there and one of every view showing it, it is freed with the last */
+    int refs;
+    /* device and inode of the opened file, opening the file again finds
+     * the buffer by them */
+    dev_t dev;
+    ino_t ino;
+    /* total number of rows in the file */
+    int numrows;
+    /* the row storage - a dynamically allocated array of row blocks, rows
+     * are only accessed through editorRowAt() */
+    struct rowblock *block;
+    int numblocks;
+    /* number of block slots allocated, grows geometrically so that
+     * appending a block is amortized O(1) */
+    int blockcap;
+    /* Fenwick tree (1 based) over the block sizes, finds the block holding
+     * a row in O(log n) */
+    int *blockidx;
+    /* block found by the last lookup and the index of its first row, so
+     * that walking consecutive rows does not search the tree every time */
+    int curblock, curstart;
+    /* number of materialized blocks that could be dropped again */
+    int numloaded;
+    /* number of blocks with a line table */
+    int numtables;
+    /* the row arena - chunks holding the characters of ROW_ARENA rows */
+    struct arenachunk *arena;
+    /* number of ROW_HEAP rows, these are the only ones freed one by one */
+    int numheaprows;
+    /* name of the opened file, NULL if there is none */
+    char *filename;
+    /* filetype of the opened file, NULL if it is not highlighted */
+    struct editorSyntax *syntax;
+    /* rows above this one have an end state that is up to date, the end
+     * states of rows below are only brought up to date once the rows are
+     * about to be drawn */
+    int hlfrontier;
+    /* background indexing of the opened file */
+    struct editorLoader load;
+    /* following data appended to the opened file */
+    struct editorFollow follow;
+    /* read-only mapping of the opened file, rows point into it until they
+     * are edited - the descriptor stays open so that a save copies the
+     * unmodified parts from the exact file that was mapped */
+    char *map;
+    size_t maplen;
+    int mapfd;
+    /* the compressed file, NULL if it is not - map is the text inflated
+     * from it then and mapfd the descriptor of the compressed file */
+    struct editorGzip *gz;
+    /* number of changes since the file was opened or saved */
+    int dirty;
+    /* edits that can be undone and redone */
+    struct undolog undo;
+    /* crash recovery journal of the edits */
+    struct editorSwap swap;
+    /* where the buffer was left when no view shows it, the active view of
+     * background work on it then (editorEnterBuffer()) */
+    struct editorView park;
+    /* rows rendered outside the render ranges of the views (soft wrap
+     * measures rows above and below them), the next trim of the cache
+     * frees them again */
+    int *stray;
+    int numstray, straycap;
+};
+
+/* a screen the editor draws on - the terminal it runs in or, in daemon
+ * mode, the terminal of an attached client, E holds the state of the active
+ * one and the others keep theirs here (editorScreenSwitch()) */
+struct editorScreen {                                                    // {{{2
+    /* socket of the client, -1 for the terminal of the editor and for the
+     * screen of the daemon itself, which is never drawn */
+    int fd;
+    /* frames are written by a thread of the screen */
+    struct editorTermOut out;
+    /* bytes received from the client that are not decoded yet */
+    char *msg;
+    int msglen, msgcap;
+    /* non-zero once the client said hello and frames may be drawn, once it
+     * detached or went away, and while keys arrived that wait for a prompt
+     * of another client */
+    int ready, detach, pending;
+    /* the views the screen is split into, E.views points here while the
+     * screen is active */
+    struct editorView views[KILO_MAX_VIEWS];
+    /* the state in E while another screen is active */
+    int numviews;
+    struct editorView *view;
+    int screenlines, screencols;
+    char statusmsg[80];
+    time_t statusmsg_time;
+    struct editorSearch search;
+    uint64_t *linehash;
+    int framevalid, termattr;
+    char inbuf[KILO_INBUF_SIZE];
+    int inpos, inlen;
+    int infd;
+    int redraw, framewait;
+    double lastframe, redrawat;
+};
+
 struct editorConfig {                                                    // {{{2
+    /* the state of the active view, from cx to framerowsub (struct
+     * editorView has the same fields) */
     /* store the cursor position, cx = horizontal (left to right, zero based),
      * cy = vertical (top to bottom, zero based)*/
     int cx, cy;
+    /* column of the screen the cursor is drawn at, cx is an offset into
+     * the chars of the row, so characters before it may be wider (tabs,
+     * wide characters) or narrower (multibyte characters) */
+    int rx;
     /* row offset for scrolling */
     int rowoff;
-    /* column offset for scrolling */
+    /* column offset for scrolling, in screen columns - in soft wrap mode
+     * the column the screen line of the cursor starts at */
     int coloff;
+    /* non-zero in soft wrap mode - rows longer than the screen continue on
+     * the next screen lines instead of scrolling horizontally */
+    int wrap;
+    /* in soft wrap mode, how many screen lines of row rowoff are above the
+     * screen, 0 otherwise */
+    int rowsub;
+    /* text row of the screen the cursor is drawn at */
+    int ry;
     /* set up global struct to contain the editor state
-     * e.g. width and height of terminal */
+     * e.g. width and height of terminal, screenrows are the rows of the
+     * view used for text, its status bar is drawn below them */
     int screenrows;
     int screencols;
-    /* for now the editor can only display one line of text
-     * -> numrows = {0 / 1} */
-    int numrows;
-    /* make row a dynamically allocated array of erow structs -> make _row_
-     * a pointer */
-    erow *row;
+    /* range of rows [rendlo, rendhi) that may hold a render buffer of their
+     * own, rows outside of it and of the ranges of the other views have
+     * none (render is NULL or shares chars) */
+    int rendlo, rendhi;
+    /* row offset the last frame was drawn with, used to scroll the terminal
+     * contents instead of redrawing them */
+    int framerowoff, framerowsub;
+    /* set while a jump to jumppct percent of the file waits for the index
+     * to reach that far */
+    int jumpwait, jumppct;
+    /* the buffer of the active view */
+    struct editorBuffer *buf;
+    /* the views the screen is split into from top to bottom, and the active
+     * one */
+    struct editorView *views;
+    int numviews;
+    struct editorView *view;
+    /* the screen the views are on, and all screens - the terminal, or the
+     * daemon's own and one per attached client */
+    struct editorScreen *screen;
+    struct editorScreen **screens;
+    int numscreens;
+    /* non-zero in daemon mode, clients attach through the socket listenfd
+     * at sockpath */
+    int daemon;
+    int listenfd;
+    char *sockpath;
+    /* the buffer list, in the order the buffers were opened */
+    struct editorBuffer **bufs;
+    int numbufs, bufcap;
+    /* height of the screen, the views and the message bar below them */
+    int screenlines;
+    /* memory for the undo log of a buffer, from -u */
+    size_t undolimit;
+    /* message shown below the status bar and when it was set, it disappears
+     * after KILO_MESSAGE_SECS */
+    char statusmsg[80];
+    time_t statusmsg_time;
+    /* non-zero if the sparse line index is read from and saved to a
+     * sidecar file next to the opened file */
+    int indexsidecar;
+    /* the search in progress */
+    struct editorSearch search;
+    /* the whole-file search counting its matches */
+    struct editorFindAll findall;
+    /* recently used regexes, compiled */
+    struct regex *regex[KILO_REGEX_CACHE];
+    unsigned long regexuse;
+    /* timers of the hot path, shown in the HUD */
+    struct editorProfile prof;
+    /* shadow copy of the last frame sent to the terminal - one hash of the
+     * line contents per screen row (text rows and status rows), lines whose
+     * hash did not change are not redrawn */
+    uint64_t *linehash;
+    /* zero if the terminal contents are unknown and the next frame has to be
+     * drawn in full */
+    int framevalid;
+    /* attribute the terminal draws with after the output of the frame so
+     * far, ATTR_DEFAULT between frames */
+    int termattr;
+    /* terminal input buffer, bytes inbuf[inpos..inlen) are not consumed yet */
+    char inbuf[KILO_INBUF_SIZE];
+    int inpos, inlen;
+    /* file descriptors watched by the event loop next to stdin, with the
+     * callback that is run when one of them becomes readable */
+    int watchfd[KILO_MAX_WATCH];
+    void (*watchcb[KILO_MAX_WATCH])(int fd);
+    int nwatch;
+    /* self-pipe written to by the SIGWINCH handler */
+    int winchpipe[2];
+    /* set by event callbacks if the screen has to be repainted while the
+     * editor waits for a key */
+    int redraw;
+    /* time the last frame was drawn and the time a coalesced repaint is
+     * due, 0 if none is */
+    double lastframe, redrawat;
+    /* shortest time between two frames in seconds, from the frame rate
+     * limit */
+    double frametime;
+    /* non-zero if a frame was skipped because the terminal had not taken
+     * the one before yet, it is drawn once that output is gone */
+    int framewait;
+    /* non-zero in headless mode - keys are read from a script file instead
+     * of the terminal and frames are rendered into an in-memory buffer */
+    int headless;
+    /* descriptor keys are read from, stdin or the headless script */
+    int infd;
+    /* file the headless output is written to at exit */
+    char *headlessfile;
     struct termios orig_termios;
 };
 
 /* global variable storing editor configuration */
 struct editorConfig E;
 
+// filetypes -------------------------------------------------------------- {{{1
+
+char *C_HL_extensions[] = {".c", ".h", ".cpp", NULL};
+char *C_HL_keywords[] = {
+    "switch", "if", "while", "for", "break", "continue", "return", "else",
+    "struct", "union", "typedef", "static", "enum", "class", "case",
+
+    "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
+    "void|", NULL
+};
+
+/* highlight database */
+struct editorSyntax HLDB[] = {
+    {
+        "c",
+        C_HL_extensions,
+        C_HL_keywords,
+        "//", "/*", "*/",
+        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+    },
+};
+
+/* number of entries in the highlight database */
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+
+// prototypes ------------------------------------------------------------- {{{1
+
+void *kmalloc(size_t size);
+void *kcalloc(size_t n, size_t size);
+void *krealloc(void *p, size_t size);
+void editorProfAlloc();
+void editorRefreshScreen();
+void editorCenterCursor();
+void editorJumpResume();
+void editorFindResume();
+void editorLoadStart(char *map, size_t len);
+void editorAppendSparseBlock(char *base, char *end, int numrows);
+void editorSetStatusMessage(const char *fmt, ...);
+int editorRedrawTimeout();
+void editorRequestRedraw();
+void editorFollowRead();
+void editorFindUpdatePrompt();
+void editorSyntaxInvalidate(int at);
+double editorNow();
+void editorDrainOutput();
+void editorUndoRecord(int op, int row, int col, const char *s, int len);
+int editorTextMatches(int row, int col, const char *s, int len);
+void editorSwapRecord(int op, int row, int col, const char *s, int len);
+void editorSwapStop(int discard);
+void editorLoadWait(int rows);
+void editorUndoReset();
+int reParseAlt(struct reparser *ps);
+char *editorPrompt(char *prompt, void (*callback)(char *, int));
+void editorRowsShifted(int at, int n);
+int editorOtherViewsRender(int lo, int hi);
+struct editorView *editorNextView(struct editorView *v);
+struct editorView *editorEnterBuffer(struct editorBuffer *b);
+void editorSwitchView(struct editorView *v);
+int editorViewVisible();
+void editorBufferIdentify();
+struct loadpiece *editorLoadNewPiece(int size);
+void editorGzPin(struct editorGzip *gz, const char *from, const char *to);
+void editorGzUnpin(struct editorGzip *gz, const char *from, const char *to);
+int editorClientFill(int timeout);
+void handleSigWinch(int sig);
+
 // terminal --------------------------------------------------------------- {{{1
 
 void die(const char *s) {                                                // {{{2
     /* clear the screen and reposition the cursor at the start of screen */
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
+    if (!E.headless) {
+        /* after the rest of the frame the terminal did not take yet */
+        editorDrainOutput();
+        write(STDOUT_FILENO, "\x1b[2J", 4);
+        write(STDOUT_FILENO, "\x1b[H", 3);
+    }
 
     /* from <stdio.h> - prints error message based on global variable errno */
     perror(s);
@@ -101,6 +1259,8 @@ void disableRawMode() {                                                  // {{{2
     /* reset the terminal attributes after program exit,
      * test the tcsetattr for error
      * use settings from stored global struct */
+    /* after the output the terminal did not take yet */
+    editorDrainOutput();
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
         die("tcsetattr");
 }
@@ -140,9 +1300,11 @@ void enableRawMode() {                                                   // {{{2
     /* control characters field <termios.h>
      * VMIN - minimum number of bytes of input needed before read() can return
      * VTIME - maximum amount of time to wait before read() returns (1 = 0.1s)
-     * if read() times out the return value is 0, otherwise number of bytes read */
+     * both are 0 so read() never blocks, waiting for input is done by poll()
+     * in editorWaitInput() which sleeps until there is something to do
+     * instead of waking up ten times a second */
     raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VTIME] = 0;
 
     /* TCSAFLUSH: when to apply flag change - waits for pending output to be
      * written to the terminal, discards any unread input
@@ -150,17 +1312,145 @@ void enableRawMode() {                                                   // {{{2
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
 }
 
+void editorWatchFd(int fd, void (*cb)(int fd)) {                         // {{{2
+    /* register _fd_ with the event loop, _cb_ is called from
+     * editorWaitInput() whenever the descriptor is readable */
+    if (E.nwatch == KILO_MAX_WATCH) die("editorWatchFd");
+    E.watchfd[E.nwatch] = fd;
+    E.watchcb[E.nwatch] = cb;
+    E.nwatch++;
+}
+
+void editorUnwatchFd(int fd) {                                           // {{{2
+    /* remove _fd_ from the event loop */
+    int j;
+    for (j = 0; j < E.nwatch; j++) {
+        if (E.watchfd[j] != fd) continue;
+        E.nwatch--;
+        E.watchfd[j] = E.watchfd[E.nwatch];
+        E.watchcb[j] = E.watchcb[E.nwatch];
+        return;
+    }
+}
+
+int editorWatched(int fd, void (*cb)(int fd)) {                         // {{{2
+    /* non-zero if _fd_ is registered with callback _cb_ */
+    int j;
+    for (j = 0; j < E.nwatch; j++)
+        if (E.watchfd[j] == fd && E.watchcb[j] == cb) return 1;
+    return 0;
+}
+
+int editorWaitInput(int timeout) {                                       // {{{2
+    /* the event loop - sleep in poll() until stdin or one of the watched
+     * descriptors is readable or _timeout_ milliseconds pass (-1 = forever),
+     * callbacks of ready descriptors are run here
+     * returns non-zero if stdin is readable */
+    struct pollfd pfd[KILO_MAX_WATCH + 1];
+    void (*cb[KILO_MAX_WATCH])(int fd);
+    int n = E.nwatch;
+    int j;
+
+    pfd[0].fd = E.infd;
+    pfd[0].events = POLLIN;
+    for (j = 0; j < n; j++) {
+        pfd[j + 1].fd = E.watchfd[j];
+        pfd[j + 1].events = POLLIN;
+        cb[j] = E.watchcb[j];
+    }
+
+    int ready = poll(pfd, n + 1, timeout);
+    if (ready == -1) {
+        /* a signal (e.g. SIGWINCH) interrupted the wait, its self-pipe is
+         * picked up on the next call */
+        if (errno == EINTR) return 0;
+        die("poll");
+    }
+    if (ready == 0) return 0;
+
+    /* run the callbacks, a callback may unregister descriptors so the
+     * snapshot in pfd and cb is used - one that was unregistered meanwhile
+     * is skipped */
+    for (j = 0; j < n; j++)
+        if ((pfd[j + 1].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                editorWatched(pfd[j + 1].fd, cb[j]))
+            cb[j](pfd[j + 1].fd);
+
+    return (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+}
+
+int editorFillInput(int timeout) {                                       // {{{2
+    /* refill the empty input buffer with everything that is available on
+     * standard input using a single read(), waits at most _timeout_
+     * milliseconds (-1 = forever, but an event that needs a repaint ends the
+     * wait as well)
+     * returns the number of bytes read, 0 if nothing arrived */
+    if (E.daemon) return editorClientFill(timeout);
+    if (!editorWaitInput(timeout)) return 0;
+
+    int nread = read(E.infd, E.inbuf, sizeof(E.inbuf));
+    /* test read for error, errno and EAGAIN come from <errno.h>,
+     * EAGAIN is not an error as stdin may have been drained already */
+    if (nread == -1 && errno != EAGAIN && errno != EINTR) die("read");
+    /* the end of a headless script ends the session, after showing the
+     * final state */
+    if (nread == 0 && E.headless) {
+        editorRefreshScreen();
+        /* like a lost terminal, the journals stay for the next session */
+        int j;
+        for (j = 0; j < E.numbufs; j++) {
+            editorEnterBuffer(E.bufs[j]);
+            editorSwapStop(0);
+        }
+        exit(0);
+    }
+    if (nread < 0) nread = 0;
+    E.inpos = 0;
+    E.inlen = nread;
+    return nread;
+}
+
+int editorReadByte(char *c, int timeout) {                               // {{{2
+    /* take one byte of input from the buffer, refilling it if it is empty,
+     * returns 0 if no byte arrived within _timeout_ milliseconds */
+    if (E.inpos == E.inlen && editorFillInput(timeout) == 0) return 0;
+    *c = E.inbuf[E.inpos++];
+    return 1;
+}
+
+int editorReadByteWait(char *c, int timeout) {                           // {{{2
+    /* editorReadByte() that waits the whole _timeout_ milliseconds, events
+     * that end the wait early (e.g. the terminal taking a frame) are
+     * not mistaken for the end of an escape sequence */
+    double end = editorNow() + timeout / 1000.0;
+    while (!editorReadByte(c, timeout)) {
+        timeout = (int)((end - editorNow()) * 1000);
+        if (timeout <= 0) return 0;
+    }
+    return 1;
+}
+
+int editorInputPending() {                                               // {{{2
+    /* non-zero if there is input that was not processed yet, either already
+     * buffered or still waiting in the terminal */
+    if (E.inpos < E.inlen) return 1;
+
+    /* poll() from <poll.h> with zero timeout just checks stdin */
+    struct pollfd pfd = {E.infd, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
 int editorReadKey() {                                                    // {{{2
     /* wait for one keypress and return it
-     * low level terminal interaction */
-    int nread;
+     * low level terminal interaction, bytes are taken from the input buffer
+     * so a paste or key repeat costs one read() for all queued keys */
     char c;
-    /* read 1 character from standard input */
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        /* test read for error, errno and EAGAIN come from <errno.h>,
-         * we don't treat EAGAIN as error for portability to Cygwin
-         * (it returns -1 with EAGAIN if read() times out */
-        if (nread == -1 && errno != EAGAIN) die("read");
+    /* read 1 character from the input buffer, blocking until there is one,
+     * repaint if an event (e.g. a resize) asked for it meanwhile */
+    while (!editorReadByte(&c, editorRedrawTimeout())) {
+        /* a client that went away leaves every prompt with escape */
+        if (E.screen->detach) return '\x1b';
+        if (E.redraw) editorRefreshScreen();
     }
 
     /* if we read an escape character */
@@ -169,15 +1459,16 @@ int editorReadKey() {                                                    // {{{2
          * sequences apart from arrow keys */
         char seq[3];
 
-        /* automatically read tow more bytes into seq buffer, if the read()
-         * function times out, assume the user pressed <esc> and return
-         * that */
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+        /* automatically read tow more bytes into seq buffer, if they do not
+         * arrive within KILO_ESC_TIMEOUT, assume the user pressed <esc> and
+         * return that */
+        if (!editorReadByteWait(&seq[0], KILO_ESC_TIMEOUT)) return '\x1b';
+        if (!editorReadByteWait(&seq[1], KILO_ESC_TIMEOUT)) return '\x1b';
 
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+                if (!editorReadByteWait(&seq[2], KILO_ESC_TIMEOUT))
+                    return '\x1b';
                 if (seq[2] == '~') {
                     switch (seq[1]) {
                         /* \x1b[1~ = Home */
@@ -225,8 +1516,9 @@ int editorReadKey() {                                                    // {{{2
          * escape */
         return '\x1b';
     } else {
-        /* return read character */
-        return c;
+        /* return read character, bytes of UTF-8 sequences are inserted one by
+         * one */
+        return (unsigned char)c;
     }
 }
 
@@ -238,11 +1530,12 @@ int getCursorPosition(int *rows, int *cols) {                            // {{{2
     /* send [6n command to query the terminal for cursor position
      * (n = device status report request, 6 = cursor position */
     /* returns an escape sequence to stdout: \x1b[24;80R or similar */
+    editorDrainOutput();
     if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
 
     while (i < sizeof(buf) - 1) {
         /* read chars into the prepared buffer */
-        if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
+        if (!editorReadByteWait(&buf[i], KILO_QUERY_TIMEOUT)) break;
         /* stop on 'R' character */
         if (buf[i] == 'R') break;
         i++;
@@ -257,8 +1550,6 @@ int getCursorPosition(int *rows, int *cols) {                            // {{{2
      * and save the result into rows and cols variable */
     if (sscanf(&buf[2], "%d;%d", rows, cols) != 2) return -1;
 
-    editorReadKey();
-
     return 1;
 }
 
@@ -274,6 +1565,7 @@ int getWindowSize(int *rows, int *cols) {                                // {{{2
         /* if ioctl() cannot return terminal size, position the cursor at the
          * end: [999C moves cursor right by 999 columns (stops at screen edge)
          *      [999B moves cursor down by 999 row (stops at screen edge) */
+        editorDrainOutput();
         if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12) return -1;
         return getCursorPosition(rows, cols);
     } else {
@@ -284,387 +1576,8681 @@ int getWindowSize(int *rows, int *cols) {                                // {{{2
     }
 }
 
-// row operations --------------------------------------------------------- {{{1
-
-void editorUpdateRow(erow *row) {                                        // {{{2
-    /* rendering tab characters as 8 spaces */
-    int tabs = 0;
-    int j;
-    /* count the number of chars in line */
-    for (j = 0; j < row->size; j++)
-        if (row->chars[j] == '\t') tabs++;
+// byte scanning ---------------------------------------------------------- {{{1
 
-    /* free memory allocated for render array */
-    free(row->render);
-    /* allocate memory for the line, tabs are 8 spaces (1 for character and add 7 */
-    row->render = malloc(row->size + tabs * (KILO_TAB_STOP - 1) + 1);
+/* kernels used to find tabs, newlines and search strings, every kernel has a
+ * scalar version and vector versions, scanInit() points scanFindByte,
+ * scanCountByte and scanFindString to the best one the cpu supports */
 
-    int idx;
-    /* for now just copy the contents of actual line to render array */
-    for (j = 0; j < row->size; j++) {
-        /* render tabs */
-        if (row->chars[j] == '\t') {
-            row->render[idx++] = ' ';
-            /* pad with spaces until tabstop = column number divisible by 8 */
-            while (idx % KILO_TAB_STOP != 0) row->render[idx++] = ' ';
-        } else {
-            row->render[idx++] = row->chars[j];
-        }
-    }
-    /* end the array with nullchar */
-    row->render[idx] = '\0';
-    /* render size = number of characters */
-    row->rsize = idx;
+const char *scanFindByteScalar(const char *s, size_t n, int c) {         // {{{2
+    /* return pointer to the first byte _c_ in s[0..n), NULL if there is none
+     * memchr() from <string.h> is the portable fallback */
+    return memchr(s, c, n);
 }
 
-void editorAppendRow(char *s, size_t len) {                              // {{{2
-    /* have to tell realloc() how many bytes to allocate */
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-
-    /* set _at_ to th index of the new row */
-    int at = E.numrows;
-    /* set size field to the length of the row */
-    E.row[at].size = len;
-    /* from <stdlib.h>
-     * allocate enough memory for the row */
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
+size_t scanCountByteScalar(const char *s, size_t n, int c) {             // {{{2
+    /* return the number of bytes _c_ in s[0..n) */
+    size_t count = 0;
+    size_t j;
+    for (j = 0; j < n; j++)
+        if (s[j] == (char)c) count++;
+    return count;
+}
 
-    /* initialize render array */
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    editorUpdateRow(&E.row[at]);
+const char *scanFindStringScalar(const char *s, size_t n, const char *q,
+        size_t m) {                                                      // {{{2
+    /* return pointer to the first occurrence of q[0..m) in s[0..n), NULL if
+     * there is none
+     * memmem() (a GNU extension in <string.h>) is a two-way search in glibc,
+     * linear even for the worst case patterns */
+    return memmem(s, n, q, m);
+}
 
-    /* set numrows + 1 */
-    E.numrows++;
+const char *scanFindStringTail(const char *s, size_t n, const char *q,
+        size_t m) {                                                      // {{{2
+    /* plain loop for the last few bytes the vector kernels leave over */
+    size_t j;
+    for (j = 0; j + m <= n; j++)
+        if (s[j] == q[0] && memcmp(s + j + 1, q + 1, m - 1) == 0)
+            return s + j;
+    return NULL;
 }
 
-// file i/o --------------------------------------------------------------- {{{1
+#ifdef KILO_SIMD_X86
+__attribute__((target("sse2")))
+const char *scanFindByteSse2(const char *s, size_t n, int c) {           // {{{2
+    /* compare 16 bytes at a time, movemask turns the comparison into a bit
+     * mask with one bit per byte */
+    __m128i needle = _mm_set1_epi8((char)c);
+    size_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + j));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (mask) return s + j + __builtin_ctz(mask);
+    }
+    for (; j < n; j++)
+        if (s[j] == (char)c) return s + j;
+    return NULL;
+}
 
-void editorOpen(char *filename) {                                        // {{{2
-    /* FILE, fopen() and getline() come from <stdio.h>
-     * editorOpen() takes filename as an argument and uses fopen() to open
-     * the file for reading */
-    FILE *fp = fopen(filename, "r");
-    if (!fp) die("fopen");
+__attribute__((target("sse2")))
+size_t scanCountByteSse2(const char *s, size_t n, int c) {               // {{{2
+    /* matching bytes compare to -1, subtracting them counts matches per byte
+     * lane, the lanes are summed with sad before they can overflow */
+    __m128i needle = _mm_set1_epi8((char)c);
+    __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    size_t j = 0;
+    while (j + 16 <= n) {
+        __m128i acc = zero;
+        int round = 0;
+        for (; round < 255 && j + 16 <= n; round++, j += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + j));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, needle));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+    }
+    size_t count = (size_t)_mm_cvtsi128_si64(total) +
+                   (size_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
+    return count + scanCountByteScalar(s + j, n - j, c);
+}
 
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    /* get line and linelen from getline() instead of hardcoded values
-     * getline() is useful for reading lines from a file if we do not know
-     * how much memory to allocate for it
-     * first we pass it a null _line_ pointer and a _linecap_ (line capacity)
-     * of 0. getline() reads a line into memory and sets _line_ to point to
-     * the memory, also sets _linecap_ to know how much memory was allocated.
-     * its return value is the length of the line read or -1 if at the EOF.
-     * later we'll feed _line_ and _linecap_ back into getline() and it will
-     * try to reuse the memory already allocated as long the _linecap_ is
-     * big enough */
-    /* while loop to read the whole file, the while loop works because
-     * getline() returns -1 at EOF */
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        /* strip newline and carriage return chars from the end of the line */
-        while (linelen > 0 && (line[linelen - 1] == '\n' ||
-                               line[linelen - 1] == '\r'))
-            linelen--;
-        editorAppendRow(line, linelen);
+__attribute__((target("avx2")))
+const char *scanFindByteAvx2(const char *s, size_t n, int c) {           // {{{2
+    /* same as the sse2 kernel with 32 bytes at a time */
+    __m256i needle = _mm256_set1_epi8((char)c);
+    size_t j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + j));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (mask) return s + j + __builtin_ctz(mask);
     }
-    free(line);
-    fclose(fp);
+    /* the tail is done by the legacy encoded sse2 kernel, clear the upper
+     * halves of the ymm registers first or every switch between the two
+     * costs an avx/sse transition stall, which dominates on short lines */
+    _mm256_zeroupper();
+    return scanFindByteSse2(s + j, n - j, c);
 }
 
-// append buffer ---------------------------------------------------------- {{{1
+__attribute__((target("sse2")))
+const char *scanFindStringSse2(const char *s, size_t n, const char *q,
+        size_t m) {                                                      // {{{2
+    /* compare the first and the last byte of the query against 16
+     * positions at a time, only positions where both match are compared in
+     * full - on normal text that filters out nearly every position, so a
+     * miss runs at the speed of two loads and compares per 16 bytes */
+    if (m == 0) return s;
+    if (m > n) return NULL;
+    __m128i first = _mm_set1_epi8(q[0]);
+    __m128i last = _mm_set1_epi8(q[m - 1]);
+    size_t j = 0;
+    for (; j + m - 1 + 16 <= n; j += 16) {
+        __m128i bf = _mm_loadu_si128((const __m128i *)(s + j));
+        __m128i bl = _mm_loadu_si128((const __m128i *)(s + j + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+                _mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (m <= 2 || memcmp(s + j + bit + 1, q + 1, m - 2) == 0)
+                return s + j + bit;
+            mask &= mask - 1;
+        }
+    }
+    return scanFindStringTail(s + j, n - j, q, m);
+}
 
-/* struct for append buffer to print whole screen at once */
-struct abuf {                                                            // {{{2
-    char *b;
-    int len;
-};
+__attribute__((target("avx2")))
+const char *scanFindStringAvx2(const char *s, size_t n, const char *q,
+        size_t m) {                                                      // {{{2
+    /* same as the sse2 kernel with 32 positions at a time */
+    if (m == 0) return s;
+    if (m > n) return NULL;
+    __m256i first = _mm256_set1_epi8(q[0]);
+    __m256i last = _mm256_set1_epi8(q[m - 1]);
+    size_t j = 0;
+    for (; j + m - 1 + 32 <= n; j += 32) {
+        __m256i bf = _mm256_loadu_si256((const __m256i *)(s + j));
+        __m256i bl = _mm256_loadu_si256((const __m256i *)(s + j + m - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+                _mm256_cmpeq_epi8(bf, first), _mm256_cmpeq_epi8(bl, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (m <= 2 || memcmp(s + j + bit + 1, q + 1, m - 2) == 0) {
+                _mm256_zeroupper();
+                return s + j + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    _mm256_zeroupper();
+    return scanFindStringTail(s + j, n - j, q, m);
+}
 
-/* constructor for abuf type */
-#define ABUF_INIT {NULL, 0}
+__attribute__((target("avx2")))
+size_t scanCountByteAvx2(const char *s, size_t n, int c) {               // {{{2
+    __m256i needle = _mm256_set1_epi8((char)c);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t j = 0;
+    while (j + 32 <= n) {
+        __m256i acc = zero;
+        int round = 0;
+        for (; round < 255 && j + 32 <= n; round++, j += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(s + j));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, needle));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(acc, zero));
+    }
+    size_t count = (size_t)_mm256_extract_epi64(total, 0) +
+                   (size_t)_mm256_extract_epi64(total, 1) +
+                   (size_t)_mm256_extract_epi64(total, 2) +
+                   (size_t)_mm256_extract_epi64(total, 3);
+    _mm256_zeroupper();
+    return count + scanCountByteSse2(s + j, n - j, c);
+}
+#endif
 
-void abAppend(struct abuf *ab, const char *s, int len) {                 // {{{2
-    /* realloc() from <stdlib.h>
-     * first make sure to have enough memory - realloc returns block of
-     * memory the size of current string + the size of string we are appending
-     * realloc() either extends the current memory block or will take care of
-     * freeing the current memory block and allocating a new one */
-    char *new = realloc(ab->b, ab->len + len);
+#ifdef KILO_SIMD_NEON
+const char *scanFindByteNeon(const char *s, size_t n, int c) {           // {{{2
+    /* compare 16 bytes at a time, vmaxvq tells whether any lane matched */
+    uint8x16_t needle = vdupq_n_u8((uint8_t)c);
+    size_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t *)(s + j)), needle);
+        if (vmaxvq_u8(eq)) break;
+    }
+    for (; j < n; j++)
+        if (s[j] == (char)c) return s + j;
+    return NULL;
+}
 
-    if (new == NULL) return;
-    /* copy string s to the end of the current string in the buffer */
-    memcpy(&new[ab->len], s, len);
-    /* update abuf pointer and length */
-    ab->b = new;
-    ab->len += len;
+size_t scanCountByteNeon(const char *s, size_t n, int c) {               // {{{2
+    /* matching lanes are 0xff, shifting them down to 1 counts matches per
+     * byte lane, the lanes are summed before they can overflow */
+    uint8x16_t needle = vdupq_n_u8((uint8_t)c);
+    size_t count = 0;
+    size_t j = 0;
+    while (j + 16 <= n) {
+        uint8x16_t acc = vdupq_n_u8(0);
+        int round = 0;
+        for (; round < 255 && j + 16 <= n; round++, j += 16) {
+            uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t *)(s + j)), needle);
+            acc = vaddq_u8(acc, vshrq_n_u8(eq, 7));
+        }
+        count += vaddlvq_u8(acc);
+    }
+    return count + scanCountByteScalar(s + j, n - j, c);
 }
 
-void abFree(struct abuf *ab) {                                           // {{{2
-    /* free() from <stdlib.h>
-     * destructor that deallocates the buffer dynamic memory */
-    free(ab->b);
+const char *scanFindStringNeon(const char *s, size_t n, const char *q,
+        size_t m) {                                                      // {{{2
+    /* first and last byte filter like the x86 kernels, a block of 16
+     * positions with any candidate is checked with the plain loop */
+    if (m == 0) return s;
+    if (m > n) return NULL;
+    uint8x16_t first = vdupq_n_u8((uint8_t)q[0]);
+    uint8x16_t last = vdupq_n_u8((uint8_t)q[m - 1]);
+    size_t j = 0;
+    for (; j + m - 1 + 16 <= n; j += 16) {
+        uint8x16_t eq = vandq_u8(
+                vceqq_u8(vld1q_u8((const uint8_t *)(s + j)), first),
+                vceqq_u8(vld1q_u8((const uint8_t *)(s + j + m - 1)), last));
+        if (vmaxvq_u8(eq)) {
+            const char *hit = scanFindStringTail(s + j, 16 + m - 1, q, m);
+            if (hit) return hit;
+        }
+    }
+    return scanFindStringTail(s + j, n - j, q, m);
 }
+#endif
 
-// output ----------------------------------------------------------------- {{{1
+/* the kernels in use */
+const char *(*scanFindByte)(const char *s, size_t n, int c) = scanFindByteScalar;
+size_t (*scanCountByte)(const char *s, size_t n, int c) = scanCountByteScalar;
+const char *(*scanFindString)(const char *s, size_t n, const char *q,
+        size_t m) = scanFindStringScalar;
 
-void editorScroll() {                                                    // {{{2
-    /* if the cursor is above the visible window scroll to the cursor
-     * position */
-    if (E.cy < E.rowoff) {
-        E.rowoff = E.cy;
+const char *scanInit() {                                                 // {{{2
+    /* pick the kernels at runtime from what the cpu supports, return the
+     * name of the instruction set in use */
+#if defined(KILO_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scanFindByte = scanFindByteAvx2;
+        scanCountByte = scanCountByteAvx2;
+        scanFindString = scanFindStringAvx2;
+        return "avx2";
     }
-    /* if the cursor is below visible window, scroll accordingly */
-    if (E.cy >= E.rowoff + E.screenrows) {
-        E.rowoff = E.cy - E.screenrows + 1;
+    if (__builtin_cpu_supports("sse2")) {
+        scanFindByte = scanFindByteSse2;
+        scanCountByte = scanCountByteSse2;
+        scanFindString = scanFindStringSse2;
+        return "sse2";
     }
-    /* if the cursor is left of the visible window scroll to the cursor
+#elif defined(KILO_SIMD_NEON)
+    /* NEON is always available on aarch64 */
+    scanFindByte = scanFindByteNeon;
+    scanCountByte = scanCountByteNeon;
+    scanFindString = scanFindStringNeon;
+    return "neon";
+#endif
+    scanFindByte = scanFindByteScalar;
+    scanCountByte = scanCountByteScalar;
+    scanFindString = scanFindStringScalar;
+    return "scalar";
+}
+
+int scanHasHigh(const char *s, size_t n) {                               // {{{2
+    /* non-zero if s[0..n) has a byte >= 0x80, i.e. is not plain ASCII -
+     * eight bytes at a time, so it is not worth a kernel of its own */
+    const uint64_t high = 0x8080808080808080ULL;
+    size_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        uint64_t w;
+        memcpy(&w, s + j, 8);
+        if (w & high) return 1;
+    }
+    for (; j < n; j++)
+        if (s[j] & 0x80) return 1;
+    return 0;
+}
+
+// unicode ---------------------------------------------------------------- {{{1
+
+/* code point ranges that take no column (combining marks, format
+ * characters, Hangul medial vowels) and two columns (East Asian wide and
+ * fullwidth, emoji), the widths the glibc 2.36 C.UTF-8 locale gives them -
+ * unassigned code points inside a range take its width, code points below
+ * U+0300 are all one column wide */
+struct charrange {                                                       // {{{2
+    uint32_t lo, hi;
+};
+
+static const struct charrange zerowidth[] = {
+    {0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x05bf, 0x05bf},
+    {0x05c1, 0x05c2}, {0x05c4, 0x05c5}, {0x05c7, 0x05c7}, {0x0610, 0x061a},
+    {0x061c, 0x061c}, {0x064b, 0x065f}, {0x0670, 0x0670}, {0x06d6, 0x06dc},
+    {0x06df, 0x06e4}, {0x06e7, 0x06e8}, {0x06ea, 0x06ed}, {0x0711, 0x0711},
+    {0x0730, 0x074a}, {0x07a6, 0x07b0}, {0x07eb, 0x07f3}, {0x07fd, 0x07fd},
+    {0x0816, 0x0819}, {0x081b, 0x0823}, {0x0825, 0x0827}, {0x0829, 0x082d},
+    {0x0859, 0x085b}, {0x0898, 0x089f}, {0x08ca, 0x08e1}, {0x08e3, 0x0902},
+    {0x093a, 0x093a}, {0x093c, 0x093c}, {0x0941, 0x0948}, {0x094d, 0x094d},
+    {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0981, 0x0981}, {0x09bc, 0x09bc},
+    {0x09c1, 0x09c4}, {0x09cd, 0x09cd}, {0x09e2, 0x09e3}, {0x09fe, 0x0a02},
+    {0x0a3c, 0x0a3c}, {0x0a41, 0x0a51}, {0x0a70, 0x0a71}, {0x0a75, 0x0a75},
+    {0x0a81, 0x0a82}, {0x0abc, 0x0abc}, {0x0ac1, 0x0ac8}, {0x0acd, 0x0acd},
+    {0x0ae2, 0x0ae3}, {0x0afa, 0x0b01}, {0x0b3c, 0x0b3c}, {0x0b3f, 0x0b3f},
+    {0x0b41, 0x0b44}, {0x0b4d, 0x0b56}, {0x0b62, 0x0b63}, {0x0b82, 0x0b82},
+    {0x0bc0, 0x0bc0}, {0x0bcd, 0x0bcd}, {0x0c00, 0x0c00}, {0x0c04, 0x0c04},
+    {0x0c3c, 0x0c3c}, {0x0c3e, 0x0c40}, {0x0c46, 0x0c56}, {0x0c62, 0x0c63},
+    {0x0c81, 0x0c81}, {0x0cbc, 0x0cbc}, {0x0cbf, 0x0cbf}, {0x0cc6, 0x0cc6},
+    {0x0ccc, 0x0ccd}, {0x0ce2, 0x0ce3}, {0x0d00, 0x0d01}, {0x0d3b, 0x0d3c},
+    {0x0d41, 0x0d44}, {0x0d4d, 0x0d4d}, {0x0d62, 0x0d63}, {0x0d81, 0x0d81},
+    {0x0dca, 0x0dca}, {0x0dd2, 0x0dd6}, {0x0e31, 0x0e31}, {0x0e34, 0x0e3a},
+    {0x0e47, 0x0e4e}, {0x0eb1, 0x0eb1}, {0x0eb4, 0x0ebc}, {0x0ec8, 0x0ecd},
+    {0x0f18, 0x0f19}, {0x0f35, 0x0f35}, {0x0f37, 0x0f37}, {0x0f39, 0x0f39},
+    {0x0f71, 0x0f7e}, {0x0f80, 0x0f84}, {0x0f86, 0x0f87}, {0x0f8d, 0x0fbc},
+    {0x0fc6, 0x0fc6}, {0x102d, 0x1030}, {0x1032, 0x1037}, {0x1039, 0x103a},
+    {0x103d, 0x103e}, {0x1058, 0x1059}, {0x105e, 0x1060}, {0x1071, 0x1074},
+    {0x1082, 0x1082}, {0x1085, 0x1086}, {0x108d, 0x108d}, {0x109d, 0x109d},
+    {0x1160, 0x11ff}, {0x135d, 0x135f}, {0x1712, 0x1714}, {0x1732, 0x1733},
+    {0x1752, 0x1753}, {0x1772, 0x1773}, {0x17b4, 0x17b5}, {0x17b7, 0x17bd},
+    {0x17c6, 0x17c6}, {0x17c9, 0x17d3}, {0x17dd, 0x17dd}, {0x180b, 0x180f},
+    {0x1885, 0x1886}, {0x18a9, 0x18a9}, {0x1920, 0x1922}, {0x1927, 0x1928},
+    {0x1932, 0x1932}, {0x1939, 0x193b}, {0x1a17, 0x1a18}, {0x1a1b, 0x1a1b},
+    {0x1a56, 0x1a56}, {0x1a58, 0x1a60}, {0x1a62, 0x1a62}, {0x1a65, 0x1a6c},
+    {0x1a73, 0x1a7f}, {0x1ab0, 0x1b03}, {0x1b34, 0x1b34}, {0x1b36, 0x1b3a},
+    {0x1b3c, 0x1b3c}, {0x1b42, 0x1b42}, {0x1b6b, 0x1b73}, {0x1b80, 0x1b81},
+    {0x1ba2, 0x1ba5}, {0x1ba8, 0x1ba9}, {0x1bab, 0x1bad}, {0x1be6, 0x1be6},
+    {0x1be8, 0x1be9}, {0x1bed, 0x1bed}, {0x1bef, 0x1bf1}, {0x1c2c, 0x1c33},
+    {0x1c36, 0x1c37}, {0x1cd0, 0x1cd2}, {0x1cd4, 0x1ce0}, {0x1ce2, 0x1ce8},
+    {0x1ced, 0x1ced}, {0x1cf4, 0x1cf4}, {0x1cf8, 0x1cf9}, {0x1dc0, 0x1dff},
+    {0x200b, 0x200f}, {0x202a, 0x202e}, {0x2060, 0x206f}, {0x20d0, 0x20f0},
+    {0x2cef, 0x2cf1}, {0x2d7f, 0x2d7f}, {0x2de0, 0x2dff}, {0x302a, 0x302d},
+    {0x3099, 0x309a}, {0xa66f, 0xa672}, {0xa674, 0xa67d}, {0xa69e, 0xa69f},
+    {0xa6f0, 0xa6f1}, {0xa802, 0xa802}, {0xa806, 0xa806}, {0xa80b, 0xa80b},
+    {0xa825, 0xa826}, {0xa82c, 0xa82c}, {0xa8c4, 0xa8c5}, {0xa8e0, 0xa8f1},
+    {0xa8ff, 0xa8ff}, {0xa926, 0xa92d}, {0xa947, 0xa951}, {0xa980, 0xa982},
+    {0xa9b3, 0xa9b3}, {0xa9b6, 0xa9b9}, {0xa9bc, 0xa9bd}, {0xa9e5, 0xa9e5},
+    {0xaa29, 0xaa2e}, {0xaa31, 0xaa32}, {0xaa35, 0xaa36}, {0xaa43, 0xaa43},
+    {0xaa4c, 0xaa4c}, {0xaa7c, 0xaa7c}, {0xaab0, 0xaab0}, {0xaab2, 0xaab4},
+    {0xaab7, 0xaab8}, {0xaabe, 0xaabf}, {0xaac1, 0xaac1}, {0xaaec, 0xaaed},
+    {0xaaf6, 0xaaf6}, {0xabe5, 0xabe5}, {0xabe8, 0xabe8}, {0xabed, 0xabed},
+    {0xd7b0, 0xd7fb}, {0xfb1e, 0xfb1e}, {0xfe00, 0xfe0f}, {0xfe20, 0xfe2f},
+    {0xfeff, 0xfeff}, {0xfff9, 0xfffb}, {0x101fd, 0x101fd},
+    {0x102e0, 0x102e0}, {0x10376, 0x1037a}, {0x10a01, 0x10a0f},
+    {0x10a38, 0x10a3f}, {0x10ae5, 0x10ae6}, {0x10d24, 0x10d27},
+    {0x10eab, 0x10eac}, {0x10f46, 0x10f50}, {0x10f82, 0x10f85},
+    {0x11001, 0x11001}, {0x11038, 0x11046}, {0x11070, 0x11070},
+    {0x11073, 0x11074}, {0x1107f, 0x11081}, {0x110b3, 0x110b6},
+    {0x110b9, 0x110ba}, {0x110c2, 0x110c2}, {0x11100, 0x11102},
+    {0x11127, 0x1112b}, {0x1112d, 0x11134}, {0x11173, 0x11173},
+    {0x11180, 0x11181}, {0x111b6, 0x111be}, {0x111c9, 0x111cc},
+    {0x111cf, 0x111cf}, {0x1122f, 0x11231}, {0x11234, 0x11234},
+    {0x11236, 0x11237}, {0x1123e, 0x1123e}, {0x112df, 0x112df},
+    {0x112e3, 0x112ea}, {0x11300, 0x11301}, {0x1133b, 0x1133c},
+    {0x11340, 0x11340}, {0x11366, 0x11374}, {0x11438, 0x1143f},
+    {0x11442, 0x11444}, {0x11446, 0x11446}, {0x1145e, 0x1145e},
+    {0x114b3, 0x114b8}, {0x114ba, 0x114ba}, {0x114bf, 0x114c0},
+    {0x114c2, 0x114c3}, {0x115b2, 0x115b5}, {0x115bc, 0x115bd},
+    {0x115bf, 0x115c0}, {0x115dc, 0x115dd}, {0x11633, 0x1163a},
+    {0x1163d, 0x1163d}, {0x1163f, 0x11640}, {0x116ab, 0x116ab},
+    {0x116ad, 0x116ad}, {0x116b0, 0x116b5}, {0x116b7, 0x116b7},
+    {0x1171d, 0x1171f}, {0x11722, 0x11725}, {0x11727, 0x1172b},
+    {0x1182f, 0x11837}, {0x11839, 0x1183a}, {0x1193b, 0x1193c},
+    {0x1193e, 0x1193e}, {0x11943, 0x11943}, {0x119d4, 0x119db},
+    {0x119e0, 0x119e0}, {0x11a01, 0x11a0a}, {0x11a33, 0x11a38},
+    {0x11a3b, 0x11a3e}, {0x11a47, 0x11a47}, {0x11a51, 0x11a56},
+    {0x11a59, 0x11a5b}, {0x11a8a, 0x11a96}, {0x11a98, 0x11a99},
+    {0x11c30, 0x11c3d}, {0x11c3f, 0x11c3f}, {0x11c92, 0x11ca7},
+    {0x11caa, 0x11cb0}, {0x11cb2, 0x11cb3}, {0x11cb5, 0x11cb6},
+    {0x11d31, 0x11d45}, {0x11d47, 0x11d47}, {0x11d90, 0x11d91},
+    {0x11d95, 0x11d95}, {0x11d97, 0x11d97}, {0x11ef3, 0x11ef4},
+    {0x13430, 0x13438}, {0x16af0, 0x16af4}, {0x16b30, 0x16b36},
+    {0x16f4f, 0x16f4f}, {0x16f8f, 0x16f92}, {0x16fe4, 0x16fe4},
+    {0x1bc9d, 0x1bc9e}, {0x1bca0, 0x1bca3}, {0x1cf00, 0x1cf46},
+    {0x1d167, 0x1d169}, {0x1d173, 0x1d182}, {0x1d185, 0x1d18b},
+    {0x1d1aa, 0x1d1ad}, {0x1d242, 0x1d244}, {0x1da00, 0x1da36},
+    {0x1da3b, 0x1da6c}, {0x1da75, 0x1da75}, {0x1da84, 0x1da84},
+    {0x1da9b, 0x1daaf}, {0x1e000, 0x1e02a}, {0x1e130, 0x1e136},
+    {0x1e2ae, 0x1e2ae}, {0x1e2ec, 0x1e2ef}, {0x1e8d0, 0x1e8d6},
+    {0x1e944, 0x1e94a}, {0xe0001, 0xe01ef}
+};
+
+static const struct charrange widewidth[] = {
+    {0x1100, 0x115f}, {0x231a, 0x231b}, {0x2329, 0x232a}, {0x23e9, 0x23ec},
+    {0x23f0, 0x23f0}, {0x23f3, 0x23f3}, {0x25fd, 0x25fe}, {0x2614, 0x2615},
+    {0x2648, 0x2653}, {0x267f, 0x267f}, {0x2693, 0x2693}, {0x26a1, 0x26a1},
+    {0x26aa, 0x26ab}, {0x26bd, 0x26be}, {0x26c4, 0x26c5}, {0x26ce, 0x26ce},
+    {0x26d4, 0x26d4}, {0x26ea, 0x26ea}, {0x26f2, 0x26f3}, {0x26f5, 0x26f5},
+    {0x26fa, 0x26fa}, {0x26fd, 0x26fd}, {0x2705, 0x2705}, {0x270a, 0x270b},
+    {0x2728, 0x2728}, {0x274c, 0x274c}, {0x274e, 0x274e}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27b0, 0x27b0}, {0x27bf, 0x27bf},
+    {0x2b1b, 0x2b1c}, {0x2b50, 0x2b50}, {0x2b55, 0x2b55}, {0x2e80, 0x3029},
+    {0x302e, 0x303e}, {0x3041, 0x3096}, {0x309b, 0xa4c6}, {0xa960, 0xa97c},
+    {0xac00, 0xd7a3}, {0xf900, 0xfad9}, {0xfe10, 0xfe19}, {0xfe30, 0xfe6b},
+    {0xff01, 0xff60}, {0xffe0, 0xffe6}, {0x16fe0, 0x16fe3},
+    {0x16ff0, 0x18d08}, {0x1aff0, 0x1b2fb}, {0x1f004, 0x1f004},
+    {0x1f0cf, 0x1f0cf}, {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a},
+    {0x1f200, 0x1f320}, {0x1f32d, 0x1f335}, {0x1f337, 0x1f37c},
+    {0x1f37e, 0x1f393}, {0x1f3a0, 0x1f3ca}, {0x1f3cf, 0x1f3d3},
+    {0x1f3e0, 0x1f3f0}, {0x1f3f4, 0x1f3f4}, {0x1f3f8, 0x1f43e},
+    {0x1f440, 0x1f440}, {0x1f442, 0x1f4fc}, {0x1f4ff, 0x1f53d},
+    {0x1f54b, 0x1f54e}, {0x1f550, 0x1f567}, {0x1f57a, 0x1f57a},
+    {0x1f595, 0x1f596}, {0x1f5a4, 0x1f5a4}, {0x1f5fb, 0x1f64f},
+    {0x1f680, 0x1f6c5}, {0x1f6cc, 0x1f6cc}, {0x1f6d0, 0x1f6d2},
+    {0x1f6d5, 0x1f6df}, {0x1f6eb, 0x1f6ec}, {0x1f6f4, 0x1f6fc},
+    {0x1f7e0, 0x1f7f0}, {0x1f90c, 0x1f93a}, {0x1f93c, 0x1f945},
+    {0x1f947, 0x1f9ff}, {0x1fa70, 0x1faf6}, {0x20000, 0x3134a}
+};
+
+int utf8Decode(const char *s, int len, uint32_t *cp) {                   // {{{2
+    /* decode the UTF-8 sequence at _s_ into _cp_, returns its length, or 0
+     * if it is not a valid sequence (truncated, overlong, a surrogate or a
+     * stray continuation byte) */
+    const unsigned char *u = (const unsigned char *)s;
+    if (u[0] < 0x80) {
+        *cp = u[0];
+        return 1;
+    }
+    int n;
+    uint32_t c, min;
+    if (u[0] >= 0xc2 && u[0] <= 0xdf) {
+        n = 2;
+        c = u[0] & 0x1f;
+        min = 0x80;
+    } else if (u[0] >= 0xe0 && u[0] <= 0xef) {
+        n = 3;
+        c = u[0] & 0x0f;
+        min = 0x800;
+    } else if (u[0] >= 0xf0 && u[0] <= 0xf4) {
+        n = 4;
+        c = u[0] & 0x07;
+        min = 0x10000;
+    } else {
+        return 0;
+    }
+    if (len < n) return 0;
+    int j;
+    for (j = 1; j < n; j++) {
+        if ((u[j] & 0xc0) != 0x80) return 0;
+        c = c << 6 | (u[j] & 0x3f);
+    }
+    if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) return 0;
+    *cp = c;
+    return n;
+}
+
+int charRangeFind(const struct charrange *r, int n, uint32_t cp) {       // {{{2
+    /* non-zero if _cp_ is in one of the _n_ sorted ranges */
+    int lo = 0, hi = n - 1;
+    if (cp < r[0].lo || cp > r[hi].hi) return 0;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp > r[mid].hi) lo = mid + 1;
+        else if (cp < r[mid].lo) hi = mid - 1;
+        else return 1;
+    }
+    return 0;
+}
+
+int charWidth(uint32_t cp) {                                             // {{{2
+    /* screen columns code point _cp_ takes, like wcwidth() but without
+     * depending on the locale */
+    if (cp < 0x300) return 1;
+    if (charRangeFind(zerowidth, sizeof(zerowidth) / sizeof(zerowidth[0]),
+                cp))
+        return 0;
+    if (charRangeFind(widewidth, sizeof(widewidth) / sizeof(widewidth[0]),
+                cp))
+        return 2;
+    return 1;
+}
+
+int charNext(const char *s, int len, int col, int *width) {              // {{{2
+    /* length of the character at _s_ and in _width_ the columns it takes
+     * when it starts at column _col_ - tabs go to the next tab stop, bytes
+     * that are not valid UTF-8 are characters of their own (shown as '?') */
+    unsigned char c = s[0];
+    if (c == '\t') {
+        *width = KILO_TAB_STOP - col % KILO_TAB_STOP;
+        return 1;
+    }
+    if (c < 0x80) {
+        *width = 1;
+        return 1;
+    }
+    uint32_t cp;
+    int n = utf8Decode(s, len, &cp);
+    if (n == 0) {
+        *width = 1;
+        return 1;
+    }
+    *width = charWidth(cp);
+    return n;
+}
+
+int charStart(const char *s, int len, int at) {                          // {{{2
+    /* start of the character that byte _at_ of _s_ belongs to, continuation
+     * bytes go back to their lead byte (at most three of them), _at_ past
+     * the end is not looked at */
+    if (at >= len) return at;
+    int j = at;
+    while (j > 0 && at - j < 3 && (s[j] & 0xc0) == 0x80) j--;
+    uint32_t cp;
+    /* only if the lead byte really starts a sequence covering _at_ */
+    if (j < at && utf8Decode(&s[j], len - j, &cp) > at - j) return j;
+    return at;
+}
+
+// arena ------------------------------------------------------------------ {{{1
+
+char *arenaAlloc(struct arenachunk **arena, size_t size) {               // {{{2
+    /* return _size_ bytes from the arena, 8 byte aligned, there is no way to
+     * free them except releasing the whole arena
+     * slots bigger than a quarter chunk get a chunk of their own, which is
+     * put behind the current one so that it keeps filling up */
+    size = (size + 7) & ~(size_t)7;
+    struct arenachunk *head = *arena;
+    if (head && head->size - head->used >= size) {
+        char *p = head->data + head->used;
+        head->used += size;
+        return p;
+    }
+
+    size_t chunksize = size > KILO_ARENA_CHUNK / 4 ? size : KILO_ARENA_CHUNK;
+    struct arenachunk *chunk = kmalloc(sizeof(struct arenachunk) + chunksize);
+    if (chunk == NULL) die("malloc");
+    chunk->size = chunksize;
+    chunk->used = size;
+    if (head && chunksize != KILO_ARENA_CHUNK) {
+        chunk->next = head->next;
+        head->next = chunk;
+    } else {
+        chunk->next = head;
+        *arena = chunk;
+    }
+    return chunk->data;
+}
+
+void arenaRelease(struct arenachunk **arena) {                           // {{{2
+    /* free every chunk of the arena at once */
+    struct arenachunk *chunk = *arena;
+    while (chunk) {
+        struct arenachunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    *arena = NULL;
+}
+
+// row storage ------------------------------------------------------------ {{{1
+
+void editorIndexRebuild(int b) {                                         // {{{2
+    /* rebuild the Fenwick tree nodes of blocks _b_ and up, needed after
+     * blocks were inserted at or removed from index _b_ - the nodes below
+     * cover only blocks that did not move and stay, so this costs
+     * O(nblocks - b + log nblocks), like the memmove of the blocks */
+    int j, n = E.buf->numblocks;
+    int *idx = E.buf->blockidx;
+    for (j = b + 1; j <= n; j++) idx[j] = E.buf->block[j - 1].numrows;
+    /* the nodes of the prefix sum of the first _b_ blocks are the ones
+     * below whose parents are rebuilt */
+    for (j = b; j > 0; j -= j & -j) {
+        int parent = j + (j & -j);
+        if (parent <= n) idx[parent] += idx[j];
+    }
+    for (j = b + 1; j <= n; j++) {
+        int parent = j + (j & -j);
+        if (parent <= n) idx[parent] += idx[j];
+    }
+    E.buf->curblock = -1;
+}
+
+void editorIndexAdd(int b, int delta) {                                  // {{{2
+    /* block _b_ (zero based) gained _delta_ rows */
+    int j;
+    for (j = b + 1; j <= E.buf->numblocks; j += j & -j)
+        E.buf->blockidx[j] += delta;
+}
+
+int editorIndexPrefix(int b) {                                           // {{{2
+    /* number of rows in the first _b_ blocks */
+    int sum = 0;
+    for (; b > 0; b -= b & -b) sum += E.buf->blockidx[b];
+    return sum;
+}
+
+int editorFindBlock(int at, int *start) {                                // {{{2
+    /* descend the Fenwick tree to the block holding row _at_, the index of
+     * the first row of that block is stored in _start_ */
+    int pos = 0;
+    int rem = at;
+    int step = 1;
+    int n = E.buf->numblocks;
+    int *idx = E.buf->blockidx;
+    while (step * 2 <= n) step *= 2;
+    for (; step; step /= 2) {
+        if (pos + step <= n && idx[pos + step] <= rem) {
+            pos += step;
+            rem -= idx[pos];
+        }
+    }
+    *start = at - rem;
+    return pos;
+}
+
+int editorRowAtOffset(size_t off) {                                      // {{{2
+    /* row holding byte _off_ of the mapping, found by bisecting the blocks
+     * by their place in the mapping - blocks of inserted rows have none and
+     * go with the block before them, and a block whose rows were changed
+     * no longer matches its lines, its first row is taken then */
+    char *at = E.buf->map + off;
+    int lo = 0, hi = E.buf->numblocks;
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2, b = mid;
+        while (b > lo && E.buf->block[b].base == NULL) b--;
+        if (E.buf->block[b].base && E.buf->block[b].base > at) hi = mid;
+        else lo = mid;
+    }
+    while (lo > 0 && E.buf->block[lo].base == NULL) lo--;
+    if (lo >= E.buf->numblocks) return 0;
+
+    struct rowblock *blk = &E.buf->block[lo];
+    int row = editorIndexPrefix(lo);
+    if (blk->base && !blk->modified && at > blk->base && at < blk->end) {
+        editorGzPin(E.buf->gz, blk->base, at);
+        row += scanCountByte(blk->base, at - blk->base, '\n');
+        editorGzUnpin(E.buf->gz, blk->base, at);
+    } else if (blk->base && at >= blk->end) {
+        row += blk->numrows;
+    }
+    return row;
+}
+
+void editorInitMappedRow(erow *row, char *s, int len) {                  // {{{2
+    /* set up a row that borrows its characters from the file mapping */
+    row->size = len;
+    row->chars = s;
+    row->store = ROW_MAPPED;
+    row->cap = 0;
+    row->rsize = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->width = NULL;
+    row->wrap = NULL;
+    row->wide = 0;
+    row->dirty = 1;
+}
+
+void editorRowsMoved(erow *rows, int n) {                                // {{{2
+    /* rows stored inline point into themselves, point them at their new
+     * place after the erow structs were moved in memory */
+    int j;
+    for (j = 0; j < n; j++) {
+        erow *row = &rows[j];
+        if (row->store != ROW_INLINE) continue;
+        if (row->render == row->chars) row->render = row->inl;
+        row->chars = row->inl;
+    }
+}
+
+int editorDisplayWidth(const char *s, int len) {                         // {{{2
+    /* number of screen columns the characters take, tabs expanded */
+    const char *end = s + len;
+    int width = 0;
+    if (scanHasHigh(s, len)) {
+        /* UTF-8 characters are decoded one by one */
+        while (s < end) {
+            int w;
+            s += charNext(s, end - s, width, &w);
+            width += w;
+        }
+        return width;
+    }
+    while (s < end) {
+        const char *tab = scanFindByte(s, end - s, '\t');
+        if (!tab) return width + (end - s);
+        width += tab - s;
+        width += KILO_TAB_STOP - width % KILO_TAB_STOP;
+        s = tab + 1;
+    }
+    return width;
+}
+
+int editorBlockTable(int b) {                                            // {{{2
+    /* build the line table of block _b_ from its lines in the mapping, one
+     * scan over the few kilobytes of the block
+     * returns -1 if the block has no table (modified or not from the file),
+     * its rows are the only description of its lines then */
+    struct rowblock *blk = &E.buf->block[b];
+    if (blk->lineoff) return 0;
+    if (!blk->base || blk->modified) return -1;
+
+    /* one allocation for the three arrays */
+    int n = blk->numrows;
+    char *mem = kmalloc(n * (sizeof(size_t) + sizeof(int) + 1));
+    if (mem == NULL) die("malloc");
+    blk->lineoff = (size_t *)mem;
+    blk->linesize = (int *)(blk->lineoff + n);
+    blk->lineflags = (unsigned char *)(blk->linesize + n);
+
+    editorGzPin(E.buf->gz, blk->base, blk->end);
+    char *p = blk->base;
+    int maxwidth = 0;
+    int j;
+    for (j = 0; j < n; j++) {
+        char *nl = (char *)scanFindByte(p, blk->end - p, '\n');
+        char *next = nl ? nl + 1 : blk->end;
+        if (!nl) nl = blk->end;
+        /* strip carriage return from the end of the line */
+        while (nl > p && nl[-1] == '\r') nl--;
+
+        int len = nl - p;
+        int tab = scanFindByte(p, len, '\t') != NULL;
+        int wide = scanHasHigh(p, len);
+        int width = tab || wide ? editorDisplayWidth(p, len) : len;
+        blk->lineoff[j] = p - blk->base;
+        blk->linesize[j] = len;
+        blk->lineflags[j] = (tab ? LINE_TAB : 0) | (wide ? LINE_WIDE : 0);
+        if (width > maxwidth) maxwidth = width;
+        p = next;
+    }
+    editorGzUnpin(E.buf->gz, blk->base, blk->end);
+    blk->maxwidth = maxwidth;
+    E.buf->numtables++;
+    return 0;
+}
+
+void editorFreeBlockTable(int b) {                                       // {{{2
+    /* drop the line table of block _b_, the cached maximum width stays */
+    struct rowblock *blk = &E.buf->block[b];
+    if (!blk->lineoff) return;
+    free(blk->lineoff);
+    blk->lineoff = NULL;
+    blk->linesize = NULL;
+    blk->lineflags = NULL;
+    E.buf->numtables--;
+}
+
+erow *editorBlockRows(int b) {                                           // {{{2
+    /* return the rows of block _b_, materializing them from the file mapping
+     * if needed - rows are set up from the line table, ASCII lines without
+     * tabs render as they are, so they start out rendered */
+    struct rowblock *blk = &E.buf->block[b];
+    if (blk->row) return blk->row;
+
+    /* the rows point into the text of a gzip file, it stays inflated until
+     * they are dropped */
+    editorGzPin(E.buf->gz, blk->base, blk->end);
+    editorBlockTable(b);
+    blk->row = kmalloc(sizeof(erow) * KILO_BLOCK_ROWS);
+    if (blk->row == NULL) die("malloc");
+    int j;
+    for (j = 0; j < blk->numrows; j++) {
+        erow *row = &blk->row[j];
+        editorInitMappedRow(row, blk->base + blk->lineoff[j],
+                blk->linesize[j]);
+        if (!(blk->lineflags[j] & (LINE_TAB | LINE_WIDE))) {
+            row->render = row->chars;
+            row->rsize = row->size;
+            row->dirty = 0;
+        }
+    }
+    E.buf->numloaded++;
+    return blk->row;
+}
+
+void editorBlockModified(int b) {                                        // {{{2
+    /* the rows of block _b_ no longer match its lines in the mapping */
+    struct rowblock *blk = &E.buf->block[b];
+    editorBlockRows(b);
+    if (blk->base && !blk->modified) E.buf->numloaded--;
+    blk->modified = 1;
+    editorFreeBlockTable(b);
+    blk->maxwidth = -1;
+}
+
+void editorRowModified(erow *row) {                                      // {{{2
+    /* mark the block holding _row_ as modified, called when a row that
+     * still points into the mapping is first changed - the row was just
+     * returned by editorRowAt(), so its block is usually the cached one */
+    int b = E.buf->curblock;
+    if (b < 0 || row < E.buf->block[b].row ||
+            row >= E.buf->block[b].row + E.buf->block[b].numrows) {
+        for (b = 0; b < E.buf->numblocks; b++) {
+            erow *rows = E.buf->block[b].row;
+            if (rows && row >= rows && row < rows + E.buf->block[b].numrows)
+                break;
+        }
+        if (b == E.buf->numblocks) return;
+    }
+    editorBlockModified(b);
+}
+
+int editorBlockDroppable(int b) {                                        // {{{2
+    /* non-zero if the rows of block _b_ can be freed and re-read later */
+    struct rowblock *blk = &E.buf->block[b];
+    if (!blk->row || !blk->base || blk->modified) return 0;
+    int j;
+    for (j = 0; j < blk->numrows; j++)
+        if (blk->row[j].store != ROW_MAPPED || blk->row[j].hl ||
+                (blk->row[j].render && blk->row[j].render != blk->row[j].chars))
+            return 0;
+    return 1;
+}
+
+void editorTrimBlocks(int keeplo, int keephi) {                          // {{{2
+    /* free the rows and line tables of unmodified blocks outside rows
+     * [keeplo, keephi) and the render ranges of the other views once more
+     * than twice KILO_BLOCK_CACHE are held, so that only the sparse index
+     * of a big file stays in memory */
+    if (E.buf->numloaded <= 2 * KILO_BLOCK_CACHE &&
+            E.buf->numtables <= 2 * KILO_BLOCK_CACHE) return;
+
+    int b;
+    int start = 0;
+    for (b = 0; b < E.buf->numblocks && (E.buf->numloaded > KILO_BLOCK_CACHE ||
+                E.buf->numtables > KILO_BLOCK_CACHE); b++) {
+        int end = start + E.buf->block[b].numrows;
+        if ((end <= keeplo || start >= keephi) &&
+                !editorOtherViewsRender(start, end)) {
+            if (editorBlockDroppable(b)) {
+                free(E.buf->block[b].row);
+                E.buf->block[b].row = NULL;
+                editorGzUnpin(E.buf->gz, E.buf->block[b].base,
+                        E.buf->block[b].end);
+                E.buf->numloaded--;
+            }
+            if (!E.buf->block[b].row && E.buf->numtables > KILO_BLOCK_CACHE)
+                editorFreeBlockTable(b);
+        }
+        start = end;
+    }
+    E.buf->curblock = -1;
+}
+
+erow *editorRowAt(int at) {                                              // {{{2
+    /* return row _at_, the pointer is only valid until rows are inserted or
+     * deleted */
+    struct rowblock *cur = E.buf->curblock >= 0 ?
+        &E.buf->block[E.buf->curblock] : NULL;
+    if (cur && at >= E.buf->curstart && at < E.buf->curstart + cur->numrows)
+        return &cur->row[at - E.buf->curstart];
+
+    /* moving on to the next block is the common case when walking rows */
+    if (cur && at == E.buf->curstart + cur->numrows &&
+            E.buf->curblock + 1 < E.buf->numblocks) {
+        E.buf->curstart += cur->numrows;
+        E.buf->curblock++;
+    } else {
+        E.buf->curblock = editorFindBlock(at, &E.buf->curstart);
+    }
+    return &editorBlockRows(E.buf->curblock)[at - E.buf->curstart];
+}
+
+void editorInsertBlock(int b) {                                          // {{{2
+    /* insert a new empty block at index _b_ of the block list */
+    if (E.buf->numblocks == E.buf->blockcap) {
+        /* grow the block list geometrically */
+        int cap = E.buf->blockcap ? E.buf->blockcap * 2 : 16;
+        struct rowblock *new = krealloc(E.buf->block,
+                sizeof(struct rowblock) * cap);
+        int *idx = krealloc(E.buf->blockidx, sizeof(int) * (cap + 1));
+        if (new == NULL || idx == NULL) die("realloc");
+        E.buf->block = new;
+        E.buf->blockidx = idx;
+        E.buf->blockcap = cap;
+    }
+
+    memmove(&E.buf->block[b + 1], &E.buf->block[b],
+            sizeof(struct rowblock) * (E.buf->numblocks - b));
+    E.buf->block[b].numrows = 0;
+    E.buf->block[b].row = kmalloc(sizeof(erow) * KILO_BLOCK_ROWS);
+    if (E.buf->block[b].row == NULL) die("malloc");
+    E.buf->block[b].base = E.buf->block[b].end = NULL;
+    E.buf->block[b].modified = 0;
+    E.buf->block[b].lineoff = NULL;
+    E.buf->block[b].linesize = NULL;
+    E.buf->block[b].lineflags = NULL;
+    E.buf->block[b].maxwidth = -1;
+    E.buf->block[b].hlstate = NULL;
+    E.buf->block[b].hlstale = 0;
+    E.buf->numblocks++;
+    /* appending only adds the node of the new block */
+    editorIndexRebuild(b);
+}
+
+void editorRemoveBlock(int b) {                                          // {{{2
+    /* remove the (empty, modified) block _b_ from the block list */
+    free(E.buf->block[b].row);
+    free(E.buf->block[b].hlstate);
+    memmove(&E.buf->block[b], &E.buf->block[b + 1],
+            sizeof(struct rowblock) * (E.buf->numblocks - b - 1));
+    E.buf->numblocks--;
+    editorIndexRebuild(b);
+}
+
+void editorSplitBlock(int b) {                                           // {{{2
+    /* move the upper half of the full block _b_ into a new block after it */
+    editorBlockModified(b);
+    editorInsertBlock(b + 1);
+    struct rowblock *blk = &E.buf->block[b];
+    struct rowblock *next = &E.buf->block[b + 1];
+    int half = blk->numrows / 2;
+
+    memcpy(next->row, &blk->row[half], sizeof(erow) * (blk->numrows - half));
+    next->numrows = blk->numrows - half;
+    editorRowsMoved(next->row, next->numrows);
+    if (blk->hlstate) {
+        next->hlstate = kmalloc(KILO_BLOCK_ROWS);
+        if (next->hlstate == NULL) die("malloc");
+        memcpy(next->hlstate, &blk->hlstate[half], next->numrows);
+        next->hlstale = blk->hlstale;
+    }
+    blk->numrows = half;
+    /* the new block was indexed empty, the rows moved over are the only
+     * change */
+    editorIndexAdd(b, -next->numrows);
+    editorIndexAdd(b + 1, next->numrows);
+    E.buf->curblock = -1;
+}
+
+erow *editorInsertRowSlot(int at) {                                      // {{{2
+    /* open an uninitialised slot for a new row at index _at_ and return it,
+     * rows _at_ and below move down by one */
+    int b, start;
+    if (at == E.buf->numrows) {
+        /* appending to the end of the file fills blocks completely */
+        if (E.buf->numblocks == 0 ||
+                E.buf->block[E.buf->numblocks - 1].numrows == KILO_BLOCK_ROWS)
+            editorInsertBlock(E.buf->numblocks);
+        b = E.buf->numblocks - 1;
+        start = E.buf->numrows - E.buf->block[b].numrows;
+    } else {
+        b = editorFindBlock(at, &start);
+        if (E.buf->block[b].numrows == KILO_BLOCK_ROWS) {
+            editorSplitBlock(b);
+            if (at - start >= E.buf->block[b].numrows) {
+                start += E.buf->block[b].numrows;
+                b++;
+            }
+        }
+    }
+
+    editorBlockModified(b);
+    struct rowblock *blk = &E.buf->block[b];
+    int i = at - start;
+    memmove(&blk->row[i + 1], &blk->row[i], sizeof(erow) * (blk->numrows - i));
+    editorRowsMoved(&blk->row[i + 1], blk->numrows - i);
+    /* the new row was never lexed, the rows below are lexed again once it
+     * is since their start state is not known either */
+    if (blk->hlstate) {
+        memmove(&blk->hlstate[i + 1], &blk->hlstate[i], blk->numrows - i);
+        blk->hlstate[i] = HL_UNKNOWN;
+        blk->hlstale = 1;
+    }
+    if (at < E.buf->hlfrontier) E.buf->hlfrontier = at;
+    blk->numrows++;
+    editorIndexAdd(b, 1);
+    E.buf->numrows++;
+    E.buf->curblock = -1;
+
+    /* rendered rows below _at_ moved down by one */
+    editorRowsShifted(at, 1);
+
+    return &blk->row[i];
+}
+
+void editorAppendSparseBlock(char *base, char *end, int numrows) {        // {{{2
+    /* append a block of _numrows_ lines that are found in the mapping
+     * between _base_ and _end_, the rows are only materialized when they
+     * are accessed */
+    editorInsertBlock(E.buf->numblocks);
+    struct rowblock *blk = &E.buf->block[E.buf->numblocks - 1];
+    free(blk->row);
+    blk->row = NULL;
+    blk->base = base;
+    blk->end = end;
+    blk->numrows = numrows;
+    editorIndexAdd(E.buf->numblocks - 1, numrows);
+    E.buf->numrows += numrows;
+}
+
+void editorRemoveRowSlots(int at, int n) {                               // {{{2
+    /* close the slots of the _n_ rows from _at_ on, the rows themselves
+     * have to be freed already - the rows are removed block by block with
+     * one move each, so removing many rows costs the rows, not a move of
+     * the block per row */
+    int left = n;
+    while (left > 0) {
+        int start;
+        int b = editorFindBlock(at, &start);
+        editorBlockModified(b);
+        struct rowblock *blk = &E.buf->block[b];
+        int i = at - start;
+        int cnt = blk->numrows - i < left ? blk->numrows - i : left;
+        int below = blk->numrows - i - cnt;
+
+        memmove(&blk->row[i], &blk->row[i + cnt], sizeof(erow) * below);
+        editorRowsMoved(&blk->row[i], below);
+        if (blk->hlstate)
+            memmove(&blk->hlstate[i], &blk->hlstate[i + cnt], below);
+        blk->numrows -= cnt;
+        editorIndexAdd(b, -cnt);
+        E.buf->numrows -= cnt;
+        E.buf->curblock = -1;
+        left -= cnt;
+
+        if (blk->numrows == 0) editorRemoveBlock(b);
+    }
+    /* the row that moved up starts after another row now */
+    if (at < E.buf->hlfrontier) E.buf->hlfrontier = at;
+    editorSyntaxInvalidate(at);
+
+    /* rendered rows below the removed ones moved up */
+    editorRowsShifted(at, -n);
+}
+
+// syntax highlighting ---------------------------------------------------- {{{1
+
+int editorIsSeparator(int c) {                                           // {{{2
+    /* non-zero if _c_ separates words, keywords and numbers only start
+     * after a separator */
+    return isspace((unsigned char)c) || c == '\0' ||
+        strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+int editorSyntaxLex(const char *s, int len, int state,
+        unsigned char *hl) {                                             // {{{2
+    /* lex the _len_ characters _s_ of a row that starts in lexer state
+     * _state_ and return the state it ends in, the highlight class of every
+     * character is stored in _hl_
+     * _hl_ is NULL when only the end state is wanted, then everything that
+     * cannot start or end a comment or a string is skipped */
+    struct editorSyntax *syntax = E.buf->syntax;
+    char **keywords = syntax->keywords;
+
+    char *scs = syntax->singleline_comment_start;
+    char *mcs = syntax->multiline_comment_start;
+    char *mce = syntax->multiline_comment_end;
+    int scs_len = strlen(scs);
+    int mcs_len = strlen(mcs);
+    int mce_len = strlen(mce);
+
+    if (hl) memset(hl, HL_NORMAL, len);
+    /* the beginning of the line is a separator */
+    int prev_sep = 1;
+    /* the quote of the string we are in, 0 outside of strings */
+    int in_string = 0;
+    int in_comment = state == HL_STATE_COMMENT;
+
+    int i = 0;
+    while (i < len) {
+        char c = s[i];
+        unsigned char prev_hl = (hl && i > 0) ? hl[i - 1] : HL_NORMAL;
+
+        if (!hl && !in_string && !in_comment && c != '"' && c != '\'' &&
+                c != scs[0] && c != mcs[0]) {
+            i++;
+            continue;
+        }
+
+        /* a single-line comment takes the rest of the line */
+        if (scs_len && !in_string && !in_comment && len - i >= scs_len &&
+                !memcmp(&s[i], scs, scs_len)) {
+            if (hl) memset(&hl[i], HL_COMMENT, len - i);
+            break;
+        }
+
+        if (mcs_len && mce_len && !in_string) {
+            if (in_comment) {
+                if (!hl) {
+                    /* jump to the end of the comment */
+                    const char *end = memmem(&s[i], len - i, mce, mce_len);
+                    if (!end) break;
+                    i = end - s + mce_len;
+                    in_comment = 0;
+                    prev_sep = 1;
+                    continue;
+                }
+                hl[i] = HL_MLCOMMENT;
+                if (len - i >= mce_len && !memcmp(&s[i], mce, mce_len)) {
+                    memset(&hl[i], HL_MLCOMMENT, mce_len);
+                    i += mce_len;
+                    in_comment = 0;
+                    prev_sep = 1;
+                } else {
+                    i++;
+                }
+                continue;
+            } else if (len - i >= mcs_len && !memcmp(&s[i], mcs, mcs_len)) {
+                if (hl) memset(&hl[i], HL_MLCOMMENT, mcs_len);
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
+
+        if (syntax->flags & HL_HIGHLIGHT_STRINGS) {
+            if (in_string) {
+                if (hl) hl[i] = HL_STRING;
+                /* an escaped quote does not end the string */
+                if (c == '\\' && i + 1 < len) {
+                    if (hl) hl[i + 1] = HL_STRING;
+                    i += 2;
+                    continue;
+                }
+                if (c == in_string) in_string = 0;
+                i++;
+                prev_sep = 1;
+                continue;
+            } else if (c == '"' || c == '\'') {
+                in_string = c;
+                if (hl) hl[i] = HL_STRING;
+                i++;
+                continue;
+            }
+        }
+
+        if (!hl) {
+            i++;
+            continue;
+        }
+
+        if (syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+            /* digits after a separator or continuing a number, a dot
+             * continues a number too */
+            if ((isdigit((unsigned char)c) &&
+                        (prev_sep || prev_hl == HL_NUMBER)) ||
+                    (c == '.' && prev_hl == HL_NUMBER)) {
+                hl[i] = HL_NUMBER;
+                i++;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        if (prev_sep) {
+            /* a keyword has to be followed by a separator as well */
+            int j;
+            for (j = 0; keywords[j]; j++) {
+                int klen = strlen(keywords[j]);
+                int kw2 = keywords[j][klen - 1] == '|';
+                if (kw2) klen--;
+
+                if (len - i >= klen && !memcmp(&s[i], keywords[j], klen) &&
+                        (i + klen == len || editorIsSeparator(s[i + klen]))) {
+                    memset(&hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+                    i += klen;
+                    break;
+                }
+            }
+            if (keywords[j] != NULL) {
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        prev_sep = editorIsSeparator(c);
+        i++;
+    }
+    return in_comment ? HL_STATE_COMMENT : HL_STATE_NORMAL;
+}
+
+int editorSyntaxToColor(int hl) {                                        // {{{2
+    /* ANSI foreground color code of a highlight class */
+    switch (hl) {
+        case HL_COMMENT:
+        case HL_MLCOMMENT: return 36;
+        case HL_KEYWORD1: return 33;
+        case HL_KEYWORD2: return 32;
+        case HL_STRING: return 35;
+        case HL_NUMBER: return 31;
+        default: return 37;
+    }
+}
+
+void editorSyntaxReset() {                                               // {{{2
+    /* forget all lexer states and highlights, e.g. when the filetype
+     * changed */
+    int b, j;
+    for (b = 0; b < E.buf->numblocks; b++) {
+        free(E.buf->block[b].hlstate);
+        E.buf->block[b].hlstate = NULL;
+        E.buf->block[b].hlstale = 0;
+    }
+    /* only rows near the viewports have highlights */
+    struct editorView *v = NULL;
+    int lo = E.rendlo, hi = E.rendhi;
+    while (1) {
+        for (j = lo; j < hi && j < E.buf->numrows; j++) {
+            erow *row = editorRowAt(j);
+            free(row->hl);
+            row->hl = NULL;
+        }
+        v = editorNextView(v);
+        if (v == NULL) break;
+        lo = v->rendlo;
+        hi = v->rendhi;
+    }
+    E.buf->hlfrontier = 0;
+}
+
+void editorSelectSyntaxHighlight() {                                     // {{{2
+    /* pick the filetype of the opened file from its name */
+    editorSyntaxReset();
+    E.buf->syntax = NULL;
+    if (E.buf->filename == NULL) return;
+
+    /* strrchr() from <string.h>, the last dot starts the extension */
+    char *ext = strrchr(E.buf->filename, '.');
+    unsigned int j;
+    for (j = 0; j < HLDB_ENTRIES; j++) {
+        struct editorSyntax *s = &HLDB[j];
+        int i;
+        for (i = 0; s->filematch[i]; i++) {
+            int is_ext = s->filematch[i][0] == '.';
+            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+                    (!is_ext && strstr(E.buf->filename, s->filematch[i]))) {
+                E.buf->syntax = s;
+                return;
+            }
+        }
+    }
+}
+
+void editorSyntaxInvalidate(int at) {                                    // {{{2
+    /* the text of row _at_ changed (or the row above it is another one now),
+     * mark its end state stale, the row is lexed again before the rows
+     * below it are drawn */
+    if (at < 0 || at >= E.buf->numrows) return;
+    if (at < E.buf->hlfrontier) E.buf->hlfrontier = at;
+    int start;
+    int b = editorFindBlock(at, &start);
+    struct rowblock *blk = &E.buf->block[b];
+    /* rows of a block without states are all unknown anyway */
+    if (!blk->hlstate) return;
+    blk->hlstate[at - start] |= HL_STALE;
+    blk->hlstale = 1;
+}
+
+int editorSyntaxEndState(int at) {                                       // {{{2
+    /* lexer state at the end of row _at_, which is above the frontier, the
+     * state a row starts in is that of the row above */
+    if (at < 0) return HL_STATE_NORMAL;
+    int start;
+    int b = editorFindBlock(at, &start);
+    return E.buf->block[b].hlstate[at - start];
+}
+
+void editorSyntaxSync(int upto) {                                        // {{{2
+    /* bring the end states of rows [hlfrontier, upto) up to date, rows are
+     * lexed from the frontier on for as long as the end state of a row
+     * differs from the one it had before - once it is the same again, the
+     * rows below are skipped up to the next stale one without being lexed,
+     * whole blocks without stale rows at once
+     * the lines of blocks that are not materialized are lexed in the file
+     * mapping through the line table, no rows are set up for them
+     * after an edit only the rows from the edited one down to the first
+     * one whose end state did not change are lexed, and never rows below
+     * _upto_ (the end of the viewport), so typing costs a few rows even in
+     * a huge file */
+    if (!E.buf->syntax) return;
+    if (upto > E.buf->numrows) upto = E.buf->numrows;
+    int at = E.buf->hlfrontier;
+    if (at >= upto) return;
+
+    int state = editorSyntaxEndState(at - 1);
+    /* non-zero if the end state of the last row lexed changed, the next row
+     * has to be lexed even if it is not stale */
+    int changed = 0;
+    int start;
+    int b = editorFindBlock(at, &start);
+    while (at < upto) {
+        struct rowblock *blk = &E.buf->block[b];
+        int end = start + blk->numrows;
+        if (!changed && blk->hlstate && !blk->hlstale) {
+            /* nothing in this block needs lexing */
+            state = blk->hlstate[blk->numrows - 1];
+            at = end;
+        } else {
+            if (!blk->hlstate) {
+                blk->hlstate = kmalloc(KILO_BLOCK_ROWS);
+                if (blk->hlstate == NULL) die("malloc");
+                memset(blk->hlstate, HL_UNKNOWN, KILO_BLOCK_ROWS);
+                blk->hlstale = 1;
+            }
+            int table = !blk->row && !blk->lineoff;
+            if (!blk->row) {
+                editorBlockTable(b);
+                editorGzPin(E.buf->gz, blk->base, blk->end);
+            }
+
+            int j;
+            for (j = at - start; j < blk->numrows && at < upto; j++, at++) {
+                unsigned char old = blk->hlstate[j];
+                if (!changed && !(old & HL_STALE)) {
+                    state = old;
+                    continue;
+                }
+                if (blk->row)
+                    state = editorSyntaxLex(blk->row[j].chars,
+                            blk->row[j].size, state, NULL);
+                else
+                    state = editorSyntaxLex(blk->base + blk->lineoff[j],
+                            blk->linesize[j], state, NULL);
+                /* HL_UNKNOWN never matches a state */
+                changed = state != (old & ~HL_STALE);
+                blk->hlstate[j] = state;
+            }
+            /* every row of the block above the frontier is up to date */
+            if (j == blk->numrows) blk->hlstale = 0;
+            if (!blk->row) editorGzUnpin(E.buf->gz, blk->base, blk->end);
+
+            /* tables built only for this pass are not kept around */
+            if (table && !blk->row && E.buf->numtables > KILO_BLOCK_CACHE)
+                editorFreeBlockTable(b);
+        }
+        if (at == end) {
+            b++;
+            start = end;
+        }
+    }
+    /* the row at the frontier was lexed with another start state than the
+     * one its state came from */
+    E.buf->hlfrontier = at;
+    if (changed) editorSyntaxInvalidate(at);
+}
+
+unsigned char *editorRowHighlight(int at, erow *row) {                  // {{{2
+    /* return the highlight classes of the rendered characters of row _at_,
+     * the row has to be rendered and above the frontier - highlights are
+     * kept until the row or the state it starts in changes */
+    int state = editorSyntaxEndState(at - 1);
+    if (row->hl && row->hlstart == state) return row->hl;
+
+    free(row->hl);
+    row->hl = kmalloc(row->rsize ? row->rsize : 1);
+    if (row->hl == NULL) die("malloc");
+    editorSyntaxLex(row->render, row->rsize, state, row->hl);
+    row->hlstart = state;
+    return row->hl;
+}
+
+// row operations --------------------------------------------------------- {{{1
+
+void editorFreeRender(erow *row) {                                       // {{{2
+    /* drop the render buffer of the row, the row is re-rendered on the next
+     * draw */
+    if (row->render != row->chars) free(row->render);
+    row->render = NULL;
+    row->rsize = 0;
+    free(row->hl);
+    row->hl = NULL;
+    free(row->width);
+    row->width = NULL;
+    free(row->wrap);
+    row->wrap = NULL;
+    row->wide = 0;
+    row->dirty = 1;
+}
+
+void editorUpdateRow(erow *row) {                                        // {{{2
+    /* rendering tab characters as 8 spaces */
+    /* count the number of tabs in line */
+    int tabs = scanCountByte(row->chars, row->size, '\t');
+    int high = scanHasHigh(row->chars, row->size);
+
+    /* free memory allocated for render array */
+    editorFreeRender(row);
+    /* ASCII without tabs renders as it is, share the characters instead of
+     * copying them */
+    if (tabs == 0 && !high) {
+        row->render = row->chars;
+        row->rsize = row->size;
+        row->dirty = 0;
+        return;
+    }
+    /* allocate memory for the line, tabs are 8 spaces (1 for character and
+     * add 7), UTF-8 is copied as it is and invalid bytes become '?' */
+    int cap = row->size + tabs * (KILO_TAB_STOP - 1);
+    row->render = kmalloc(cap + 1);
+    if (row->render == NULL) die("malloc");
+
+    /* long rows get checkpoints, every column of the render is at least one
+     * byte of it */
+    struct rowwidth *w = NULL;
+    struct widthpoint *colpt = NULL;
+    if (row->size >= KILO_WIDTH_STEP) {
+        int nbyte = row->size / KILO_WIDTH_STEP + 1;
+        int ncol = cap / KILO_WIDTH_STEP + 1;
+        w = kmalloc(sizeof(struct rowwidth) +
+                sizeof(struct widthpoint) * (nbyte + ncol));
+        if (w == NULL) die("malloc");
+        w->nbyte = w->ncol = 0;
+        w->colbase = nbyte;
+        colpt = w->p + nbyte;
+    }
+
+    const char *chars = row->chars;
+    int size = row->size;
+    int ci = 0, idx = 0, col = 0;
+    while (ci < size) {
+        unsigned char c = chars[ci];
+        if (c < 0x80 && c != '\t') {
+            /* a run of ASCII is one byte and one column per character, it
+             * is copied in bulk */
+            int run = 1;
+            while (ci + run < size && (unsigned char)chars[ci + run] < 0x80 &&
+                    chars[ci + run] != '\t')
+                run++;
+            if (w) {
+                while (w->nbyte * KILO_WIDTH_STEP < ci + run) {
+                    int k = w->nbyte * KILO_WIDTH_STEP;
+                    w->p[w->nbyte++] = (struct widthpoint){k, col + k - ci};
+                }
+                while (w->ncol * KILO_WIDTH_STEP < col + run) {
+                    int k = w->ncol * KILO_WIDTH_STEP;
+                    colpt[w->ncol++] = (struct widthpoint){idx + k - col, k};
+                }
+            }
+            memcpy(&row->render[idx], &chars[ci], run);
+            ci += run;
+            idx += run;
+            col += run;
+            continue;
+        }
+
+        int width;
+        int n = charNext(&chars[ci], size - ci, col, &width);
+        if (w) {
+            while (w->nbyte * KILO_WIDTH_STEP < ci + n)
+                w->p[w->nbyte++] = (struct widthpoint){ci, col};
+            /* a character without width covers the column it is at, for
+             * the checkpoints it comes before the one that takes it */
+            while (w->ncol * KILO_WIDTH_STEP < col + (width ? width : 1)) {
+                /* the spaces of a tab are characters of their own */
+                int k = w->ncol * KILO_WIDTH_STEP;
+                colpt[w->ncol++] = c == '\t' ?
+                    (struct widthpoint){idx + k - col, k} :
+                    (struct widthpoint){idx, col};
+            }
+        }
+        if (c == '\t') {
+            /* render tab, pad with spaces until the next tab stop */
+            memset(&row->render[idx], ' ', width);
+            idx += width;
+        } else if (n == 1) {
+            row->render[idx++] = '?';
+        } else {
+            memcpy(&row->render[idx], &chars[ci], n);
+            idx += n;
+            row->wide = 1;
+        }
+        ci += n;
+        col += width;
+    }
+    /* end the array with nullchar */
+    row->render[idx] = '\0';
+    /* render size = number of bytes */
+    row->rsize = idx;
+    row->width = w;
+    row->dirty = 0;
+}
+
+int editorRowCxToRx(erow *row, int cx) {                                 // {{{2
+    /* column the character at chars offset _cx_ of the rendered row starts
+     * at, walks from the nearest checkpoint at most one step */
+    if (row->render == row->chars) return cx;
+    int ci = 0, col = 0;
+    if (row->width && row->width->nbyte > 0) {
+        int k = cx / KILO_WIDTH_STEP;
+        if (k >= row->width->nbyte) k = row->width->nbyte - 1;
+        ci = row->width->p[k].off;
+        col = row->width->p[k].col;
+    }
+    while (ci < cx && ci < row->size) {
+        int w;
+        ci += charNext(&row->chars[ci], row->size - ci, col, &w);
+        col += w;
+    }
+    return col;
+}
+
+int editorRowRenderAt(erow *row, int col, int *start) {                  // {{{2
+    /* render offset of the character of the rendered row that covers column
+     * _col_ (or comes first after it), the column it starts at is stored to
+     * _start_ - it is less than _col_ if the character is wide */
+    if (!row->wide) {
+        *start = col;
+        return col;
+    }
+    int off = 0, c = 0;
+    if (row->width && row->width->ncol > 0) {
+        int k = col / KILO_WIDTH_STEP;
+        if (k >= row->width->ncol) k = row->width->ncol - 1;
+        off = row->width->p[row->width->colbase + k].off;
+        c = row->width->p[row->width->colbase + k].col;
+    }
+    while (off < row->rsize && c < col) {
+        int w;
+        int n = charNext(&row->render[off], row->rsize - off, c, &w);
+        if (c + w > col) break;
+        off += n;
+        c += w;
+    }
+    *start = c;
+    return off;
+}
+
+int editorRowRxToCx(erow *row, int rx) {                                 // {{{2
+    /* chars offset of the character of the rendered row that covers column
+     * _rx_, the size of the row if it ends before - the byte checkpoint to
+     * walk from is found with a binary search over their columns */
+    if (row->render == row->chars) return rx < row->size ? rx : row->size;
+    int ci = 0, col = 0;
+    if (row->width && row->width->nbyte > 0) {
+        struct widthpoint *p = row->width->p;
+        int lo = 0, hi = row->width->nbyte - 1;
+        while (lo < hi) {
+            int mid = (lo + hi + 1) / 2;
+            if (p[mid].col <= rx) lo = mid;
+            else hi = mid - 1;
+        }
+        ci = p[lo].off;
+        col = p[lo].col;
+    }
+    while (ci < row->size) {
+        int w;
+        int n = charNext(&row->chars[ci], row->size - ci, col, &w);
+        if (col + w > rx) break;
+        ci += n;
+        col += w;
+    }
+    return ci;
+}
+
+struct rowwrap *editorRowWrap(erow *row) {                               // {{{2
+    /* wrap points of the rendered row for the current screen width, built
+     * on first use and kept until the row is rendered again or the width
+     * changes - NULL for rows that are one byte per column, their screen
+     * lines start at multiples of the width */
+    if (!row->wide) return NULL;
+    int cols = E.screencols;
+    if (row->wrap && row->wrap->cols == cols) return row->wrap;
+    free(row->wrap);
+
+    /* a wide character that does not fit leaves at most one column of a
+     * screen line empty, and the end of the row may need a line of its own
+     */
+    int cap = row->rsize / (cols > 1 ? cols - 1 : 1) + 2;
+    struct rowwrap *w = kmalloc(sizeof(struct rowwrap) +
+            sizeof(struct widthpoint) * cap);
+    if (w == NULL) die("malloc");
+    w->cols = cols;
+    w->p[0] = (struct widthpoint){0, 0};
+    w->n = 1;
+
+    int off = 0, col = 0, linecol = 0;
+    while (off < row->rsize) {
+        int width = 1, n = 1;
+        if ((unsigned char)row->render[off] >= 0x80)
+            n = charNext(&row->render[off], row->rsize - off, col, &width);
+        /* a character that does not fit starts the next line, characters
+         * without width stay with the one before them */
+        if (width && col > linecol && col + width > linecol + cols) {
+            w->p[w->n++] = (struct widthpoint){off, col};
+            linecol = col;
+        }
+        off += n;
+        col += width;
+    }
+    /* the cursor after the last character takes a column too */
+    if (col >= linecol + cols) w->p[w->n++] = (struct widthpoint){off, col};
+    row->wrap = w;
+    return w;
+}
+
+int editorWrapLines(erow *row) {                                         // {{{2
+    /* number of screen lines the rendered row takes in soft wrap mode */
+    struct rowwrap *w = editorRowWrap(row);
+    return w ? w->n : row->rsize / E.screencols + 1;
+}
+
+int editorWrapLine(erow *row, int rx) {                                  // {{{2
+    /* screen line of the rendered row that column _rx_ is on in soft wrap
+     * mode, a binary search over the wrap points */
+    struct rowwrap *w = editorRowWrap(row);
+    if (!w) return rx / E.screencols;
+    int lo = 0, hi = w->n - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (w->p[mid].col <= rx) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+int editorWrapStart(erow *row, int line, int *off) {                     // {{{2
+    /* the column screen line _line_ of the rendered row starts at in soft
+     * wrap mode, its render offset is stored to _off_ */
+    struct rowwrap *w = editorRowWrap(row);
+    if (!w) {
+        *off = line * E.screencols;
+        return *off;
+    }
+    *off = w->p[line].off;
+    return w->p[line].col;
+}
+
+erow *editorRenderRow(int at) {                                          // {{{2
+    /* return row _at_ with an up to date render buffer, rendering is done
+     * lazily here instead of on load because only the visible rows are
+     * ever drawn */
+    erow *row = editorRowAt(at);
+    if (!row->dirty) return row;
+    if ((at < E.rendlo || at >= E.rendhi) &&
+            !editorOtherViewsRender(at, at + 1)) {
+        if (E.buf->numstray == E.buf->straycap) {
+            int cap = E.buf->straycap ? E.buf->straycap * 2 : 64;
+            int *stray = krealloc(E.buf->stray, sizeof(int) * cap);
+            if (stray == NULL) die("realloc");
+            E.buf->stray = stray;
+            E.buf->straycap = cap;
+        }
+        E.buf->stray[E.buf->numstray++] = at;
+    }
+    editorUpdateRow(row);
+    return row;
+}
+
+void editorFreeStrays(int lo, int hi) {                                  // {{{2
+    /* free the render buffers of the rows rendered outside the render
+     * ranges, except for rows [lo, hi) and the ranges of the other views */
+    int j;
+    for (j = 0; j < E.buf->numstray; j++) {
+        int at = E.buf->stray[j];
+        if (at >= E.buf->numrows || (at >= lo && at < hi) ||
+                editorOtherViewsRender(at, at + 1)) continue;
+        erow *row = editorRowAt(at);
+        if (row->render) editorFreeRender(row);
+    }
+    E.buf->numstray = 0;
+}
+
+void editorTrimRenderCache() {                                           // {{{2
+    /* free the render buffers of rows that are far outside the viewport so
+     * that the memory used by rendering scales with the screen and not with
+     * the file, the rows are re-rendered if they are scrolled into view -
+     * rows near another view of the buffer are left alone, the views share
+     * them */
+    int slack = E.screenrows * KILO_RENDER_SLACK;
+    int lo = E.rowoff - slack;
+    int hi = E.rowoff + E.screenrows + slack;
+    if (lo < 0) lo = 0;
+    if (hi > E.buf->numrows) hi = E.buf->numrows;
+
+    /* only the previously cached range has to be visited, it is bounded by
+     * the cache size */
+    int j;
+    for (j = E.rendlo; j < E.rendhi && j < E.buf->numrows; j++) {
+        if ((j >= lo && j < hi) || editorOtherViewsRender(j, j + 1)) continue;
+        erow *row = editorRowAt(j);
+        if (!row->render) continue;
+        editorFreeRender(row);
+    }
+    editorFreeStrays(lo, hi);
+
+    E.rendlo = lo;
+    E.rendhi = hi;
+
+    /* rows near the viewport stay materialized */
+    editorTrimBlocks(lo, hi);
+}
+
+void editorRowSetChars(erow *row, const char *s, size_t len) {           // {{{2
+    /* give the row its own copy of _s_ - short lines are kept inline, the
+     * rest gets a slot in the row arena (rounded up to 8 bytes, so small
+     * edits still fit) */
+    char *chars;
+    if (len < KILO_ROW_INLINE) {
+        chars = row->inl;
+        row->store = ROW_INLINE;
+        row->cap = KILO_ROW_INLINE;
+    } else {
+        row->cap = (len + 1 + 7) & ~(size_t)7;
+        chars = arenaAlloc(&E.buf->arena, row->cap);
+        row->store = ROW_ARENA;
+    }
+    memcpy(chars, s, len);
+    chars[len] = '\0';
+    row->chars = chars;
+    row->size = len;
+}
+
+int editorMaxLineWidth() {                                               // {{{2
+    /* display width of the widest line in the file - a whole-file pass over
+     * the line tables (or the maximum cached per block), rows are not
+     * materialized for it; only rows of modified blocks are visited one by
+     * one */
+    int maxwidth = 0;
+    int b, j;
+    for (b = 0; b < E.buf->numblocks; b++) {
+        struct rowblock *blk = &E.buf->block[b];
+        if (blk->maxwidth < 0 && editorBlockTable(b) == 0) {
+            /* tables built only for this pass are not kept around */
+            if (!blk->row && E.buf->numtables > KILO_BLOCK_CACHE)
+                editorFreeBlockTable(b);
+        }
+        if (blk->maxwidth >= 0) {
+            if (blk->maxwidth > maxwidth) maxwidth = blk->maxwidth;
+            continue;
+        }
+        for (j = 0; j < blk->numrows; j++) {
+            erow *row = &blk->row[j];
+            int width = row->dirty || row->wide ?
+                editorDisplayWidth(row->chars, row->size) : row->rsize;
+            if (width > maxwidth) maxwidth = width;
+        }
+    }
+    return maxwidth;
+}
+
+void editorInsertRow(int at, char *s, size_t len) {                       // {{{2
+    /* insert a new row with a copy of _s_ at index _at_ */
+    if (at < 0 || at > E.buf->numrows) return;
+
+    erow *row = editorInsertRowSlot(at);
+    editorRowSetChars(row, s, len);
+
+    /* initialize render array */
+    row->rsize = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->width = NULL;
+    row->wrap = NULL;
+    row->wide = 0;
+    /* the row is rendered on first draw */
+    row->dirty = 1;
+}
+
+void editorAppendRow(char *s, size_t len) {                              // {{{2
+    editorInsertRow(E.buf->numrows, s, len);
+}
+
+void editorFreeRow(erow *row) {                                          // {{{2
+    /* free the memory owned by the row, inline and arena characters go away
+     * with the row and the arena */
+    editorFreeRender(row);
+    if (row->store == ROW_HEAP) {
+        free(row->chars);
+        E.buf->numheaprows--;
+    }
+}
+
+void editorDelRows(int at, int n) {                                      // {{{2
+    /* delete the _n_ rows from _at_ on, rows below move up by _n_ */
+    if (at < 0 || n <= 0 || at + n > E.buf->numrows) return;
+    int j;
+    for (j = at; j < at + n; j++) editorFreeRow(editorRowAt(j));
+    editorRemoveRowSlots(at, n);
+}
+
+void editorDelRow(int at) {                                              // {{{2
+    /* delete row _at_, rows below move up by one */
+    editorDelRows(at, 1);
+}
+
+void editorRowMakeWritable(erow *row) {                                  // {{{2
+    /* copy-on-write - must be called before modifying row->chars, rows that
+     * still point into the read-only mapping get their own copy */
+    if (row->store != ROW_MAPPED) return;
+    editorRowModified(row);
+    if (row->render == row->chars) editorFreeRender(row);
+    editorRowSetChars(row, row->chars, row->size);
+}
+
+void editorRowReserve(erow *row, size_t size) {                          // {{{2
+    /* make the row writable with room for _size_ characters and the null
+     * byte, a row that outgrows its inline or arena slot moves to a heap
+     * block, growing geometrically from there */
+    editorRowMakeWritable(row);
+    if (size + 1 <= (size_t)row->cap) return;
+    if (row->render == row->chars) editorFreeRender(row);
+
+    size_t cap = row->cap * 2;
+    if (cap < size + 1) cap = size + 1;
+    char *chars;
+    if (row->store == ROW_HEAP) {
+        chars = krealloc(row->chars, cap);
+        if (chars == NULL) die("realloc");
+    } else {
+        chars = kmalloc(cap);
+        if (chars == NULL) die("malloc");
+        memcpy(chars, row->chars, row->size + 1);
+        row->store = ROW_HEAP;
+        E.buf->numheaprows++;
+    }
+    row->chars = chars;
+    row->cap = cap;
+}
+
+void editorRowInsertChar(erow *row, int at, int c) {                     // {{{2
+    /* insert character _c_ at position _at_ of the row */
+    /* validate _at_, it can go one character past the end of the string */
+    if (at < 0 || at > row->size) at = row->size;
+    /* make room for the new char and the null byte */
+    editorRowReserve(row, row->size + 1);
+    /* memmove() from <string.h>, like memcpy() but safe for overlapping
+     * arrays */
+    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+    row->size++;
+    row->chars[at] = c;
+    /* re-render on next draw */
+    row->dirty = 1;
+}
+
+void editorRowInsertString(erow *row, int at, const char *s,
+        size_t len) {                                                    // {{{2
+    /* insert the _len_ characters _s_ at position _at_ of the row */
+    if (at < 0 || at > row->size) at = row->size;
+    editorRowReserve(row, row->size + len);
+    memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+    memcpy(&row->chars[at], s, len);
+    row->size += len;
+    row->dirty = 1;
+}
+
+void editorRowDelString(erow *row, int at, size_t len) {                 // {{{2
+    /* delete the _len_ characters from position _at_ on */
+    if (at < 0 || at + len > (size_t)row->size) return;
+    editorRowMakeWritable(row);
+    memmove(&row->chars[at], &row->chars[at + len], row->size - at - len);
+    row->size -= len;
+    row->chars[row->size] = '\0';
+    row->dirty = 1;
+}
+
+void editorRowTruncate(erow *row, int at) {                              // {{{2
+    /* cut the row off at position _at_ */
+    editorRowMakeWritable(row);
+    row->size = at;
+    row->chars[row->size] = '\0';
+    row->dirty = 1;
+}
+
+void editorRowAppendString(erow *row, char *s, size_t len) {             // {{{2
+    /* append string _s_ to the end of the row */
+    editorRowReserve(row, row->size + len);
+    memcpy(&row->chars[row->size], s, len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    row->dirty = 1;
+}
+
+void editorRowDelChar(erow *row, int at) {                               // {{{2
+    /* delete the character at position _at_ of the row */
+    if (at < 0 || at >= row->size) return;
+    editorRowMakeWritable(row);
+    /* overwrite the deleted character with the characters that come after */
+    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+    row->size--;
+    row->dirty = 1;
+}
+
+// editor operations ------------------------------------------------------ {{{1
+
+void editorClampCursor() {                                               // {{{2
+    /* put a cursor past the end of its line back onto the line, no edit
+     * runs with it beyond the text */
+    if (E.cy < E.buf->numrows) {
+        int rowlen = editorRowAt(E.cy)->size;
+        if (E.cx > rowlen) E.cx = rowlen;
+    }
+}
+
+void editorInsertChar(int c) {                                           // {{{2
+    /* insert character _c_ at the cursor position */
+    editorClampCursor();
+    /* if the cursor is on the tilde line after the end of file, append a new
+     * row first */
+    if (E.cy == E.buf->numrows && E.buf->numrows > 0) {
+        /* for the undo log that is a newline at the end of the last row */
+        char s[2] = {'\n', c};
+        editorUndoRecord(UNDO_INSERT, E.cy - 1, editorRowAt(E.cy - 1)->size,
+                s, 2);
+    } else {
+        char ch = c;
+        editorUndoRecord(UNDO_INSERT, E.cy, E.cx, &ch, 1);
+    }
+    if (E.cy == E.buf->numrows) {
+        editorAppendRow("", 0);
+    }
+    /* the column recorded above, the cursor is on the row */
+    editorRowInsertChar(editorRowAt(E.cy), E.cx, c);
+    editorSyntaxInvalidate(E.cy);
+    E.buf->dirty++;
+    /* move the cursor after the inserted char */
+    E.cx++;
+}
+
+void editorInsertNewline() {                                             // {{{2
+    /* split the line at the cursor, or insert an empty row if the cursor is
+     * at the beginning of the line */
+    /* for the undo log a row added after the end of the file is a newline
+     * at the end of the last row, the first row of an empty file is not
+     * recorded (the empty file and the file with one empty row read the
+     * same) */
+    editorClampCursor();
+    if (E.cy < E.buf->numrows)
+        editorUndoRecord(UNDO_INSERT, E.cy, E.cx, "\n", 1);
+    else if (E.buf->numrows > 0)
+        editorUndoRecord(UNDO_INSERT, E.cy - 1, editorRowAt(E.cy - 1)->size,
+                "\n", 1);
+    if (E.cx == 0) {
+        editorInsertRow(E.cy, "", 0);
+    } else {
+        erow *row = editorRowAt(E.cy);
+        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+        /* the insert may have moved the rows, get the current one again */
+        row = editorRowAt(E.cy);
+        editorRowMakeWritable(row);
+        row->size = E.cx;
+        row->chars[row->size] = '\0';
+        row->dirty = 1;
+        editorSyntaxInvalidate(E.cy);
+    }
+    E.buf->dirty++;
+    E.cy++;
+    E.cx = 0;
+}
+
+void editorDelChar() {                                                   // {{{2
+    /* delete the character left of the cursor */
+    /* if the cursor is past the end of the file, there is nothing to delete */
+    if (E.cy == E.buf->numrows) return;
+    editorClampCursor();
+    /* nothing to delete at the beginning of the file */
+    if (E.cx == 0 && E.cy == 0) return;
+
+    erow *row = editorRowAt(E.cy);
+    if (E.cx > 0) {
+        /* the whole character, all bytes of it */
+        int at = charStart(row->chars, row->size, E.cx - 1);
+        editorUndoRecord(UNDO_DELETE, E.cy, at, &row->chars[at], E.cx - at);
+        editorRowDelString(row, at, E.cx - at);
+        editorSyntaxInvalidate(E.cy);
+        E.cx = at;
+    } else {
+        /* at the beginning of a line join it with the previous one */
+        erow *prev = editorRowAt(E.cy - 1);
+        editorUndoRecord(UNDO_DELETE, E.cy - 1, prev->size, "\n", 1);
+        E.cx = prev->size;
+        editorRowAppendString(prev, row->chars, row->size);
+        editorSyntaxInvalidate(E.cy - 1);
+        editorDelRow(E.cy);
+        E.cy--;
+    }
+    E.buf->dirty++;
+}
+
+// undo ------------------------------------------------------------------- {{{1
+
+void editorTextEnd(int row, int col, const char *s, int len, int *endrow,
+        int *endcol) {                                                     // {{{2
+    /* position right after the text _s_ inserted at _row_, _col_ */
+    const char *nl = memrchr(s, '\n', len);
+    if (!nl) {
+        *endrow = row;
+        *endcol = col + len;
+        return;
+    }
+    *endrow = row + scanCountByte(s, len, '\n');
+    *endcol = s + len - nl - 1;
+}
+
+void editorInsertText(int row, int col, const char *s, int len) {        // {{{2
+    /* insert the text _s_ at _row_, _col_, newlines split the row - the
+     * cost is the length of the text, the rows between its first and last
+     * line are inserted as they are */
+    const char *nl = memchr(s, '\n', len);
+    /* an empty file has no row to insert into yet */
+    if (row == E.buf->numrows) editorAppendRow("", 0);
+    erow *r = editorRowAt(row);
+    if (!nl) {
+        editorRowInsertString(r, col, s, len);
+        editorSyntaxInvalidate(row);
+        return;
+    }
+
+    /* the part of the row after _col_ goes to the end of the last line */
+    int taillen = r->size - col;
+    char *tail = kmalloc(taillen + 1);
+    if (tail == NULL) die("malloc");
+    memcpy(tail, &r->chars[col], taillen);
+    editorRowTruncate(r, col);
+    editorRowAppendString(r, (char *)s, nl - s);
+    editorSyntaxInvalidate(row);
+
+    const char *end = s + len;
+    const char *p = nl + 1;
+    while (1) {
+        nl = memchr(p, '\n', end - p);
+        editorInsertRow(++row, (char *)p, (nl ? nl : end) - p);
+        if (!nl) break;
+        p = nl + 1;
+    }
+    editorRowAppendString(editorRowAt(row), tail, taillen);
+    free(tail);
+}
+
+void editorDeleteText(int row, int col, const char *s, int len) {        // {{{2
+    /* delete the text _s_ found at _row_, _col_, its newlines join rows -
+     * the rows it covers completely are removed at once */
+    erow *r = editorRowAt(row);
+    const char *nl = memrchr(s, '\n', len);
+    if (!nl) {
+        editorRowDelString(r, col, len);
+        editorSyntaxInvalidate(row);
+        return;
+    }
+
+    /* the rest of the last line moves to the end of the first one */
+    int lines = scanCountByte(s, len, '\n');
+    erow *last = editorRowAt(row + lines);
+    int skip = s + len - nl - 1;
+    int taillen = last->size - skip;
+    char *tail = kmalloc(taillen + 1);
+    if (tail == NULL) die("malloc");
+    memcpy(tail, &last->chars[skip], taillen);
+
+    r = editorRowAt(row);
+    editorRowTruncate(r, col);
+    editorRowAppendString(r, tail, taillen);
+    free(tail);
+    editorSyntaxInvalidate(row);
+    editorDelRows(row + 1, lines);
+}
+
+struct undorec *editorUndoRec(struct undochunk *chunk, int off) {        // {{{2
+    return (struct undorec *)(chunk->data + off);
+}
+
+int editorUndoRecEnd(struct undochunk *chunk, int off) {                 // {{{2
+    /* offset right after the record at _off_, where the next one may go
+     * (records are 4 byte aligned) */
+    int end = off + sizeof(struct undorec) + editorUndoRec(chunk, off)->len;
+    return (end + 3) & ~3;
+}
+
+int editorUndoNext(struct undochunk **chunk, int *off) {                 // {{{2
+    /* move _chunk_, _off_ to the record after it, a NULL chunk is the
+     * position before the first record - returns 0 if there is none */
+    struct undochunk *c = *chunk;
+    int o;
+    if (c == NULL) {
+        c = E.buf->undo.first;
+        o = 0;
+    } else {
+        o = editorUndoRecEnd(c, *off);
+        if (o > c->last) {
+            c = c->next;
+            o = 0;
+        }
+    }
+    if (c == NULL || c->last < 0) return 0;
+    *chunk = c;
+    *off = o;
+    return 1;
+}
+
+void editorUndoFreeAfter(struct undochunk *chunk, int off) {             // {{{2
+    /* drop the records after the one at _chunk_, _off_ (all of them for a
+     * NULL chunk) - they could be redone, a new edit replaces them */
+    struct undochunk *c = chunk ? chunk->next : E.buf->undo.first;
+    while (c) {
+        struct undochunk *next = c->next;
+        E.buf->undo.bytes -= sizeof(struct undochunk) + c->size;
+        free(c);
+        c = next;
+    }
+    if (chunk) {
+        chunk->next = NULL;
+        chunk->last = off;
+        chunk->used = off + sizeof(struct undorec) +
+            editorUndoRec(chunk, off)->len;
+    } else {
+        E.buf->undo.first = NULL;
+    }
+    E.buf->undo.last = chunk;
+}
+
+struct undorec *editorUndoAppend(int op, int row, int col, int step,
+        const char *s, int len) {                                        // {{{2
+    /* append a record to the log and make it the current one, the oldest
+     * chunks are dropped while the log takes more than its limit */
+    struct undochunk *chunk = E.buf->undo.last;
+    int need = sizeof(struct undorec) + len;
+    int off = chunk ? (chunk->used + 3) & ~3 : 0;
+    if (chunk == NULL || off + need > chunk->size) {
+        int size = need > KILO_UNDO_CHUNK ? need : KILO_UNDO_CHUNK;
+        struct undochunk *c = kmalloc(sizeof(struct undochunk) + size);
+        if (c == NULL) die("malloc");
+        c->prev = chunk;
+        c->next = NULL;
+        c->last = -1;
+        c->used = 0;
+        c->size = size;
+        if (chunk) chunk->next = c;
+        else E.buf->undo.first = c;
+        E.buf->undo.last = chunk = c;
+        E.buf->undo.bytes += sizeof(struct undochunk) + size;
+        off = 0;
+    }
+
+    struct undorec *rec = editorUndoRec(chunk, off);
+    rec->op = op;
+    rec->reversed = 0;
+    rec->step = step;
+    rec->row = row;
+    rec->col = col;
+    rec->len = len;
+    rec->prev = chunk->last;
+    memcpy(rec->text, s, len);
+    chunk->last = off;
+    chunk->used = off + need;
+    E.buf->undo.cur = chunk;
+    E.buf->undo.curoff = off;
+
+    while (E.buf->undo.bytes > E.buf->undo.limit &&
+            E.buf->undo.first != chunk) {
+        struct undochunk *old = E.buf->undo.first;
+        E.buf->undo.first = old->next;
+        E.buf->undo.first->prev = NULL;
+        E.buf->undo.bytes -= sizeof(struct undochunk) + old->size;
+        free(old);
+    }
+    return rec;
+}
+
+int editorUndoExtend(struct undorec *rec, const char *s, int len,
+        int reversed) {                                                  // {{{2
+    /* grow the text of the current record by _s_ in place, if the record is
+     * the last one of the log and its chunk has room - _reversed_ appends
+     * the characters last first
+     * returns 0 if the record cannot grow */
+    struct undochunk *chunk = E.buf->undo.cur;
+    if (chunk->next || chunk->last != E.buf->undo.curoff ||
+            chunk->used + len > chunk->size)
+        return 0;
+    int j;
+    for (j = 0; j < len; j++)
+        rec->text[rec->len + j] = reversed ? s[len - 1 - j] : s[j];
+    rec->len += len;
+    chunk->used += len;
+    return 1;
+}
+
+void editorUndoRecord(int op, int row, int col, const char *s, int len) { // {{{2
+    /* record an edit made at _row_, _col_ - the text _s_ was inserted there
+     * (UNDO_INSERT) or deleted from there (UNDO_DELETE)
+     * an edit that continues the current record within KILO_UNDO_GROUP_MS
+     * grows it in place: typing extends an insertion, delete extends a
+     * deletion forward and backspace backward (its text is kept last
+     * character first, the record moves back with the cursor); other edits
+     * get a record of their own and start a new undo step
+     * a record that does not fit the text (an insertion past the end of
+     * its row, a deletion of text that is not there) is refused, undoing
+     * it would change other text than the edit did */
+    struct undolog *u = &E.buf->undo;
+    int fits = op == UNDO_INSERT ?
+        (row == E.buf->numrows ? row == 0 && col == 0 :
+         row >= 0 && row < E.buf->numrows && col >= 0 &&
+         col <= editorRowAt(row)->size) :
+        row >= 0 && col >= 0 && editorTextMatches(row, col, s, len);
+    if (!fits) return;
+    editorSwapRecord(op, row, col, s, len);
+    /* a new edit replaces everything that could be redone */
+    if (u->cur != u->last || (u->cur && u->cur->last != u->curoff) ||
+            (!u->cur && u->first))
+        editorUndoFreeAfter(u->cur, u->curoff);
+
+    double now = editorNow();
+    int step = u->seal || !u->cur ||
+        now - u->lastedit > KILO_UNDO_GROUP_MS / 1000.0;
+    u->lastedit = now;
+    u->seal = 0;
+
+    if (!step) {
+        struct undorec *rec = editorUndoRec(u->cur, u->curoff);
+        int endrow, endcol;
+        step = 1;
+        if (rec->op == op && op == UNDO_INSERT) {
+            editorTextEnd(rec->row, rec->col, rec->text, rec->len,
+                    &endrow, &endcol);
+            if (endrow == row && endcol == col) {
+                if (editorUndoExtend(rec, s, len, 0)) return;
+                step = 0;
+            }
+        } else if (rec->op == op) {
+            editorTextEnd(row, col, s, len, &endrow, &endcol);
+            if (row == rec->row && col == rec->col &&
+                    (!rec->reversed || rec->len == 1)) {
+                /* deleting forward at the same position */
+                if (editorUndoExtend(rec, s, len, 0)) {
+                    rec->reversed = 0;
+                    return;
+                }
+                step = 0;
+            } else if (endrow == rec->row && endcol == rec->col &&
+                    (rec->reversed || rec->len == 1)) {
+                /* deleting backward, right before the deleted text */
+                if (editorUndoExtend(rec, s, len, 1)) {
+                    rec->reversed = 1;
+                    rec->row = row;
+                    rec->col = col;
+                    return;
+                }
+                step = 0;
+            }
+        }
+    }
+    editorUndoAppend(op, row, col, step, s, len);
+}
+
+void editorUndoApply(struct undorec *rec, int undo) {                    // {{{2
+    /* revert (_undo_ non-zero) or repeat the edit of _rec_ and put the
+     * cursor where it happened */
+    char *text = rec->text;
+    if (rec->reversed) {
+        text = kmalloc(rec->len);
+        if (text == NULL) die("malloc");
+        int j;
+        for (j = 0; j < rec->len; j++) text[j] = rec->text[rec->len - 1 - j];
+    }
+    int insert = (rec->op == UNDO_INSERT) != (undo != 0);
+    editorSwapRecord(insert ? UNDO_INSERT : UNDO_DELETE, rec->row, rec->col,
+            text, rec->len);
+    if (insert) {
+        editorInsertText(rec->row, rec->col, text, rec->len);
+        /* the cursor goes after the text, except when a deletion made
+         * with delete is undone - it stayed in front of the text */
+        if (!undo || rec->reversed)
+            editorTextEnd(rec->row, rec->col, text, rec->len, &E.cy, &E.cx);
+        else {
+            E.cy = rec->row;
+            E.cx = rec->col;
+        }
+    } else {
+        editorDeleteText(rec->row, rec->col, text, rec->len);
+        E.cy = rec->row;
+        E.cx = rec->col;
+    }
+    if (text != rec->text) free(text);
+    E.buf->dirty++;
+}
+
+void editorUndo() {                                                      // {{{2
+    /* revert the records of the last undo step, newest first */
+    struct undolog *u = &E.buf->undo;
+    if (!u->cur) {
+        editorSetStatusMessage("Nothing to undo");
+        return;
+    }
+    int step;
+    do {
+        struct undorec *rec = editorUndoRec(u->cur, u->curoff);
+        editorUndoApply(rec, 1);
+        step = rec->step;
+        /* move to the record before */
+        if (rec->prev >= 0) {
+            u->curoff = rec->prev;
+        } else {
+            u->cur = u->cur->prev;
+            if (u->cur) u->curoff = u->cur->last;
+        }
+    } while (!step && u->cur);
+    u->seal = 1;
+}
+
+void editorRedo() {                                                      // {{{2
+    /* repeat the records of the undo step after the current position */
+    struct undolog *u = &E.buf->undo;
+    struct undochunk *chunk = u->cur;
+    int off = u->curoff;
+    if (!editorUndoNext(&chunk, &off)) {
+        editorSetStatusMessage("Nothing to redo");
+        return;
+    }
+    do {
+        editorUndoApply(editorUndoRec(chunk, off), 0);
+        u->cur = chunk;
+        u->curoff = off;
+    } while (editorUndoNext(&chunk, &off) && !editorUndoRec(chunk, off)->step);
+    u->seal = 1;
+}
+
+void editorUndoReset() {                                                 // {{{2
+    /* forget all edits, e.g. when another file is opened */
+    editorUndoFreeAfter(NULL, 0);
+    E.buf->undo.cur = NULL;
+    E.buf->undo.curoff = 0;
+    E.buf->undo.seal = 0;
+}
+
+// swap file -------------------------------------------------------------- {{{1
+
+uint32_t editorSwapChecksum(const void *p, size_t len, uint32_t h) {     // {{{2
+    /* 32 bit FNV-1a, continues the hash _h_ over _len_ more bytes */
+    const unsigned char *s = p;
+    size_t j;
+    for (j = 0; j < len; j++) {
+        h ^= s[j];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+char *editorSwapPath() {                                                 // {{{2
+    /* name of the swap file of the opened file, malloc()ed */
+    char *path = kmalloc(strlen(E.buf->filename) + sizeof(KILO_SWAP_SUFFIX));
+    if (path == NULL) die("malloc");
+    strcpy(path, E.buf->filename);
+    strcat(path, KILO_SWAP_SUFFIX);
+    return path;
+}
+
+void editorSwapIdentify() {                                              // {{{2
+    /* remember the version of the file that edits are journaled against,
+     * a journal is only replayed onto the same size and modification time */
+    struct swapheader *hdr = &E.buf->swap.hdr;
+    struct stat st;
+    E.buf->swap.enabled = E.buf->filename && stat(E.buf->filename, &st) == 0;
+    if (!E.buf->swap.enabled) return;
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, KILO_SWAP_MAGIC, sizeof(hdr->magic));
+    hdr->filesize = st.st_size;
+    hdr->mtime_sec = st.st_mtim.tv_sec;
+    hdr->mtime_nsec = st.st_mtim.tv_nsec;
+}
+
+int editorSwapWrite(int fd, const char *s, size_t len) {                 // {{{2
+    /* write all of _s_, returns -1 on an error */
+    while (len > 0) {
+        ssize_t n = write(fd, s, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        s += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void *editorSwapWriter(void *arg) {                                      // {{{2
+    /* writer thread - appends the queued records to the swap file as they
+     * come, so that they survive the editor being killed, and syncs them to
+     * disk at most every KILO_SWAP_SYNC_MS so that a burst of keys costs
+     * one fdatasync() */
+    struct editorSwap *sw = arg;
+    if (sw->fd == -1) {
+        /* a new journal, the lock keeps a second editor on the same file
+         * from writing to it as well */
+        int fd = open(sw->path, O_WRONLY | O_CREAT, 0600);
+        if (fd != -1 && (flock(fd, LOCK_EX | LOCK_NB) == -1 ||
+                    ftruncate(fd, 0) == -1 ||
+                    editorSwapWrite(fd, (char *)&sw->hdr,
+                        sizeof(sw->hdr)) == -1)) {
+            close(fd);
+            fd = -1;
+        }
+        pthread_mutex_lock(&sw->lock);
+        if (fd == -1) sw->error = errno;
+        sw->fd = fd;
+        pthread_mutex_unlock(&sw->lock);
+        if (fd == -1) return NULL;
+    }
+
+    double lastsync = editorNow();
+    int unsynced = 0;
+    while (1) {
+        pthread_mutex_lock(&sw->lock);
+        while (sw->pendlen == 0 && !sw->stop) {
+            if (!unsynced) {
+                pthread_cond_wait(&sw->cond, &sw->lock);
+                continue;
+            }
+            /* written records wait for the sync that is due */
+            double left = lastsync + KILO_SWAP_SYNC_MS / 1000.0 - editorNow();
+            if (left <= 0) break;
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += (time_t)left;
+            ts.tv_nsec += (long)((left - (time_t)left) * 1e9);
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            if (pthread_cond_timedwait(&sw->cond, &sw->lock, &ts) == ETIMEDOUT)
+                break;
+        }
+        char *data = sw->pending;
+        size_t len = sw->pendlen;
+        sw->pending = NULL;
+        sw->pendlen = sw->pendcap = 0;
+        int stop = sw->stop, discard = sw->discard;
+        pthread_mutex_unlock(&sw->lock);
+
+        if (discard) {
+            free(data);
+            break;
+        }
+        if (len > 0) {
+            int failed = editorSwapWrite(sw->fd, data, len) == -1;
+            free(data);
+            if (failed) {
+                pthread_mutex_lock(&sw->lock);
+                sw->error = errno;
+                pthread_mutex_unlock(&sw->lock);
+                break;
+            }
+            unsynced = 1;
+        }
+        if (unsynced && (stop ||
+                editorNow() - lastsync >= KILO_SWAP_SYNC_MS / 1000.0)) {
+            fdatasync(sw->fd);
+            lastsync = editorNow();
+            unsynced = 0;
+        }
+        if (stop) break;
+    }
+    return NULL;
+}
+
+void editorSwapRecord(int op, int row, int col, const char *s, int len) { // {{{2
+    /* journal an edit about to be applied - the record is queued for the
+     * writer thread, the key that made it never waits for the disk */
+    struct editorSwap *sw = &E.buf->swap;
+    if (!sw->enabled || sw->replaying) return;
+    if (!sw->running) {
+        pthread_mutex_init(&sw->lock, NULL);
+        pthread_cond_init(&sw->cond, NULL);
+        sw->pending = NULL;
+        sw->pendlen = sw->pendcap = 0;
+        sw->stop = sw->discard = 0;
+        sw->error = 0;
+        sw->path = editorSwapPath();
+        if (pthread_create(&sw->thread, NULL, editorSwapWriter, sw) != 0)
+            die("pthread_create");
+        sw->running = 1;
+    }
+
+    struct swaprec rec;
+    rec.op = op;
+    rec.row = row;
+    rec.col = col;
+    rec.len = len;
+    rec.check = editorSwapChecksum((char *)&rec + sizeof(rec.check),
+            sizeof(rec) - sizeof(rec.check), 2166136261U);
+    rec.check = editorSwapChecksum(s, len, rec.check);
+
+    pthread_mutex_lock(&sw->lock);
+    int error = sw->error;
+    if (!error) {
+        size_t need = sw->pendlen + sizeof(rec) + len;
+        if (need > sw->pendcap) {
+            size_t cap = sw->pendcap ? sw->pendcap * 2 : 4096;
+            while (cap < need) cap *= 2;
+            char *p = krealloc(sw->pending, cap);
+            if (p == NULL) die("realloc");
+            sw->pending = p;
+            sw->pendcap = cap;
+        }
+        memcpy(sw->pending + sw->pendlen, &rec, sizeof(rec));
+        memcpy(sw->pending + sw->pendlen + sizeof(rec), s, len);
+        sw->pendlen = need;
+        pthread_cond_signal(&sw->cond);
+    }
+    pthread_mutex_unlock(&sw->lock);
+
+    if (error) {
+        /* the writer gave up, do not queue records nobody writes */
+        sw->enabled = 0;
+        editorSetStatusMessage("Swap file disabled: %s", strerror(error));
+    }
+}
+
+void editorSwapStop(int discard) {                                       // {{{2
+    /* stop journaling - the records queued so far are written and synced
+     * first, unless _discard_ is set, then the swap file is removed */
+    struct editorSwap *sw = &E.buf->swap;
+    if (sw->running) {
+        pthread_mutex_lock(&sw->lock);
+        sw->stop = 1;
+        sw->discard = discard;
+        pthread_cond_signal(&sw->cond);
+        pthread_mutex_unlock(&sw->lock);
+        pthread_join(sw->thread, NULL);
+        pthread_mutex_destroy(&sw->lock);
+        pthread_cond_destroy(&sw->cond);
+        free(sw->pending);
+        sw->pending = NULL;
+        free(sw->path);
+        sw->path = NULL;
+        sw->running = 0;
+    }
+    if (sw->fd != -1) {
+        /* only a swap file that is ours (locked) is removed */
+        if (discard) {
+            char *path = editorSwapPath();
+            unlink(path);
+            free(path);
+        }
+        close(sw->fd);
+        sw->fd = -1;
+    }
+}
+
+int editorTextMatches(int row, int col, const char *s, int len) {        // {{{2
+    /* non-zero if the text _s_ is found at _row_, _col_ */
+    while (1) {
+        if (row >= E.buf->numrows) return 0;
+        erow *r = editorRowAt(row);
+        const char *nl = memchr(s, '\n', len);
+        int n = nl ? nl - s : len;
+        if (col > r->size || r->size - col < n ||
+                memcmp(&r->chars[col], s, n) != 0)
+            return 0;
+        if (!nl) return 1;
+        /* a newline has to be the end of the row */
+        if (col + n != r->size) return 0;
+        s += n + 1;
+        len -= n + 1;
+        row++;
+        col = 0;
+    }
+}
+
+void editorSwapReplay() {                                                // {{{2
+    /* look for the swap file of a session that did not end and apply its
+     * edits to the opened file in one pass - records are checked before
+     * they are applied, the journal ends at the first torn or corrupt one
+     * and is continued from there */
+    struct editorSwap *sw = &E.buf->swap;
+    editorSwapIdentify();
+    if (!sw->enabled) return;
+    char *path = editorSwapPath();
+    int fd = open(path, O_RDWR);
+    free(path);
+    if (fd == -1) return;
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        close(fd);
+        sw->enabled = 0;
+        editorSetStatusMessage("Swap file in use by another session, "
+                "changes are not journaled");
+        return;
+    }
+
+    struct stat st;
+    char *buf = NULL;
+    size_t size = 0;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct swapheader)) {
+        size = st.st_size;
+        buf = kmalloc(size);
+        if (buf == NULL) die("malloc");
+        if (pread(fd, buf, size, 0) != (ssize_t)size) size = 0;
+    }
+    if (size < sizeof(struct swapheader) ||
+            memcmp(buf, &sw->hdr, sizeof(struct swapheader)) != 0) {
+        /* a journal of another version of the file is left alone */
+        free(buf);
+        close(fd);
+        sw->enabled = 0;
+        editorSetStatusMessage("Swap file does not match the file, "
+                "changes are not journaled");
+        return;
+    }
+
+    /* records may be anywhere in the file */
+    if (E.buf->load.active) editorLoadWait(-1);
+    size_t off = sizeof(struct swapheader);
+    int count = 0;
+    sw->replaying = 1;
+    while (size - off >= sizeof(struct swaprec)) {
+        struct swaprec rec;
+        memcpy(&rec, buf + off, sizeof(rec));
+        char *text = buf + off + sizeof(rec);
+        if (rec.len > size - off - sizeof(rec)) break;
+        uint32_t check = editorSwapChecksum((char *)&rec + sizeof(rec.check),
+                sizeof(rec) - sizeof(rec.check), 2166136261U);
+        if (editorSwapChecksum(text, rec.len, check) != rec.check) break;
+        /* an insertion needs a position inside the text, a deletion the
+         * exact text */
+        int ok;
+        if (rec.op == UNDO_INSERT)
+            ok = rec.row == E.buf->numrows ?
+                E.buf->numrows == 0 && rec.col == 0 :
+                rec.row >= 0 && rec.row < E.buf->numrows && rec.col >= 0 &&
+                rec.col <= editorRowAt(rec.row)->size;
+        else
+            ok = rec.op == UNDO_DELETE && rec.row >= 0 && rec.col >= 0 &&
+                editorTextMatches(rec.row, rec.col, text, rec.len);
+        if (!ok) break;
+
+        editorUndoRecord(rec.op, rec.row, rec.col, text, rec.len);
+        if (rec.op == UNDO_INSERT) {
+            editorInsertText(rec.row, rec.col, text, rec.len);
+            editorTextEnd(rec.row, rec.col, text, rec.len, &E.cy, &E.cx);
+        } else {
+            editorDeleteText(rec.row, rec.col, text, rec.len);
+            E.cy = rec.row;
+            E.cx = rec.col;
+        }
+        count++;
+        off += sizeof(rec) + rec.len;
+    }
+    sw->replaying = 0;
+    free(buf);
+
+    /* new records go after the last good one */
+    if (ftruncate(fd, off) == -1 || lseek(fd, off, SEEK_SET) == -1) {
+        close(fd);
+        sw->enabled = 0;
+        return;
+    }
+    sw->fd = fd;
+    if (count > 0) {
+        E.buf->dirty += count;
+        editorSetStatusMessage("Recovered %d changes from the swap file",
+                count);
+    }
+}
+
+// gzip ------------------------------------------------------------------- {{{1
+
+/* gzip files are browsed without inflating them to disk - an index pass
+ * inflates the whole file once on a loader thread, builds the sparse line
+ * index from the text and records a resume point about every KILO_GZ_SPAN
+ * bytes of text, the spans between them are inflated again on demand into
+ * a reserved address range with rows and searches pointing into it like
+ * into a file mapping, and the least recently used ones are dropped */
+
+long gzHeaderSize(const unsigned char *p, size_t n) {                    // {{{2
+    /* length of the gzip member header at _p_ (RFC 1952), -1 if there is no
+     * complete header */
+    if (n < 10 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8) return -1;
+    int flags = p[3];
+    size_t i = 10;
+    /* FEXTRA */
+    if (flags & 4) {
+        if (i + 2 > n) return -1;
+        i += 2 + (p[i] | p[i + 1] << 8);
+    }
+    /* FNAME and FCOMMENT, zero terminated */
+    int f;
+    for (f = 8; f <= 16; f <<= 1) {
+        if (!(flags & f)) continue;
+        while (i < n && p[i]) i++;
+        i++;
+    }
+    /* FHCRC */
+    if (flags & 2) i += 2;
+    return i <= n ? (long)i : -1;
+}
+
+void gzFeed(z_stream *strm, const unsigned char *end) {                  // {{{2
+    /* give _strm_ the next input up to _end_, avail_in is only 32 bits */
+    if (strm->avail_in > 0) return;
+    size_t left = end - strm->next_in;
+    strm->avail_in = left < (1u << 30) ? left : (1u << 30);
+}
+
+int gzAddSpan(struct editorGzip *gz, uint64_t out, z_stream *strm,
+        const unsigned char *text, size_t textlen) {                     // {{{2
+    /* record a resume point at _out_ where _strm_ stands at a deflate block
+     * boundary, _text_ is the text before it - called by the index pass
+     * returns -1 if memory runs out */
+    struct gzspan s;
+    memset(&s, 0, sizeof(s));
+    s.out = out;
+    s.in = strm->next_in - gz->data;
+    s.bits = strm->data_type & 7;
+    if (textlen > KILO_GZ_WINDOW) {
+        text += textlen - KILO_GZ_WINDOW;
+        textlen = KILO_GZ_WINDOW;
+    }
+    if (textlen > 0) {
+        uLongf len = compressBound(textlen);
+        s.window = kmalloc(len);
+        if (s.window == NULL ||
+                compress2(s.window, &len, text, textlen, 1) != Z_OK) {
+            free(s.window);
+            return -1;
+        }
+        s.winlen = len;
+    }
+
+    pthread_mutex_lock(&gz->lock);
+    if (gz->numspans == gz->spancap) {
+        int cap = gz->spancap ? gz->spancap * 2 : 64;
+        struct gzspan *span = krealloc(gz->span, sizeof(*span) * cap);
+        if (span == NULL) {
+            pthread_mutex_unlock(&gz->lock);
+            free(s.window);
+            return -1;
+        }
+        gz->span = span;
+        gz->spancap = cap;
+    }
+    gz->span[gz->numspans++] = s;
+    gz->total = out;
+    pthread_mutex_unlock(&gz->lock);
+    return 0;
+}
+
+void gzPublish(struct loadchunk *chunk, struct loadpiece **held,
+        struct loadpiece **piece) {                                      // {{{2
+    /* hand the held back pieces and the one being filled over to the main
+     * thread, their lines all end before the last resume point */
+    struct editorLoader *load = chunk->load;
+    if (*piece && (*piece)->numentries > 0) {
+        (*piece)->next = *held;
+        *held = *piece;
+        *piece = NULL;
+    }
+    /* the held pieces are kept newest first */
+    struct loadpiece *list = NULL;
+    while (*held) {
+        struct loadpiece *next = (*held)->next;
+        (*held)->next = list;
+        list = *held;
+        *held = next;
+    }
+    if (list == NULL) return;
+    struct loadpiece *tail = list;
+    while (tail->next) tail = tail->next;
+
+    pthread_mutex_lock(&load->lock);
+    if (chunk->tail) chunk->tail->next = list;
+    else chunk->head = list;
+    chunk->tail = tail;
+    pthread_mutex_unlock(&load->lock);
+    write(load->notify[1], "p", 1);
+}
+
+int gzAddEntry(struct loadpiece **held, struct loadpiece **piece, int *size,
+        char *base, char *end, int lines) {                              // {{{2
+    /* add a line index entry to the pieces the index pass holds back, a
+     * full piece is put aside and the next one is twice as big
+     * returns -1 if memory runs out */
+    if (*piece && (*piece)->numentries == *size) {
+        (*piece)->next = *held;
+        *held = *piece;
+        *piece = NULL;
+        if (*size < KILO_LOAD_PIECE_MAX / KILO_BLOCK_ROWS) *size *= 2;
+    }
+    if (*piece == NULL && (*piece = editorLoadNewPiece(*size)) == NULL)
+        return -1;
+    int n = (*piece)->numentries++;
+    (*piece)->base[n] = base;
+    (*piece)->end[n] = end;
+    (*piece)->lines[n] = lines;
+    return 0;
+}
+
+void *editorGzLoadWorker(void *arg) {                                    // {{{2
+    /* loader thread of a gzip file - inflate all of it (members one after
+     * the other) into a sliding buffer, find the lines and record resume
+     * points at block boundaries about every KILO_GZ_SPAN bytes of text
+     * entries are held back until the span they end in is complete, the
+     * main thread may inflate it as soon as it has them */
+    struct loadchunk *chunk = arg;
+    struct editorLoader *load = chunk->load;
+    struct editorGzip *gz = chunk->gz;
+    const unsigned char *dataend = gz->data + gz->len;
+    size_t bufsize = KILO_GZ_WINDOW + KILO_GZ_CHUNK;
+    unsigned char *buf = kmalloc(bufsize);
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    /* 15 + 32 - a gzip header and trailer around the largest window */
+    int error = buf == NULL || inflateInit2(&strm, 47) != Z_OK;
+    strm.next_in = gz->data;
+    strm.avail_in = 0;
+
+    size_t have = 0;
+    uint64_t out = 0, last = 0;
+    /* the line index entry being counted */
+    uint64_t entry = 0;
+    int lines = 0;
+    int size = KILO_LOAD_PIECE_MIN / KILO_BLOCK_ROWS;
+    struct loadpiece *held = NULL;
+    struct loadpiece *piece = NULL;
+    int cancel = 0;
+
+    while (!error && !cancel) {
+        if (have == bufsize) {
+            /* keep the history inflating may refer back to */
+            memmove(buf, buf + have - KILO_GZ_WINDOW, KILO_GZ_WINDOW);
+            have = KILO_GZ_WINDOW;
+        }
+        gzFeed(&strm, dataend);
+        strm.next_out = buf + have;
+        strm.avail_out = bufsize - have;
+        int ret = inflate(&strm, Z_BLOCK);
+        size_t n = bufsize - have - strm.avail_out;
+        if (out + n > gz->reserved) {
+            error = 1;
+            break;
+        }
+
+        /* vectorized newline scan of the new text */
+        const char *start = (const char *)buf + have;
+        const char *p = start;
+        const char *end = p + n;
+        while (p < end && !error) {
+            const char *nl = scanFindByte(p, end - p, '\n');
+            if (!nl) break;
+            p = nl + 1;
+            if (++lines < KILO_BLOCK_ROWS) continue;
+            uint64_t next = out + (p - start);
+            error = gzAddEntry(&held, &piece, &size, gz->text + entry,
+                    gz->text + next, lines) == -1;
+            entry = next;
+            lines = 0;
+        }
+        have += n;
+        out += n;
+
+        if (ret == Z_STREAM_END) {
+            /* another member may follow, anything else after the last one
+             * (padding) is ignored */
+            strm.avail_in = 0;
+            gzFeed(&strm, dataend);
+            if (strm.avail_in >= 2 && strm.next_in[0] == 0x1f &&
+                    strm.next_in[1] == 0x8b) {
+                inflateReset(&strm);
+                continue;
+            }
+            break;
+        }
+        /* corrupt, or truncated if inflate is stuck at the end */
+        if ((ret != Z_OK && ret != Z_BUF_ERROR) ||
+                (ret == Z_BUF_ERROR && strm.next_in == dataend)) {
+            error = 1;
+            break;
+        }
+
+        /* a block boundary that is not the end of the member */
+        if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+                (gz->numspans == 0 || out - last >= KILO_GZ_SPAN)) {
+            if (gzAddSpan(gz, out, &strm, buf, have) == -1) {
+                error = 1;
+                break;
+            }
+            last = out;
+            gzPublish(chunk, &held, &piece);
+            pthread_mutex_lock(&load->lock);
+            cancel = load->cancel;
+            pthread_mutex_unlock(&load->lock);
+        }
+    }
+    if (buf) inflateEnd(&strm);
+
+    /* the last line may have no newline, the text ends there (or where it
+     * turned out to be corrupt) */
+    if (!cancel && out > entry) {
+        if (buf[have - 1] != '\n') lines++;
+        if (gzAddEntry(&held, &piece, &size, gz->text + entry,
+                    gz->text + out, lines) == -1)
+            out = entry;
+    }
+    free(buf);
+
+    pthread_mutex_lock(&gz->lock);
+    if (!cancel) gz->total = out;
+    gz->done = 1;
+    gz->error = error;
+    pthread_mutex_unlock(&gz->lock);
+    if (!cancel) gzPublish(chunk, &held, &piece);
+    while (held) {
+        struct loadpiece *next = held->next;
+        free(held);
+        held = next;
+    }
+    free(piece);
+
+    pthread_mutex_lock(&load->lock);
+    chunk->done = 1;
+    pthread_mutex_unlock(&load->lock);
+    write(load->notify[1], "d", 1);
+    return NULL;
+}
+
+int gzFindSpan(struct editorGzip *gz, uint64_t off) {                    // {{{2
+    /* the span holding byte _off_ of the text, binary search */
+    int lo = 0, hi = gz->numspans - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (gz->span[mid].out <= off) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+uint64_t gzSpanEnd(struct editorGzip *gz, int k) {                       // {{{2
+    /* where span _k_ ends, the next one starts there */
+    return k + 1 < gz->numspans ? gz->span[k + 1].out : gz->total;
+}
+
+void gzEvict(struct editorGzip *gz, int k) {                             // {{{2
+    /* give the memory of span _k_ back - the pages it shares with a
+     * neighbour that is inflated stay */
+    size_t page = sysconf(_SC_PAGESIZE);
+    uint64_t lo = gz->span[k].out;
+    uint64_t hi = gzSpanEnd(gz, k);
+    lo = k > 0 && gz->span[k - 1].resident ?
+        (lo + page - 1) / page * page : lo / page * page;
+    hi = k + 1 < gz->numspans && gz->span[k + 1].resident ?
+        hi / page * page : (hi + page - 1) / page * page;
+    if (lo < hi) madvise(gz->text + lo, hi - lo, MADV_DONTNEED);
+    gz->span[k].resident = 0;
+    gz->resident--;
+}
+
+void gzInflateSpan(struct editorGzip *gz, int k) {                       // {{{2
+    /* inflate the text of span _k_ into its place in the reserved range,
+     * the least recently used span nobody pins makes room for it once
+     * KILO_GZ_CACHE are inflated */
+    if (gz->resident >= KILO_GZ_CACHE) {
+        int j, lru = -1;
+        for (j = 0; j < gz->numspans; j++) {
+            struct gzspan *s = &gz->span[j];
+            if (s->resident && !s->pins &&
+                    (lru < 0 || s->used < gz->span[lru].used))
+                lru = j;
+        }
+        if (lru >= 0) gzEvict(gz, lru);
+    }
+
+    struct gzspan *s = &gz->span[k];
+    const unsigned char *dataend = gz->data + gz->len;
+    unsigned char window[KILO_GZ_WINDOW];
+    uLongf winlen = sizeof(window);
+    if (s->winlen == 0) winlen = 0;
+    else if (uncompress(window, &winlen, s->window, s->winlen) != Z_OK)
+        winlen = 0;
+
+    /* raw deflate from the block boundary on, the headers and trailers of
+     * the members after it are skipped by hand */
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, -15) != Z_OK) return;
+    strm.next_in = gz->data + s->in;
+    strm.avail_in = 0;
+    if (s->bits) inflatePrime(&strm, s->bits, strm.next_in[-1] >> (8 - s->bits));
+    if (winlen) inflateSetDictionary(&strm, window, winlen);
+    strm.next_out = (unsigned char *)gz->text + s->out;
+    strm.avail_out = gzSpanEnd(gz, k) - s->out;
+    while (strm.avail_out > 0) {
+        gzFeed(&strm, dataend);
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            /* the 8 byte trailer, then the header of the next member */
+            strm.avail_in = 0;
+            if ((size_t)(dataend - strm.next_in) < 8) break;
+            strm.next_in += 8;
+            long hdr = gzHeaderSize(strm.next_in, dataend - strm.next_in);
+            if (hdr < 0) break;
+            strm.next_in += hdr;
+            inflateReset(&strm);
+            continue;
+        }
+        if (ret != Z_OK) break;
+    }
+    inflateEnd(&strm);
+    s->resident = 1;
+    gz->resident++;
+}
+
+void editorGzPin(struct editorGzip *gz, const char *from,
+        const char *to) {                                                // {{{2
+    /* make the text [from, to) readable until it is unpinned, inflating
+     * the spans of it that are not - does nothing for files that are not
+     * compressed, may run on any thread */
+    if (gz == NULL || from >= to) return;
+    pthread_mutex_lock(&gz->lock);
+    int k0 = gzFindSpan(gz, from - gz->text);
+    int k1 = gzFindSpan(gz, to - 1 - gz->text);
+    int k;
+    /* pinned first, inflating a span never drops another one of the
+     * range */
+    for (k = k0; k <= k1; k++) gz->span[k].pins++;
+    for (k = k0; k <= k1; k++) {
+        if (!gz->span[k].resident) gzInflateSpan(gz, k);
+        gz->span[k].used = ++gz->tick;
+    }
+    pthread_mutex_unlock(&gz->lock);
+}
+
+void editorGzUnpin(struct editorGzip *gz, const char *from,
+        const char *to) {                                                // {{{2
+    /* the text [from, to) pinned with editorGzPin() may be dropped again */
+    if (gz == NULL || from >= to) return;
+    pthread_mutex_lock(&gz->lock);
+    int k0 = gzFindSpan(gz, from - gz->text);
+    int k1 = gzFindSpan(gz, to - 1 - gz->text);
+    int k;
+    for (k = k0; k <= k1; k++) gz->span[k].pins--;
+    pthread_mutex_unlock(&gz->lock);
+}
+
+// file i/o --------------------------------------------------------------- {{{1
+
+double editorNow() {                                                     // {{{2
+    /* monotonic time in seconds, clock_gettime() from <time.h> */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct loadpiece *editorLoadNewPiece(int size) {                         // {{{2
+    /* allocate a piece with room for _size_ index entries, in one block */
+    struct loadpiece *piece = kmalloc(sizeof(struct loadpiece) +
+            size * (2 * sizeof(char *) + sizeof(int)));
+    if (piece == NULL) return NULL;
+    piece->next = NULL;
+    piece->numentries = 0;
+    piece->base = (char **)(piece + 1);
+    piece->end = piece->base + size;
+    piece->lines = (int *)(piece->end + size);
+    return piece;
+}
+
+void *editorLoadWorker(void *arg) {                                      // {{{2
+    /* loader thread - build the sparse index of one chunk of the mapping,
+     * one entry every KILO_BLOCK_ROWS lines, and publish it piece by piece,
+     * the rows themselves are only touched by the main thread */
+    struct loadchunk *chunk = arg;
+    struct editorLoader *load = chunk->load;
+    char *p = chunk->begin;
+    int size = KILO_LOAD_PIECE_MIN / KILO_BLOCK_ROWS;
+
+    while (p < chunk->end) {
+        struct loadpiece *piece = editorLoadNewPiece(size);
+        if (piece == NULL) break;
+
+        while (piece->numentries < size && p < chunk->end) {
+            int n = piece->numentries;
+            int lines = 0;
+            piece->base[n] = p;
+            while (lines < KILO_BLOCK_ROWS && p < chunk->end) {
+                /* vectorized newline scan */
+                char *nl = (char *)scanFindByte(p, chunk->end - p, '\n');
+                p = nl ? nl + 1 : chunk->end;
+                lines++;
+            }
+            piece->end[n] = p;
+            piece->lines[n] = lines;
+            piece->numentries++;
+        }
+
+        pthread_mutex_lock(&load->lock);
+        if (chunk->tail) chunk->tail->next = piece;
+        else chunk->head = piece;
+        chunk->tail = piece;
+        int cancel = load->cancel;
+        pthread_mutex_unlock(&load->lock);
+        /* wake up the event loop */
+        write(load->notify[1], "p", 1);
+
+        if (cancel) break;
+        if (size < KILO_LOAD_PIECE_MAX / KILO_BLOCK_ROWS) size *= 2;
+    }
+
+    pthread_mutex_lock(&load->lock);
+    chunk->done = 1;
+    pthread_mutex_unlock(&load->lock);
+    write(load->notify[1], "d", 1);
+    return NULL;
+}
+
+char *editorIndexPath() {                                                // {{{2
+    /* name of the sidecar index file of the opened file, malloc()ed */
+    char *path = kmalloc(strlen(E.buf->filename) + sizeof(KILO_INDEX_SUFFIX));
+    strcpy(path, E.buf->filename);
+    strcat(path, KILO_INDEX_SUFFIX);
+    return path;
+}
+
+void editorIndexSave() {                                                 // {{{2
+    /* write the sparse index collected while loading to the sidecar file,
+     * so that the next open does not have to scan the file */
+    struct stat st;
+    if (stat(E.buf->filename, &st) == -1) return;
+
+    struct indexheader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, KILO_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.filesize = st.st_size;
+    hdr.mtime_sec = st.st_mtim.tv_sec;
+    hdr.mtime_nsec = st.st_mtim.tv_nsec;
+    hdr.numentries = E.buf->load.idxlen;
+
+    char *path = editorIndexPath();
+    FILE *fp = fopen(path, "w");
+    free(path);
+    if (!fp) return;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(E.buf->load.idxoff, sizeof(uint64_t), E.buf->load.idxlen, fp);
+    fwrite(E.buf->load.idxlines, sizeof(uint32_t), E.buf->load.idxlen, fp);
+    fclose(fp);
+}
+
+int editorIndexLoad(struct stat *st) {                                   // {{{2
+    /* build the row blocks straight from the sidecar index file, returns -1
+     * if there is none or it does not match the file */
+    char *path = editorIndexPath();
+    FILE *fp = fopen(path, "r");
+    free(path);
+    if (!fp) return -1;
+
+    struct indexheader hdr;
+    uint64_t *off = NULL;
+    uint32_t *lines = NULL;
+    int ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+        memcmp(hdr.magic, KILO_INDEX_MAGIC, sizeof(hdr.magic)) == 0 &&
+        hdr.filesize == (uint64_t)st->st_size &&
+        hdr.mtime_sec == st->st_mtim.tv_sec &&
+        hdr.mtime_nsec == st->st_mtim.tv_nsec &&
+        hdr.numentries <= hdr.filesize;
+    if (ok) {
+        off = kmalloc(sizeof(uint64_t) * hdr.numentries);
+        lines = kmalloc(sizeof(uint32_t) * hdr.numentries);
+        ok = off && lines &&
+            fread(off, sizeof(uint64_t), hdr.numentries, fp) == hdr.numentries &&
+            fread(lines, sizeof(uint32_t), hdr.numentries, fp) == hdr.numentries;
+    }
+    fclose(fp);
+
+    /* entries have to be increasing offsets inside the file */
+    uint64_t j;
+    for (j = 0; ok && j < hdr.numentries; j++) {
+        uint64_t next = j + 1 < hdr.numentries ? off[j + 1] : hdr.filesize;
+        if (off[j] >= next || lines[j] == 0 || lines[j] > KILO_BLOCK_ROWS)
+            ok = 0;
+    }
+
+    if (ok) {
+        for (j = 0; j < hdr.numentries; j++) {
+            uint64_t next = j + 1 < hdr.numentries ? off[j + 1] : hdr.filesize;
+            editorAppendSparseBlock(E.buf->map + off[j], E.buf->map + next,
+                    lines[j]);
+        }
+    }
+    free(off);
+    free(lines);
+    return ok ? 0 : -1;
+}
+
+void editorIndexCollect(char *base, int lines) {                         // {{{2
+    /* remember an index entry for the sidecar file */
+    if (E.buf->load.idxlen == E.buf->load.idxcap) {
+        int cap = E.buf->load.idxcap ? E.buf->load.idxcap * 2 : 1024;
+        uint64_t *off = krealloc(E.buf->load.idxoff, sizeof(uint64_t) * cap);
+        uint32_t *num = krealloc(E.buf->load.idxlines, sizeof(uint32_t) * cap);
+        if (off == NULL || num == NULL) die("realloc");
+        E.buf->load.idxoff = off;
+        E.buf->load.idxlines = num;
+        E.buf->load.idxcap = cap;
+    }
+    E.buf->load.idxoff[E.buf->load.idxlen] = base - E.buf->map;
+    E.buf->load.idxlines[E.buf->load.idxlen] = lines;
+    E.buf->load.idxlen++;
+}
+
+void editorLoadFinish() {                                                // {{{2
+    /* all chunks are stitched together (or loading was cancelled), join the
+     * threads and release the loader */
+    int j;
+    for (j = 0; j < E.buf->load.numchunks; j++) {
+        pthread_join(E.buf->load.chunk[j].thread, NULL);
+        /* pieces left over after a cancel */
+        struct loadpiece *piece = E.buf->load.chunk[j].head;
+        while (piece) {
+            struct loadpiece *next = piece->next;
+            free(piece);
+            piece = next;
+        }
+    }
+    editorUnwatchFd(E.buf->load.notify[0]);
+    close(E.buf->load.notify[0]);
+    close(E.buf->load.notify[1]);
+    pthread_mutex_destroy(&E.buf->load.lock);
+    E.buf->load.active = 0;
+
+    /* a complete index is saved for the next time the file is opened */
+    if (E.indexsidecar && !E.buf->load.cancel && !E.buf->gz) editorIndexSave();
+    free(E.buf->load.idxoff);
+    free(E.buf->load.idxlines);
+    if (E.buf->gz) {
+        /* the text of a gzip file is known now */
+        E.buf->maplen = E.buf->gz->total;
+        if (E.buf->gz->error)
+            editorSetStatusMessage("%.40s is corrupt after %zu bytes",
+                    E.buf->filename, E.buf->maplen);
+    } else if (E.buf->map) {
+        madvise(E.buf->map, E.buf->maplen, MADV_NORMAL);
+    }
+
+    /* data appended to a followed file while it was indexed goes after the
+     * indexed rows */
+    if (E.buf->follow.fd != -1 && !E.buf->load.cancel) editorFollowRead();
+}
+
+int editorLoadConsume() {                                                // {{{2
+    /* append the rows of all pieces that are ready, in file order
+     * returns the number of rows appended */
+    int appended = 0;
+    while (E.buf->load.active && E.buf->load.next < E.buf->load.numchunks) {
+        struct loadchunk *chunk = &E.buf->load.chunk[E.buf->load.next];
+
+        pthread_mutex_lock(&E.buf->load.lock);
+        struct loadpiece *piece = chunk->head;
+        chunk->head = chunk->tail = NULL;
+        int done = chunk->done;
+        pthread_mutex_unlock(&E.buf->load.lock);
+
+        while (piece) {
+            int j;
+            for (j = 0; j < piece->numentries; j++) {
+                editorAppendSparseBlock(piece->base[j], piece->end[j],
+                        piece->lines[j]);
+                E.buf->load.indexed = piece->end[j] - E.buf->map;
+                if (E.indexsidecar && !E.buf->gz)
+                    editorIndexCollect(piece->base[j], piece->lines[j]);
+                appended += piece->lines[j];
+            }
+            struct loadpiece *next = piece->next;
+            free(piece);
+            piece = next;
+        }
+
+        /* continue with the next chunk only once this one is complete */
+        if (!done) break;
+        E.buf->load.next++;
+    }
+
+    if (E.buf->load.active && E.buf->load.next == E.buf->load.numchunks)
+        editorLoadFinish();
+    return appended;
+}
+
+void editorLoadProgress(int fd) {                                        // {{{2
+    /* event loop callback for the loader pipe - append the new rows and
+     * repaint if they are visible, the status bar is updated at most every
+     * KILO_LOAD_STATUS_MS */
+    char buf[256];
+    while (read(fd, buf, sizeof(buf)) > 0);
+
+    /* the buffer being indexed need not be the one of the active view */
+    int j;
+    for (j = 0; j < E.numbufs; j++)
+        if (E.bufs[j]->load.active && E.bufs[j]->load.notify[0] == fd) break;
+    if (j == E.numbufs) return;
+    struct editorView *prev = editorEnterBuffer(E.bufs[j]);
+
+    int before = E.buf->numrows;
+    editorLoadConsume();
+
+    double now = editorNow();
+    if (editorViewVisible() && (before < E.rowoff + E.screenrows ||
+            !E.buf->load.active ||
+            now - E.buf->load.lastupdate >= KILO_LOAD_STATUS_MS / 1000.0)) {
+        E.buf->load.lastupdate = now;
+        E.redraw = 1;
+    }
+    editorSwitchView(prev);
+}
+
+void editorLoadWait(int rows) {                                          // {{{2
+    /* block until at least _rows_ rows are loaded or the whole file is,
+     * -1 waits for the whole file */
+    while (E.buf->load.active && (rows < 0 || E.buf->numrows < rows)) {
+        struct pollfd pfd = {E.buf->load.notify[0], POLLIN, 0};
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR) die("poll");
+        char buf[256];
+        while (read(E.buf->load.notify[0], buf, sizeof(buf)) > 0);
+        editorLoadConsume();
+    }
+}
+
+void editorLoadCancel() {                                                // {{{2
+    /* stop indexing, the rows loaded so far stay */
+    if (!E.buf->load.active) return;
+    pthread_mutex_lock(&E.buf->load.lock);
+    E.buf->load.cancel = 1;
+    pthread_mutex_unlock(&E.buf->load.lock);
+    editorLoadFinish();
+}
+
+void editorLoadInit() {                                                  // {{{2
+    /* set up the loader of the buffer without any chunks */
+    memset(&E.buf->load, 0, sizeof(E.buf->load));
+    pthread_mutex_init(&E.buf->load.lock, NULL);
+    if (pipe(E.buf->load.notify) == -1) die("pipe");
+    fcntl(E.buf->load.notify[0], F_SETFL, O_NONBLOCK);
+    fcntl(E.buf->load.notify[1], F_SETFL, O_NONBLOCK);
+}
+
+void editorLoadRun(void *(*worker)(void *)) {                            // {{{2
+    /* start a _worker_ thread for each chunk of the loader */
+    E.buf->load.active = 1;
+    int j;
+    for (j = 0; j < E.buf->load.numchunks; j++) {
+        if (pthread_create(&E.buf->load.chunk[j].thread, NULL, worker,
+                    &E.buf->load.chunk[j]) != 0) die("pthread_create");
+    }
+    editorWatchFd(E.buf->load.notify[0], editorLoadProgress);
+}
+
+void editorLoadStart(char *map, size_t len) {                            // {{{2
+    /* index the mapping in the background - the file is split into chunks
+     * at line boundaries, one thread per chunk finds the lines and the main
+     * thread appends them as rows in file order through the event loop */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = len / KILO_LOAD_CHUNK + 1;
+    if (n > cpus) n = cpus;
+    if (n > KILO_LOAD_THREADS) n = KILO_LOAD_THREADS;
+    if (n < 1) n = 1;
+
+    editorLoadInit();
+
+    char *end = map + len;
+    char *p = map;
+    int j;
+    for (j = 0; j < n && p < end; j++) {
+        /* the chunk ends after the first newline past its share */
+        char *cut = end;
+        if (j < n - 1) {
+            char *target = map + len / n * (j + 1);
+            if (target < p) target = p;
+            char *nl = (char *)scanFindByte(target, end - target, '\n');
+            if (nl) cut = nl + 1;
+        }
+        struct loadchunk *chunk = &E.buf->load.chunk[E.buf->load.numchunks++];
+        chunk->load = &E.buf->load;
+        chunk->begin = p;
+        chunk->end = cut;
+        p = cut;
+    }
+    editorLoadRun(editorLoadWorker);
+}
+
+int editorGzOpen(unsigned char *data, size_t len) {                      // {{{2
+    /* browse the gzip file mapped at _data_ - an address range for its text
+     * is reserved (no memory is committed for it) and the index pass starts
+     * inflating it in the background, returns -1 if the range cannot be
+     * reserved */
+    size_t reserve = len < KILO_GZ_RESERVE_MAX / KILO_GZ_RATIO ?
+        len * KILO_GZ_RATIO : KILO_GZ_RESERVE_MAX;
+    char *text = mmap(NULL, reserve, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (text == MAP_FAILED) return -1;
+
+    struct editorGzip *gz = kcalloc(1, sizeof(struct editorGzip));
+    if (gz == NULL) die("calloc");
+    gz->data = data;
+    gz->len = len;
+    gz->text = text;
+    gz->reserved = reserve;
+    pthread_mutex_init(&gz->lock, NULL);
+    E.buf->gz = gz;
+    E.buf->map = text;
+    E.buf->maplen = 0;
+
+    editorLoadInit();
+    struct loadchunk *chunk = &E.buf->load.chunk[E.buf->load.numchunks++];
+    chunk->load = &E.buf->load;
+    chunk->gz = gz;
+    editorLoadRun(editorGzLoadWorker);
+    return 0;
+}
+
+void editorGzClose() {                                                   // {{{2
+    /* release the text and the mapping of a gzip file, the index pass is
+     * over */
+    struct editorGzip *gz = E.buf->gz;
+    if (gz == NULL) return;
+    int k;
+    for (k = 0; k < gz->numspans; k++) free(gz->span[k].window);
+    free(gz->span);
+    munmap(gz->text, gz->reserved);
+    munmap(gz->data, gz->len);
+    pthread_mutex_destroy(&gz->lock);
+    free(gz);
+    E.buf->gz = NULL;
+    E.buf->map = NULL;
+    E.buf->maplen = 0;
+}
+
+int editorOpenMapped(char *filename) {                                   // {{{2
+    /* map the whole file read-only and split it into rows in place in the
+     * background, returns -1 if the file cannot be mapped (pipes, empty
+     * files, ...) so that the caller can fall back to reading it line by
+     * line */
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+
+    /* fstat() from <sys/stat.h>, only regular files can be mapped */
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    /* mmap() from <sys/mman.h>, pages are only read in when they are
+     * touched - the mapping would stay valid after the file descriptor is
+     * closed, it is kept open for saving */
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    E.buf->map = map;
+    E.buf->maplen = st.st_size;
+    E.buf->mapfd = fd;
+
+    /* the whole file is read front to back once, tell the kernel to read
+     * ahead aggressively */
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    /* gzip files are inflated on the fly, zstd ones are shown as they are */
+    if (st.st_size >= 2 && map[0] == '\x1f' && map[1] == '\x8b') {
+        if (editorGzOpen((unsigned char *)map, st.st_size) == 0) return 0;
+        E.buf->map = NULL;
+        munmap(map, st.st_size);
+        close(fd);
+        E.buf->mapfd = -1;
+        return -1;
+    }
+    if (st.st_size >= 4 && memcmp(map, "\x28\xb5\x2f\xfd", 4) == 0)
+        editorSetStatusMessage("zstd compressed files are not supported");
+
+    /* a valid sidecar index makes scanning the file unnecessary */
+    if (E.indexsidecar && editorIndexLoad(&st) == 0) return 0;
+
+    editorLoadStart(map, st.st_size);
+    return 0;
+}
+
+void editorOpen(char *filename) {                                        // {{{2
+    free(E.buf->filename);
+    /* strdup() from <string.h>, makes a copy of the string */
+    E.buf->filename = strdup(filename);
+    editorBufferIdentify();
+    editorSelectSyntaxHighlight();
+
+    /* prefer the memory mapped load mode, rows then point directly into the
+     * file mapping and no per line allocation is done for the text
+     * the file is indexed in the background, wait only for the first screen
+     * (headless runs wait for all of it so that scripts are deterministic) */
+    if (editorOpenMapped(filename) == 0) {
+        if (!E.buf->gz) {
+            E.buf->follow.offset = E.buf->maplen;
+            E.buf->follow.partial = E.buf->map[E.buf->maplen - 1] != '\n';
+        }
+        editorLoadWait(E.headless ? -1 : E.screenrows);
+        editorSwapReplay();
+        return;
+    }
+
+    /* FILE, fopen() and getline() come from <stdio.h>
+     * editorOpen() takes filename as an argument and uses fopen() to open
+     * the file for reading */
+    FILE *fp = fopen(filename, "r");
+    if (!fp) die("fopen");
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    /* get line and linelen from getline() instead of hardcoded values
+     * getline() is useful for reading lines from a file if we do not know
+     * how much memory to allocate for it
+     * first we pass it a null _line_ pointer and a _linecap_ (line capacity)
+     * of 0. getline() reads a line into memory and sets _line_ to point to
+     * the memory, also sets _linecap_ to know how much memory was allocated.
+     * its return value is the length of the line read or -1 if at the EOF.
+     * later we'll feed _line_ and _linecap_ back into getline() and it will
+     * try to reuse the memory already allocated as long the _linecap_ is
+     * big enough */
+    /* while loop to read the whole file, the while loop works because
+     * getline() returns -1 at EOF */
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        /* remember where following the file continues */
+        E.buf->follow.offset += linelen;
+        E.buf->follow.partial = line[linelen - 1] != '\n';
+        /* strip newline and carriage return chars from the end of the line */
+        while (linelen > 0 && (line[linelen - 1] == '\n' ||
+                               line[linelen - 1] == '\r'))
+            linelen--;
+        editorAppendRow(line, linelen);
+    }
+    free(line);
+    fclose(fp);
+    editorSwapReplay();
+}
+
+void editorSaveFlush(struct savewriter *w) {                             // {{{2
+    /* write the queued buffers with writev(), partial writes continue
+     * where the kernel stopped */
+    struct iovec *iov = w->iov;
+    int n = w->niov;
+    w->niov = 0;
+    while (n > 0 && !w->error) {
+        ssize_t written = writev(w->fd, iov, n);
+        if (written == -1) {
+            if (errno != EINTR) w->error = errno;
+            continue;
+        }
+        w->bytes += written;
+        while (n > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+void editorSaveBuffer(struct savewriter *w, const char *s, size_t len) { // {{{2
+    /* queue _len_ bytes at _s_, nothing is copied - the buffer has to stay
+     * valid until the queue is flushed */
+    if (len == 0) return;
+    if (w->niov == KILO_SAVE_IOV) editorSaveFlush(w);
+    w->iov[w->niov].iov_base = (void *)s;
+    w->iov[w->niov].iov_len = len;
+    w->niov++;
+}
+
+void editorSaveRange(struct savewriter *w, size_t off, size_t len) {     // {{{2
+    /* write the bytes [off, off + len) of the opened file - the kernel
+     * copies them from the original with copy_file_range() (or shares the
+     * extents on file systems that can), the data never passes through the
+     * editor; where that is not supported they are written from the
+     * mapping
+     * the text of a gzip file is written from the mapping span by span, each
+     * one pinned until it is written */
+    editorSaveFlush(w);
+    struct editorGzip *gz = E.buf->gz;
+    while (gz && len > 0) {
+        size_t n = len < KILO_GZ_SPAN ? len : KILO_GZ_SPAN;
+        editorGzPin(gz, E.buf->map + off, E.buf->map + off + n);
+        editorSaveBuffer(w, E.buf->map + off, n);
+        editorSaveFlush(w);
+        editorGzUnpin(gz, E.buf->map + off, E.buf->map + off + n);
+        off += n;
+        len -= n;
+    }
+#ifdef __linux__
+    loff_t in = off;
+    while (len > 0 && !w->error) {
+        ssize_t n = copy_file_range(E.buf->mapfd, &in, w->fd, NULL, len, 0);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        w->bytes += n;
+        len -= n;
+    }
+    off = in;
+#endif
+    while (len > 0) {
+        size_t n = len < KILO_SAVE_CHUNK ? len : KILO_SAVE_CHUNK;
+        editorSaveBuffer(w, E.buf->map + off, n);
+        off += n;
+        len -= n;
+    }
+}
+
+void editorSaveRows(struct savewriter *w) {                              // {{{2
+    /* stream all rows to the writer - runs of unmodified blocks are one
+     * range of the original file each, rows of modified blocks are queued
+     * buffer by buffer
+     * rows written from memory end with the line ending the file uses, but
+     * the last one has none if the last line of the file had none */
+    const char *eol = "\n";
+    int lasteol = 1;
+    if (E.buf->map) {
+        /* the first line of a gzip file is found in its first span */
+        size_t len = E.buf->maplen;
+        if (E.buf->gz && len > KILO_GZ_SPAN) len = KILO_GZ_SPAN;
+        editorGzPin(E.buf->gz, E.buf->map, E.buf->map + len);
+        const char *nl = scanFindByte(E.buf->map, len, '\n');
+        if (nl && nl > E.buf->map && nl[-1] == '\r') eol = "\r\n";
+        editorGzUnpin(E.buf->gz, E.buf->map, E.buf->map + len);
+
+        if (E.buf->maplen) {
+            const char *last = E.buf->map + E.buf->maplen - 1;
+            editorGzPin(E.buf->gz, last, last + 1);
+            lasteol = *last == '\n';
+            editorGzUnpin(E.buf->gz, last, last + 1);
+        }
+    }
+    int eollen = strlen(eol);
+
+    /* the block holding the last row */
+    int b, j, lastblock = E.buf->numblocks - 1;
+    while (lastblock > 0 && E.buf->block[lastblock].numrows == 0) lastblock--;
+
+    for (b = 0; b < E.buf->numblocks; b++) {
+        struct rowblock *blk = &E.buf->block[b];
+        if (blk->base && !blk->modified) {
+            /* blocks that continue each other in the mapping */
+            char *end = blk->end;
+            while (b + 1 < E.buf->numblocks && !E.buf->block[b + 1].modified &&
+                    E.buf->block[b + 1].base == end)
+                end = E.buf->block[++b].end;
+            editorSaveRange(w, blk->base - E.buf->map, end - blk->base);
+            /* the last line of the file may have no newline, rows that
+             * were appended after it start a new line */
+            if (end[-1] != '\n' && b + 1 < E.buf->numblocks)
+                editorSaveBuffer(w, eol, eollen);
+            continue;
+        }
+        for (j = 0; j < blk->numrows; j++) {
+            editorSaveBuffer(w, blk->row[j].chars, blk->row[j].size);
+            if (lasteol || b != lastblock || j + 1 < blk->numrows)
+                editorSaveBuffer(w, eol, eollen);
+        }
+    }
+    editorSaveFlush(w);
+}
+
+int editorSaveTo(const char *path, size_t *bytes) {                      // {{{2
+    /* write the rows to a temporary file next to _path_, flush it to disk
+     * and rename it over _path_ - a crash leaves either the old or the new
+     * file, never a partial one
+     * returns -1 with errno set on failure */
+    /* the file a symbolic link points to is replaced, not the link */
+    char *target = realpath(path, NULL);
+    if (target == NULL) {
+        if (errno != ENOENT) return -1;
+        target = strdup(path);
+    }
+    size_t len = strlen(target);
+    char *tmp = kmalloc(len + 16);
+    if (tmp == NULL) die("malloc");
+    snprintf(tmp, len + 16, "%s.kiloXXXXXX", target);
+
+    /* mkstemp() from <stdlib.h> creates the file with mode 0600, give it
+     * the mode of the file it replaces */
+    int fd = mkstemp(tmp);
+    int saved = errno;
+    if (fd != -1) {
+        struct stat st;
+        if (stat(target, &st) == 0) {
+            fchmod(fd, st.st_mode & 07777);
+            if (fchown(fd, st.st_uid, st.st_gid) == -1) {
+                /* not the owner - the new file is ours */
+            }
+        } else {
+            mode_t mask = umask(0);
+            umask(mask);
+            fchmod(fd, 0666 & ~mask);
+        }
+
+        struct savewriter w;
+        w.fd = fd;
+        w.niov = 0;
+        w.bytes = 0;
+        w.error = 0;
+        editorSaveRows(&w);
+        *bytes = w.bytes;
+
+        /* fsync() before rename(), otherwise the rename may reach the disk
+         * before the data does */
+        if (!w.error && fsync(fd) == -1) w.error = errno;
+        if (close(fd) == -1 && !w.error) w.error = errno;
+        if (!w.error && rename(tmp, target) == -1) w.error = errno;
+        if (w.error) unlink(tmp);
+        saved = w.error;
+        fd = w.error ? -1 : 0;
+    }
+
+    if (fd != -1) {
+        /* make the rename itself durable */
+        char *slash = strrchr(target, '/');
+        const char *dirname = ".";
+        if (slash) {
+            *slash = '\0';
+            dirname = slash == target ? "/" : target;
+        }
+        int dirfd = open(dirname, O_RDONLY);
+        if (dirfd != -1) {
+            fsync(dirfd);
+            close(dirfd);
+        }
+    }
+    free(tmp);
+    free(target);
+    errno = saved;
+    return fd == -1 ? -1 : 0;
+}
+
+void editorSave() {                                                      // {{{2
+    /* save the file, asking for a name if it has none - the text of a gzip
+     * file is saved uncompressed, under another name */
+    struct stat st;
+    if (E.buf->gz && E.buf->filename && stat(E.buf->filename, &st) == 0 &&
+            st.st_dev == E.buf->dev && st.st_ino == E.buf->ino) {
+        char *name = editorPrompt("Save uncompressed as: %s (ESC to cancel)",
+                NULL);
+        if (name == NULL) {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        free(E.buf->filename);
+        E.buf->filename = name;
+        editorSelectSyntaxHighlight();
+    }
+    if (E.buf->filename == NULL) {
+        E.buf->filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        if (E.buf->filename == NULL) {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        editorSelectSyntaxHighlight();
+    }
+    /* rows past the ones indexed so far are part of the file too */
+    if (E.buf->load.active) editorLoadWait(-1);
+
+    size_t bytes = 0;
+    double t = editorNow();
+    if (editorSaveTo(E.buf->filename, &bytes) == -1) {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+        return;
+    }
+    E.buf->dirty = 0;
+    /* a new file exists now */
+    editorBufferIdentify();
+    /* the journal starts over against the saved file */
+    editorSwapStop(1);
+    editorSwapIdentify();
+    editorSetStatusMessage("%zu bytes written to disk in %.0f ms", bytes,
+            (editorNow() - t) * 1e3);
+}
+
+void editorFollowAppend(char *s, size_t len) {                           // {{{2
+    /* split new data of the followed file into rows, the first line
+     * continues the last row if that one was not terminated yet */
+    while (len > 0) {
+        char *nl = (char *)scanFindByte(s, len, '\n');
+        size_t n = nl ? (size_t)(nl - s) : len;
+        if (E.buf->follow.partial && E.buf->numrows > 0) {
+            editorRowAppendString(editorRowAt(E.buf->numrows - 1), s, n);
+            editorSyntaxInvalidate(E.buf->numrows - 1);
+        } else
+            editorAppendRow(s, n);
+        E.buf->follow.partial = nl == NULL;
+
+        if (nl) {
+            /* strip the carriage return of a CRLF line ending, it may have
+             * come with an earlier read than the newline */
+            erow *row = editorRowAt(E.buf->numrows - 1);
+            if (row->size > 0 && row->chars[row->size - 1] == '\r') {
+                editorRowMakeWritable(row);
+                row->chars[--row->size] = '\0';
+                row->dirty = 1;
+                editorSyntaxInvalidate(E.buf->numrows - 1);
+            }
+            n++;
+        }
+        s += n;
+        len -= n;
+    }
+}
+
+void editorFollowRead() {                                                // {{{2
+    /* add the data appended to the followed file since the last call as
+     * rows, only the new bytes are read, never the whole file again
+     * a cursor on the last row (or past it) stays at the end of the file,
+     * the screen is repainted only if the new rows are visible */
+    /* rows appended while the file is indexed would end up in front of the
+     * indexed ones, editorLoadFinish() calls here again */
+    if (E.buf->load.active) return;
+    /* the block list must not change while it is searched by other
+     * threads, editorFindAllFinish() calls here again */
+    if (E.findall.active && E.findall.buf == E.buf) return;
+
+    struct stat st;
+    if (fstat(E.buf->follow.fd, &st) == -1) return;
+    if (st.st_size < E.buf->follow.offset) {
+        /* truncated (e.g. log rotation with copytruncate), keep the rows
+         * and follow the new contents from the start */
+        editorSetStatusMessage("%.40s was truncated", E.buf->filename);
+        E.buf->follow.offset = 0;
+        E.buf->follow.partial = 0;
+        E.redraw = 1;
+    }
+
+    off_t start = E.buf->follow.offset;
+    int first = E.buf->follow.partial ? E.buf->numrows - 1 : E.buf->numrows;
+    int atend = E.cy >= E.buf->numrows - 1;
+    int pastend = E.cy >= E.buf->numrows;
+
+    /* pread() from <unistd.h> reads at an offset without moving the file
+     * position */
+    char buf[KILO_FOLLOW_READ];
+    ssize_t n;
+    while ((n = pread(E.buf->follow.fd, buf, sizeof(buf),
+                    E.buf->follow.offset)) > 0) {
+        editorFollowAppend(buf, n);
+        E.buf->follow.offset += n;
+    }
+    if (E.buf->follow.offset == start) return;
+
+    if (atend) {
+        /* auto-scroll - keep the cursor on the last row */
+        E.cy = pastend ? E.buf->numrows : E.buf->numrows - 1;
+        int rowlen = E.cy < E.buf->numrows ? editorRowAt(E.cy)->size : 0;
+        if (E.cx > rowlen) E.cx = rowlen;
+    }
+
+    /* off-screen rows only change the line count in the status bar, which
+     * is updated at most every KILO_LOAD_STATUS_MS */
+    double now = editorNow();
+    if (!editorViewVisible()) return;
+    if (atend || first < E.rowoff + E.screenrows ||
+            now - E.buf->follow.lastupdate >= KILO_LOAD_STATUS_MS / 1000.0) {
+        E.buf->follow.lastupdate = now;
+        editorRequestRedraw();
+    }
+}
+
+void editorFollowEvent(int fd) {                                         // {{{2
+    /* event loop callback for the inotify descriptor - the file was
+     * written to, the events themselves carry nothing else of interest */
+    char buf[4096];
+    while (read(fd, buf, sizeof(buf)) > 0);
+    int j;
+    for (j = 0; j < E.numbufs; j++)
+        if (E.bufs[j]->follow.fd != -1 && E.bufs[j]->follow.inotify == fd)
+            break;
+    if (j == E.numbufs) return;
+    struct editorView *prev = editorEnterBuffer(E.bufs[j]);
+    editorFollowRead();
+    editorSwitchView(prev);
+}
+
+int editorFollowStart() {                                                // {{{2
+    /* follow the opened file like tail -f, returns -1 if it cannot be
+     * followed (no file, not a regular file, no inotify) */
+#ifdef __linux__
+    /* appended compressed data would have to be inflated too */
+    if (E.buf->filename == NULL || E.buf->gz) return -1;
+    E.buf->follow.fd = open(E.buf->filename, O_RDONLY);
+    if (E.buf->follow.fd == -1) return -1;
+
+    struct stat st;
+    /* inotify_init1() and inotify_add_watch() from <sys/inotify.h> */
+    E.buf->follow.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fstat(E.buf->follow.fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+            E.buf->follow.inotify == -1 ||
+            inotify_add_watch(E.buf->follow.inotify, E.buf->filename,
+                IN_MODIFY) == -1) {
+        if (E.buf->follow.inotify != -1) close(E.buf->follow.inotify);
+        close(E.buf->follow.fd);
+        E.buf->follow.fd = -1;
+        return -1;
+    }
+    editorWatchFd(E.buf->follow.inotify, editorFollowEvent);
+
+    /* pick up whatever was written since the file was opened */
+    editorFollowRead();
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void editorFollowStop() {                                                // {{{2
+    /* stop following the opened file */
+    if (E.buf->follow.fd == -1) return;
+    editorUnwatchFd(E.buf->follow.inotify);
+    close(E.buf->follow.inotify);
+    close(E.buf->follow.fd);
+    E.buf->follow.fd = -1;
+}
+
+void editorClose() {                                                     // {{{2
+    /* free all rows and the file mapping, the editor is empty afterwards */
+    editorLoadCancel();
+    editorFollowStop();
+    editorSwapStop(1);
+    E.buf->swap.enabled = 0;
+    free(E.buf->filename);
+    E.buf->filename = NULL;
+    E.buf->syntax = NULL;
+    E.buf->hlfrontier = 0;
+
+    /* only rows near the viewport have a render buffer and only edited rows
+     * a heap block, everything else goes with the arena */
+    int b, j;
+    for (j = E.rendlo; j < E.rendhi && j < E.buf->numrows; j++)
+        editorFreeRender(editorRowAt(j));
+    editorFreeStrays(0, 0);
+    for (b = 0; b < E.buf->numblocks && E.buf->numheaprows > 0; b++) {
+        if (!E.buf->block[b].row) continue;
+        for (j = 0; j < E.buf->block[b].numrows; j++)
+            editorFreeRow(&E.buf->block[b].row[j]);
+    }
+    for (b = 0; b < E.buf->numblocks; b++) {
+        free(E.buf->block[b].row);
+        free(E.buf->block[b].lineoff);
+        free(E.buf->block[b].hlstate);
+    }
+    E.buf->numtables = 0;
+    arenaRelease(&E.buf->arena);
+    E.buf->numheaprows = 0;
+    E.buf->numblocks = 0;
+    E.buf->numrows = 0;
+    E.buf->numloaded = 0;
+    E.buf->curblock = -1;
+    E.rendlo = E.rendhi = 0;
+
+    editorGzClose();
+    if (E.buf->map) munmap(E.buf->map, E.buf->maplen);
+    E.buf->map = NULL;
+    E.buf->maplen = 0;
+    if (E.buf->mapfd != -1) close(E.buf->mapfd);
+    E.buf->mapfd = -1;
+    E.buf->dirty = 0;
+    editorUndoReset();
+    E.buf->follow.offset = 0;
+    E.buf->follow.partial = 0;
+
+    E.cx = E.cy = 0;
+    E.rowoff = E.rowsub = E.coloff = 0;
+    E.framevalid = 0;
+}
+
+// buffers ---------------------------------------------------------------- {{{1
+
+void editorViewSave() {                                                  // {{{2
+    /* copy the state of the active view from E back to its struct */
+    struct editorView *v = E.view;
+    v->screenrows = E.screenrows;
+    v->cx = E.cx;
+    v->cy = E.cy;
+    v->rx = E.rx;
+    v->rowoff = E.rowoff;
+    v->coloff = E.coloff;
+    v->wrap = E.wrap;
+    v->rowsub = E.rowsub;
+    v->ry = E.ry;
+    v->rendlo = E.rendlo;
+    v->rendhi = E.rendhi;
+    v->framerowoff = E.framerowoff;
+    v->framerowsub = E.framerowsub;
+    v->jumpwait = E.jumpwait;
+    v->jumppct = E.jumppct;
+}
+
+void editorViewLoad(struct editorView *v) {                              // {{{2
+    /* make _v_ the active view, its state is copied into E - a cursor past
+     * text that was deleted through another view of the buffer is put
+     * back onto the text */
+    E.view = v;
+    E.buf = v->buf;
+    E.screenrows = v->screenrows;
+    E.cx = v->cx;
+    E.cy = v->cy;
+    E.rx = v->rx;
+    E.rowoff = v->rowoff;
+    E.coloff = v->coloff;
+    E.wrap = v->wrap;
+    E.rowsub = v->rowsub;
+    E.ry = v->ry;
+    E.rendlo = v->rendlo;
+    E.rendhi = v->rendhi;
+    E.framerowoff = v->framerowoff;
+    E.framerowsub = v->framerowsub;
+    E.jumpwait = v->jumpwait;
+    E.jumppct = v->jumppct;
+
+    if (E.cy > E.buf->numrows) E.cy = E.buf->numrows;
+    if (E.cy < E.buf->numrows) {
+        erow *row = editorRowAt(E.cy);
+        if (E.cx > row->size) E.cx = row->size;
+        E.cx = charStart(row->chars, row->size, E.cx);
+    } else {
+        E.cx = 0;
+    }
+}
+
+void editorSwitchView(struct editorView *v) {                            // {{{2
+    if (v == E.view) return;
+    editorViewSave();
+    editorViewLoad(v);
+}
+
+struct editorView *editorEnterBuffer(struct editorBuffer *b) {           // {{{2
+    /* make a view of buffer _b_ active for work on it from the event loop,
+     * the first view showing it or else where it was left, returns the view
+     * to switch back to afterwards */
+    struct editorView *prev = E.view;
+    if (b == E.buf) return prev;
+    int j;
+    for (j = 0; j < E.numviews && E.views[j].buf != b; j++);
+    editorSwitchView(j < E.numviews ? &E.views[j] : &b->park);
+    return prev;
+}
+
+int editorViewVisible() {                                                // {{{2
+    /* non-zero if the active view is on the screen, and not where a
+     * buffer no view shows was left - in daemon mode the buffer may be on
+     * the screen of another client */
+    return E.view != &E.buf->park || editorNextView(NULL) != NULL;
+}
+
+struct editorView *editorNextView(struct editorView *v) {                // {{{2
+    /* the other views showing the buffer of the active view, the first one
+     * for _v_ = NULL and the one after _v_ else, NULL after the last - the
+     * active view itself is left out, its state is in E
+     * the views of all screens are visited, screen by screen, those of the
+     * screens that are not active hold their state themselves */
+    int k = 0, j = 0;
+    if (v) {
+        for (k = 0; k < E.numscreens; k++) {
+            struct editorView *views = E.screens[k]->views;
+            if (v >= views && v < views + KILO_MAX_VIEWS) break;
+        }
+        j = v - E.screens[k]->views + 1;
+    }
+    for (; k < E.numscreens; k++, j = 0) {
+        struct editorScreen *s = E.screens[k];
+        int n = s == E.screen ? E.numviews : s->numviews;
+        for (; j < n; j++)
+            if (&s->views[j] != E.view && s->views[j].buf == E.buf)
+                return &s->views[j];
+    }
+    return NULL;
+}
+
+int editorShiftRow(int row, int at, int n) {                             // {{{2
+    /* where row _row_ is after the rows from _at_ on moved down by _n_, a
+     * negative _n_ removed -n rows from _at_ on and moved the rest up */
+    if (row <= at) return row;
+    if (n < 0 && row - at < -n) return at;
+    return row + n;
+}
+
+void editorRowsShifted(int at, int n) {                                  // {{{2
+    /* rows below _at_ moved by _n_ (see editorShiftRow()) - the render
+     * ranges move along, and the other views of the buffer keep showing
+     * the same text */
+    E.rendlo = editorShiftRow(E.rendlo, at, n);
+    E.rendhi = editorShiftRow(E.rendhi, at, n);
+    int j;
+    for (j = 0; j < E.buf->numstray; j++)
+        E.buf->stray[j] = editorShiftRow(E.buf->stray[j], at, n);
+    struct editorView *v;
+    for (v = editorNextView(NULL); v; v = editorNextView(v)) {
+        v->rendlo = editorShiftRow(v->rendlo, at, n);
+        v->rendhi = editorShiftRow(v->rendhi, at, n);
+        v->cy = editorShiftRow(v->cy, at, n);
+        v->rowoff = editorShiftRow(v->rowoff, at, n);
+    }
+}
+
+int editorOtherViewsRender(int lo, int hi) {                             // {{{2
+    /* non-zero if rows [lo, hi) overlap the render range of another view
+     * of the buffer */
+    struct editorView *v;
+    for (v = editorNextView(NULL); v; v = editorNextView(v))
+        if (lo < v->rendhi && v->rendlo < hi) return 1;
+    return 0;
+}
+
+void editorReleaseRender() {                                             // {{{2
+    /* the active view stops showing its buffer, the render buffers only its
+     * range held are freed */
+    int j;
+    for (j = E.rendlo; j < E.rendhi && j < E.buf->numrows; j++) {
+        erow *row = editorRowAt(j);
+        if (row->render && !editorOtherViewsRender(j, j + 1))
+            editorFreeRender(row);
+    }
+    editorFreeStrays(0, 0);
+    E.rendlo = E.rendhi = 0;
+}
+
+void editorViewLeave() {                                                 // {{{2
+    /* the active view stops showing its buffer, if no other view shows it
+     * the buffer remembers where it was left */
+    editorReleaseRender();
+    editorViewSave();
+    if (!editorNextView(NULL)) E.buf->park = *E.view;
+}
+
+void editorLayout() {                                                    // {{{2
+    /* split the screen lines above the message bar evenly between the
+     * views, each view ends with its status bar */
+    int lines = E.screenlines - 1;
+    int top = 0;
+    int j;
+    for (j = 0; j < E.numviews; j++) {
+        int h = lines / E.numviews + (j < lines % E.numviews);
+        E.views[j].top = top;
+        E.views[j].screenrows = h - 1;
+        top += h;
+    }
+    E.screenrows = E.view->screenrows;
+    /* the views moved, the terminal contents are of no use */
+    E.framevalid = 0;
+}
+
+struct editorBuffer *editorBufferNew() {                                 // {{{2
+    /* a new empty buffer at the end of the buffer list */
+    struct editorBuffer *b = kcalloc(1, sizeof(struct editorBuffer));
+    if (b == NULL) die("calloc");
+    b->curblock = -1;
+    b->follow.fd = -1;
+    b->mapfd = -1;
+    b->undo.limit = E.undolimit;
+    b->swap.fd = -1;
+    /* shown from the top, in the mode and size of the active view */
+    b->park.buf = b;
+    b->park.screenrows = E.screenrows;
+    b->park.wrap = E.wrap;
+
+    if (E.numbufs == E.bufcap) {
+        int cap = E.bufcap ? E.bufcap * 2 : 16;
+        struct editorBuffer **bufs = krealloc(E.bufs, sizeof(*bufs) * cap);
+        if (bufs == NULL) die("realloc");
+        E.bufs = bufs;
+        E.bufcap = cap;
+    }
+    E.bufs[E.numbufs++] = b;
+    b->refs = 1;
+    return b;
+}
+
+void editorBufferUnref(struct editorBuffer *b) {                         // {{{2
+    /* drop a reference to buffer _b_, the last one frees its rows, its
+     * mapping and all the rest */
+    if (--b->refs > 0) return;
+    struct editorView *prev = editorEnterBuffer(b);
+    editorClose();
+    editorSwitchView(prev);
+    free(b->block);
+    free(b->blockidx);
+    free(b->stray);
+    free(b);
+}
+
+int editorBufferIndex(struct editorBuffer *b) {                          // {{{2
+    /* position of buffer _b_ in the buffer list */
+    int j;
+    for (j = 0; j < E.numbufs && E.bufs[j] != b; j++);
+    return j;
+}
+
+void editorBufferIdentify() {                                            // {{{2
+    /* remember which file the buffer of the active view has opened */
+    struct stat st;
+    if (E.buf->filename && stat(E.buf->filename, &st) == 0) {
+        E.buf->dev = st.st_dev;
+        E.buf->ino = st.st_ino;
+    } else {
+        E.buf->dev = 0;
+        E.buf->ino = 0;
+    }
+}
+
+struct editorBuffer *editorBufferFind(const char *filename) {            // {{{2
+    /* the buffer of _filename_ if it is open already, also under another
+     * name of the same file (a relative path, a link) */
+    struct stat st;
+    int exists = stat(filename, &st) == 0;
+    int j;
+    for (j = 0; j < E.numbufs; j++) {
+        struct editorBuffer *b = E.bufs[j];
+        if (b->filename == NULL) continue;
+        if (exists ? b->ino && b->ino == st.st_ino && b->dev == st.st_dev :
+                strcmp(b->filename, filename) == 0)
+            return b;
+    }
+    return NULL;
+}
+
+void editorShowBuffer(struct editorBuffer *b) {                          // {{{2
+    /* show buffer _b_ in the active view where it was left */
+    if (b == E.buf) return;
+    struct editorBuffer *old = E.buf;
+    struct editorView *v = E.view;
+    editorViewLeave();
+    b->refs++;
+    int top = v->top, rows = v->screenrows;
+    *v = b->park;
+    v->top = top;
+    v->screenrows = rows;
+    v->rendlo = v->rendhi = 0;
+    /* the terminal shows the other buffer there, nothing to scroll */
+    v->framerowoff = v->rowoff;
+    v->framerowsub = v->rowsub;
+    editorViewLoad(v);
+    editorBufferUnref(old);
+}
+
+int editorOpenBuffer(char *filename) {                                   // {{{2
+    /* show _filename_ in the active view - a file that is open already is
+     * not read again, the views share its buffer - an empty buffer that
+     * was never named or changed is replaced
+     * returns -1 if the file cannot be read */
+    struct editorBuffer *b = editorBufferFind(filename);
+    if (b) {
+        editorShowBuffer(b);
+        return 0;
+    }
+    if (access(filename, R_OK) == -1) return -1;
+
+    struct editorBuffer *old = E.buf;
+    int scratch = old->filename == NULL && !old->dirty &&
+        old->numrows == 0 && old->refs == 2;
+    editorShowBuffer(editorBufferNew());
+    if (scratch) {
+        int j = editorBufferIndex(old);
+        memmove(&E.bufs[j], &E.bufs[j + 1],
+                sizeof(E.bufs[0]) * (E.numbufs - j - 1));
+        E.numbufs--;
+        editorBufferUnref(old);
+    }
+    editorOpen(filename);
+    return 0;
+}
+
+void editorCloseBuffer() {                                               // {{{2
+    /* close the buffer of the active view - the views showing it show the
+     * next buffer in the list instead, or a new empty one if there is no
+     * other */
+    struct editorBuffer *b = E.buf;
+    int j = editorBufferIndex(b);
+    memmove(&E.bufs[j], &E.bufs[j + 1],
+            sizeof(E.bufs[0]) * (E.numbufs - j - 1));
+    E.numbufs--;
+    struct editorBuffer *next = E.numbufs == 0 ? editorBufferNew() :
+        E.bufs[j < E.numbufs ? j : j - 1];
+
+    struct editorView *active = E.view;
+    int k;
+    for (k = 0; k < E.numviews; k++) {
+        if (E.views[k].buf != b) continue;
+        editorSwitchView(&E.views[k]);
+        editorShowBuffer(next);
+    }
+    editorSwitchView(active);
+    /* the reference of the buffer list */
+    editorBufferUnref(b);
+}
+
+void editorCycleBuffer(int dir) {                                        // {{{2
+    /* show the next buffer in the list (_dir_ = 1) or the one before (-1)
+     * in the active view */
+    int j = editorBufferIndex(E.buf);
+    editorShowBuffer(E.bufs[(j + dir + E.numbufs) % E.numbufs]);
+}
+
+void editorSplitView() {                                                 // {{{2
+    /* split the active view in two, the new one below shows the same buffer
+     * at the same position and becomes the active one */
+    if (E.numviews == KILO_MAX_VIEWS ||
+            (E.screenlines - 1) / (E.numviews + 1) < 2) {
+        editorSetStatusMessage("No room for another view");
+        return;
+    }
+    editorViewSave();
+    int j = E.view - E.views;
+    memmove(&E.views[j + 2], &E.views[j + 1],
+            sizeof(struct editorView) * (E.numviews - j - 1));
+    E.views[j + 1] = E.views[j];
+    E.views[j + 1].rendlo = E.views[j + 1].rendhi = 0;
+    E.numviews++;
+    E.buf->refs++;
+    editorViewLoad(&E.views[j + 1]);
+    editorLayout();
+}
+
+void editorCloseView() {                                                 // {{{2
+    /* close the active view, the one above takes its place (the one below
+     * for the top view) */
+    if (E.numviews == 1) return;
+    struct editorBuffer *b = E.buf;
+    editorViewLeave();
+    int j = E.view - E.views;
+    memmove(&E.views[j], &E.views[j + 1],
+            sizeof(struct editorView) * (E.numviews - j - 1));
+    E.numviews--;
+    editorViewLoad(&E.views[j > 0 ? j - 1 : 0]);
+    editorLayout();
+    editorBufferUnref(b);
+}
+
+void editorCycleView() {                                                 // {{{2
+    /* make the next view from the top active */
+    int j = E.view - E.views;
+    editorSwitchView(&E.views[(j + 1) % E.numviews]);
+}
+
+int editorDirtyBuffers() {                                               // {{{2
+    /* number of buffers with unsaved changes */
+    int n = 0;
+    int j;
+    for (j = 0; j < E.numbufs; j++)
+        if (E.bufs[j]->dirty) n++;
+    return n;
+}
+
+void editorOpenPrompt() {                                                // {{{2
+    /* ask for a file and show it in the active view */
+    char *name = editorPrompt("Open: %s (ESC to cancel)", NULL);
+    if (name == NULL) return;
+    if (editorOpenBuffer(name) == -1)
+        editorSetStatusMessage("Can't open %.40s: %s", name, strerror(errno));
+    free(name);
+}
+
+// regex ------------------------------------------------------------------ {{{1
+
+/* regular expressions for the search - a pattern is parsed into a syntax
+ * tree and compiled into two NFA programs, one for the pattern and one for
+ * the pattern reversed, which run as lazily built DFAs: a DFA state is
+ * the set of NFA instructions the threads are at, it is created the first
+ * time a transition leads to it, so matching never backtracks and costs one
+ * table lookup per byte once the states in use exist
+ * syntax: . [abc] [^a-z] \d \w \s \D \W \S ^ $ | ( ) (?: ) * + ? {n} {n,}
+ * {n,m}, any other escaped character stands for itself, a match never spans
+ * two lines */
+
+void reSetAdd(uint32_t *set, int c) {                                    // {{{2
+    set[c >> 5] |= 1u << (c & 31);
+}
+
+int reSetHas(const uint32_t *set, int c) {                               // {{{2
+    return set[c >> 5] >> (c & 31) & 1;
+}
+
+int reError(struct reparser *ps, const char *error) {                    // {{{2
+    /* fail parsing with _error_, returns -1 */
+    if (ps->error == NULL) ps->error = error;
+    return -1;
+}
+
+int reNodeNew(struct reparser *ps, enum reNode type) {                   // {{{2
+    /* append a syntax tree node, returns its index */
+    if (ps->numnodes == ps->capnodes) {
+        ps->capnodes = ps->capnodes ? ps->capnodes * 2 : 64;
+        ps->node = krealloc(ps->node, sizeof(struct renode) * ps->capnodes);
+        if (ps->node == NULL) die("realloc");
+    }
+    struct renode *n = &ps->node[ps->numnodes];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    return ps->numnodes++;
+}
+
+int reSetNew(struct reparser *ps) {                                      // {{{2
+    /* append an empty byte set to the regex, returns its index */
+    struct regex *re = ps->re;
+    if (re->numsets == ps->capsets) {
+        ps->capsets = ps->capsets ? ps->capsets * 2 : 16;
+        re->set = krealloc(re->set, sizeof(re->set[0]) * ps->capsets);
+        if (re->set == NULL) die("realloc");
+    }
+    memset(re->set[re->numsets], 0, sizeof(re->set[0]));
+    return re->numsets++;
+}
+
+int reClassEscape(uint32_t *set, int c) {                                // {{{2
+    /* add the bytes of the class escape \c (\d, \w, \s or the negation in
+     * upper case) to _set_, returns 0 if _c_ is not a class escape */
+    int lc = tolower(c);
+    if (lc != 'd' && lc != 'w' && lc != 's') return 0;
+    int neg = c != lc;
+    int j;
+    for (j = 0; j < 256; j++) {
+        int in;
+        if (lc == 'd') in = j >= '0' && j <= '9';
+        else if (lc == 'w') in = j < 128 && (isalnum(j) || j == '_');
+        else in = j == ' ' || (j >= '\t' && j <= '\r');
+        if (in != neg) reSetAdd(set, j);
+    }
+    return 1;
+}
+
+int reEscapeByte(int c) {                                                // {{{2
+    /* the byte an escaped character stands for */
+    switch (c) {
+        case 't': return '\t';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        default: return c;
+    }
+}
+
+int reParseClass(struct reparser *ps, uint32_t *set) {                   // {{{2
+    /* parse a bracket expression after the [ into _set_ */
+    uint32_t bits[8] = {0};
+    int neg = *ps->p == '^';
+    if (neg) ps->p++;
+    int first = 1;
+    int j;
+    while (*ps->p && (*ps->p != ']' || first)) {
+        first = 0;
+        int lo = (unsigned char)*ps->p++;
+        if (lo == '\\') {
+            if (*ps->p == '\0') break;
+            int e = (unsigned char)*ps->p++;
+            if (reClassEscape(bits, e)) continue;
+            lo = reEscapeByte(e);
+        }
+        if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+            ps->p++;
+            int hi = (unsigned char)*ps->p++;
+            if (hi == '\\') {
+                if (*ps->p == '\0') break;
+                hi = reEscapeByte((unsigned char)*ps->p++);
+            }
+            if (hi < lo) return reError(ps, "bad range");
+            for (j = lo; j <= hi; j++) reSetAdd(bits, j);
+        } else {
+            reSetAdd(bits, lo);
+        }
+    }
+    if (*ps->p != ']') return reError(ps, "missing ]");
+    ps->p++;
+    for (j = 0; j < 8; j++) set[j] = neg ? ~bits[j] : bits[j];
+    return 0;
+}
+
+int reParseAtom(struct reparser *ps) {                                   // {{{2
+    /* parse a group, an anchor or something matching one byte */
+    int c = (unsigned char)*ps->p;
+    if (c == '(') {
+        ps->p++;
+        if (ps->p[0] == '?' && ps->p[1] == ':') ps->p += 2;
+        if (++ps->depth > KILO_REGEX_MAX_DEPTH)
+            return reError(ps, "nested too deeply");
+        int n = reParseAlt(ps);
+        ps->depth--;
+        if (n < 0) return -1;
+        if (*ps->p != ')') return reError(ps, "missing )");
+        ps->p++;
+        return n;
+    }
+    if (c == '^' || c == '$') {
+        ps->p++;
+        return reNodeNew(ps, c == '^' ? RE_NODE_BEGIN : RE_NODE_END);
+    }
+    if (c == '*' || c == '+' || c == '?')
+        return reError(ps, "nothing to repeat");
+
+    int n = reNodeNew(ps, RE_NODE_SET);
+    int set = reSetNew(ps);
+    ps->node[n].set = set;
+    uint32_t *bits = ps->re->set[set];
+    ps->p++;
+    if (c == '.') {
+        memset(bits, 0xff, sizeof(ps->re->set[0]));
+    } else if (c == '[') {
+        if (reParseClass(ps, bits) < 0) return -1;
+    } else if (c == '\\') {
+        if (*ps->p == '\0') return reError(ps, "trailing \\");
+        int e = (unsigned char)*ps->p++;
+        if (!reClassEscape(bits, e)) reSetAdd(bits, reEscapeByte(e));
+    } else {
+        reSetAdd(bits, c);
+    }
+    return n;
+}
+
+int reParseBounds(struct reparser *ps, int *min, int *max) {             // {{{2
+    /* parse {n}, {n,} or {n,m}, returns 0 if the brace does not start one
+     * (it is an ordinary character then) and -1 on errors */
+    char *p = (char *)ps->p + 1;
+    if (!isdigit((unsigned char)*p)) return 0;
+    long lo = strtol(p, &p, 10);
+    long hi = lo;
+    if (*p == ',') {
+        p++;
+        hi = isdigit((unsigned char)*p) ? strtol(p, &p, 10) : -1;
+    }
+    if (*p != '}') return 0;
+    if (lo > KILO_REGEX_MAX_REPEAT || hi > KILO_REGEX_MAX_REPEAT)
+        return reError(ps, "repeat count too big");
+    if (hi >= 0 && hi < lo) return reError(ps, "bad repeat count");
+    *min = lo;
+    *max = hi;
+    ps->p = p + 1;
+    return 1;
+}
+
+int reParseRepeat(struct reparser *ps) {                                 // {{{2
+    /* parse an atom followed by any number of repetition operators */
+    int n = reParseAtom(ps);
+    if (n < 0) return -1;
+    while (1) {
+        int min, max;
+        char c = *ps->p;
+        if (c == '*' || c == '+' || c == '?') {
+            min = c == '+';
+            max = c == '?' ? 1 : -1;
+            ps->p++;
+        } else if (c == '{') {
+            int r = reParseBounds(ps, &min, &max);
+            if (r < 0) return -1;
+            if (r == 0) break;
+        } else {
+            break;
+        }
+        int r = reNodeNew(ps, RE_NODE_REPEAT);
+        ps->node[r].a = n;
+        ps->node[r].min = min;
+        ps->node[r].max = max;
+        n = r;
+    }
+    return n;
+}
+
+int reParseCat(struct reparser *ps) {                                    // {{{2
+    /* parse a sequence up to the next | or ) */
+    int n = -1;
+    while (*ps->p && *ps->p != '|' && *ps->p != ')') {
+        int r = reParseRepeat(ps);
+        if (r < 0) return -1;
+        if (n < 0) {
+            n = r;
+        } else {
+            int cat = reNodeNew(ps, RE_NODE_CAT);
+            ps->node[cat].a = n;
+            ps->node[cat].b = r;
+            n = cat;
+        }
+    }
+    return n < 0 ? reNodeNew(ps, RE_NODE_EMPTY) : n;
+}
+
+int reParseAlt(struct reparser *ps) {                                    // {{{2
+    /* parse alternatives separated by | */
+    int n = reParseCat(ps);
+    if (n < 0) return -1;
+    while (*ps->p == '|') {
+        ps->p++;
+        int r = reParseCat(ps);
+        if (r < 0) return -1;
+        int alt = reNodeNew(ps, RE_NODE_ALT);
+        ps->node[alt].a = n;
+        ps->node[alt].b = r;
+        n = alt;
+    }
+    return n;
+}
+
+int reEmit(struct reprog *prog, enum reOp op, int x, int y) {            // {{{2
+    /* append an instruction, returns its index or -1 if the program is
+     * too big */
+    if (prog->numinst == KILO_REGEX_MAX_INST) return -1;
+    if (prog->numinst == prog->cap) {
+        prog->cap = prog->cap ? prog->cap * 2 : 64;
+        prog->inst = krealloc(prog->inst, sizeof(struct reinst) * prog->cap);
+        if (prog->inst == NULL) die("realloc");
+    }
+    prog->inst[prog->numinst].op = op;
+    prog->inst[prog->numinst].x = x;
+    prog->inst[prog->numinst].y = y;
+    return prog->numinst++;
+}
+
+int reCompileNode(struct reparser *ps, struct reprog *prog, int n,
+        int reverse) {                                                   // {{{2
+    /* append the instructions of node _n_, _reverse_ builds the program
+     * matching the reversed pattern: sequences are emitted back to front
+     * and the anchors swap places
+     * returns -1 if the program gets too big */
+    struct renode *nd = &ps->node[n];
+    int j, split, jmp;
+    switch (nd->type) {
+        case RE_NODE_SET:
+            return reEmit(prog, RE_BYTE, nd->set, 0) < 0 ? -1 : 0;
+        case RE_NODE_EMPTY:
+            return 0;
+        case RE_NODE_BEGIN:
+        case RE_NODE_END:
+            return reEmit(prog, (nd->type == RE_NODE_BEGIN) != reverse ?
+                    RE_BEGIN : RE_END, 0, 0) < 0 ? -1 : 0;
+        case RE_NODE_CAT:
+            if (reCompileNode(ps, prog, reverse ? nd->b : nd->a, reverse) < 0)
+                return -1;
+            return reCompileNode(ps, prog, reverse ? nd->a : nd->b, reverse);
+        case RE_NODE_ALT:
+            /* split L1, L2; L1: a; jmp L3; L2: b; L3: */
+            if ((split = reEmit(prog, RE_SPLIT, 0, 0)) < 0) return -1;
+            prog->inst[split].x = split + 1;
+            if (reCompileNode(ps, prog, nd->a, reverse) < 0) return -1;
+            if ((jmp = reEmit(prog, RE_JMP, 0, 0)) < 0) return -1;
+            prog->inst[split].y = jmp + 1;
+            if (reCompileNode(ps, prog, nd->b, reverse) < 0) return -1;
+            prog->inst[jmp].x = prog->numinst;
+            return 0;
+        case RE_NODE_REPEAT:
+            for (j = 0; j < nd->min; j++)
+                if (reCompileNode(ps, prog, nd->a, reverse) < 0) return -1;
+            if (nd->max < 0) {
+                /* L1: split L2, L3; L2: a; jmp L1; L3: */
+                if ((split = reEmit(prog, RE_SPLIT, 0, 0)) < 0) return -1;
+                prog->inst[split].x = split + 1;
+                if (reCompileNode(ps, prog, nd->a, reverse) < 0) return -1;
+                if (reEmit(prog, RE_JMP, split, 0) < 0) return -1;
+                prog->inst[split].y = prog->numinst;
+            } else {
+                /* optional copies, each split skips to the end, the splits
+                 * are chained through y until the end is known */
+                int chain = -1;
+                for (j = nd->min; j < nd->max; j++) {
+                    if ((split = reEmit(prog, RE_SPLIT, 0, chain)) < 0)
+                        return -1;
+                    prog->inst[split].x = split + 1;
+                    chain = split;
+                    if (reCompileNode(ps, prog, nd->a, reverse) < 0) return -1;
+                }
+                while (chain >= 0) {
+                    int next = prog->inst[chain].y;
+                    prog->inst[chain].y = prog->numinst;
+                    chain = next;
+                }
+            }
+            return 0;
+    }
+    return 0;
+}
+
+int rePrefix(struct reparser *ps, int n, struct regex *re) {            // {{{2
+    /* append the literal bytes node _n_ starts with to the prefix of _re_,
+     * returns non-zero if the node is nothing but literal bytes, so that the
+     * prefix continues with what follows it */
+    struct renode *nd = &ps->node[n];
+    int j, c = -1;
+    switch (nd->type) {
+        case RE_NODE_SET:
+            for (j = 0; j < 256; j++) {
+                if (!reSetHas(re->set[nd->set], j)) continue;
+                if (c >= 0) return 0;
+                c = j;
+            }
+            if (c < 0 || re->prefixlen == KILO_REGEX_PREFIX) return 0;
+            re->prefix[re->prefixlen++] = c;
+            return 1;
+        case RE_NODE_EMPTY:
+        case RE_NODE_BEGIN:
+        case RE_NODE_END:
+            /* zero width */
+            return 1;
+        case RE_NODE_CAT:
+            return rePrefix(ps, nd->a, re) && rePrefix(ps, nd->b, re);
+        case RE_NODE_REPEAT:
+            /* the first copy is there, what follows it is not known */
+            if (nd->min > 0) rePrefix(ps, nd->a, re);
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+void regexFree(struct regex *re) {                                       // {{{2
+    int j;
+    for (j = 0; j <= KILO_FIND_THREADS; j++) {
+        struct rematcher *m = re->matcher[j];
+        if (m == NULL) continue;
+        struct redfa *d[3] = {&m->fwd, &m->rev, &m->anch};
+        int k;
+        for (k = 0; k < 3; k++) {
+            free(d[k]->trans);
+            free(d[k]->flags);
+            free(d[k]->setoff);
+            free(d[k]->setlen);
+            free(d[k]->pool);
+            free(d[k]->hash);
+            free(d[k]->list);
+            free(d[k]->stack);
+            free(d[k]->mark);
+        }
+        free(m);
+    }
+    free(re->fwd.inst);
+    free(re->rev.inst);
+    free(re->set);
+    free(re->pattern);
+    free(re);
+}
+
+struct regex *regexCompile(const char *pattern, const char **error) {    // {{{2
+    /* compile _pattern_, returns NULL and sets _error_ if it is invalid */
+    struct regex *re = kcalloc(1, sizeof(struct regex));
+    if (re == NULL) die("calloc");
+    struct reparser ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.p = pattern;
+    ps.re = re;
+
+    int root = reParseAlt(&ps);
+    if (root >= 0 && *ps.p) root = reError(&ps, "unmatched )");
+    if (root >= 0 && (reCompileNode(&ps, &re->fwd, root, 0) < 0 ||
+                reEmit(&re->fwd, RE_MATCH, 0, 0) < 0 ||
+                reCompileNode(&ps, &re->rev, root, 1) < 0 ||
+                reEmit(&re->rev, RE_MATCH, 0, 0) < 0))
+        root = reError(&ps, "pattern too big");
+    if (root < 0) {
+        *error = ps.error;
+        free(ps.node);
+        regexFree(re);
+        return NULL;
+    }
+    rePrefix(&ps, root, re);
+    free(ps.node);
+
+    /* newlines end lines, they are never matched */
+    int j, k;
+    for (k = 0; k < re->numsets; k++) re->set[k]['\n' >> 5] &= ~(1u << ('\n' & 31));
+
+    /* byte classes - start with the newline, the carriage return and
+     * everything else, then split the classes by every set */
+    memset(re->classof, 0, sizeof(re->classof));
+    re->classof['\n'] = 1;
+    re->classof['\r'] = 2;
+    re->numclasses = 3;
+    for (k = 0; k < re->numsets; k++) {
+        int remap[256][2];
+        int n = 0;
+        memset(remap, -1, sizeof(remap));
+        for (j = 0; j < 256; j++) {
+            int *r = &remap[re->classof[j]][reSetHas(re->set[k], j)];
+            if (*r < 0) *r = n++;
+            re->classof[j] = *r;
+        }
+        re->numclasses = n;
+    }
+    re->pattern = strdup(pattern);
+    if (re->pattern == NULL) die("strdup");
+    return re;
+}
+
+void dfaFlush(struct redfa *d) {                                         // {{{2
+    /* drop all states, they are built again as they are needed */
+    d->numstates = 0;
+    d->poollen = 0;
+    memset(d->hash, 0, sizeof(int) * KILO_REGEX_STATES * 2);
+    d->start[0] = d->start[1] = -1;
+    d->skipentry = -1;
+    d->flushes++;
+}
+
+void dfaInit(struct redfa *d, struct regex *re, struct reprog *prog,
+        int unanchored) {                                                // {{{2
+    memset(d, 0, sizeof(*d));
+    d->re = re;
+    d->prog = prog;
+    d->unanchored = unanchored;
+    d->hash = kcalloc(KILO_REGEX_STATES * 2, sizeof(int));
+    d->list = kmalloc(sizeof(int) * prog->numinst);
+    d->stack = kmalloc(sizeof(int) * (2 * prog->numinst + 2));
+    d->mark = kcalloc(prog->numinst, sizeof(unsigned));
+    if (!d->hash || !d->list || !d->stack || !d->mark) die("malloc");
+    d->start[0] = d->start[1] = -1;
+    d->skipentry = -1;
+    d->skipflushes = -1;
+}
+
+void dfaClosure(struct redfa *d, int pc, int bol, int *n) {              // {{{2
+    /* add instruction _pc_ and all instructions reached from it without
+     * consuming a byte to the state being built, _bol_ is non-zero at the
+     * start of a line (in the direction of the scan)
+     * only instructions that consume a byte, wait for the line end or
+     * match are kept, the others are followed */
+    struct reinst *inst = d->prog->inst;
+    int sp = 0;
+    d->stack[sp++] = pc;
+    while (sp > 0) {
+        pc = d->stack[--sp];
+        if (d->mark[pc] == d->gen) continue;
+        d->mark[pc] = d->gen;
+        switch (inst[pc].op) {
+            case RE_SPLIT:
+                d->stack[sp++] = inst[pc].y;
+                d->stack[sp++] = inst[pc].x;
+                break;
+            case RE_JMP:
+                d->stack[sp++] = inst[pc].x;
+                break;
+            case RE_BEGIN:
+                if (bol) d->stack[sp++] = pc + 1;
+                break;
+            default:
+                d->list[(*n)++] = pc;
+                break;
+        }
+    }
+}
+
+void dfaNewGen(struct redfa *d) {                                        // {{{2
+    /* forget the instructions marked while building the last state */
+    if (++d->gen == 0) {
+        memset(d->mark, 0, sizeof(unsigned) * d->prog->numinst);
+        d->gen = 1;
+    }
+}
+
+int dfaCompareInt(const void *a, const void *b) {                        // {{{2
+    int x = *(const int *)a, y = *(const int *)b;
+    return x < y ? -1 : x > y;
+}
+
+int dfaAdd(struct redfa *d, int n, int flags, int bol) {                 // {{{2
+    /* the state of the _n_ instructions in d->list and _flags_, it is
+     * created unless it exists already - when the cache is full all states
+     * are dropped first, _bol_ is non-zero if the state is at the start of
+     * a line */
+    struct reinst *inst = d->prog->inst;
+    int j;
+    qsort(d->list, n, sizeof(int), dfaCompareInt);
+    int ends = 0;
+    for (j = 0; j < n; j++) {
+        if (inst[d->list[j]].op == RE_MATCH) flags |= DFA_MATCH;
+        if (inst[d->list[j]].op == RE_END) ends = 1;
+    }
+    if (n == 0) flags |= DFA_DEAD;
+    if (ends) {
+        /* follow the line end assertions to see whether a match is
+         * complete if the line ends here, the list is copied past its end
+         * so that the closure does not disturb it */
+        int m = 0;
+        int save[n];
+        memcpy(save, d->list, sizeof(int) * n);
+        dfaNewGen(d);
+        for (j = 0; j < n; j++)
+            if (inst[save[j]].op == RE_END)
+                dfaClosure(d, save[j] + 1, bol, &m);
+        for (j = 0; j < m; j++) {
+            int pc = d->list[j];
+            if (inst[pc].op == RE_MATCH) flags |= DFA_EOLMATCH;
+            /* an end assertion right after another one holds too */
+            if (inst[pc].op == RE_END) dfaClosure(d, pc + 1, bol, &m);
+        }
+        memcpy(d->list, save, sizeof(int) * n);
+    }
+
+    uint32_t h = 2166136261u ^ flags;
+    for (j = 0; j < n; j++) h = (h ^ d->list[j]) * 16777619u;
+    uint32_t mask = KILO_REGEX_STATES * 2 - 1;
+    uint32_t slot;
+    for (slot = h & mask; d->hash[slot]; slot = (slot + 1) & mask) {
+        int s = d->hash[slot] - 1;
+        if (d->flags[s] == flags && d->setlen[s] == n &&
+                memcmp(d->pool + d->setoff[s], d->list, sizeof(int) * n) == 0)
+            return s;
+    }
+
+    if (d->numstates == KILO_REGEX_STATES) {
+        dfaFlush(d);
+        slot = h & mask;
+    }
+    if (d->numstates == d->capstates) {
+        d->capstates = d->capstates ? d->capstates * 2 : 16;
+        d->trans = krealloc(d->trans,
+                sizeof(int) * d->capstates * d->re->numclasses);
+        d->flags = krealloc(d->flags, d->capstates);
+        d->setoff = krealloc(d->setoff, sizeof(int) * d->capstates);
+        d->setlen = krealloc(d->setlen, sizeof(int) * d->capstates);
+        if (!d->trans || !d->flags || !d->setoff || !d->setlen)
+            die("realloc");
+    }
+    if (d->poollen + n > d->poolcap) {
+        while (d->poollen + n > d->poolcap)
+            d->poolcap = d->poolcap ? d->poolcap * 2 : 256;
+        d->pool = krealloc(d->pool, sizeof(int) * d->poolcap);
+        if (d->pool == NULL) die("realloc");
+    }
+    int s = d->numstates++;
+    d->flags[s] = flags;
+    d->setoff[s] = d->poollen;
+    d->setlen[s] = n;
+    if (n) memcpy(d->pool + d->poollen, d->list, sizeof(int) * n);
+    d->poollen += n;
+    for (j = 0; j < d->re->numclasses; j++)
+        d->trans[s * d->re->numclasses + j] = -1;
+    d->hash[slot] = s + 1;
+    return s;
+}
+
+int dfaEntry(struct redfa *d, int s) {                                  // {{{2
+    /* transition table entry leading to state _s_ - the offset of the row
+     * of the state, shifted left by one, the low bit is set if the state
+     * has any flags, so that the scan loops look at nothing but the entry
+     * in the common case */
+    return (s * d->re->numclasses) << 1 | (d->flags[s] != 0);
+}
+
+int dfaStart(struct redfa *d, int bol) {                                 // {{{2
+    /* entry of the state the scan starts in, at the start of a line or
+     * elsewhere */
+    if (d->start[bol] < 0) {
+        int n = 0;
+        dfaNewGen(d);
+        dfaClosure(d, 0, bol, &n);
+        int s = dfaAdd(d, n, 0, bol);
+        d->start[bol] = s;
+    }
+    return dfaEntry(d, d->start[bol]);
+}
+
+int dfaCompute(struct redfa *d, int t, int c) {                          // {{{2
+    /* build the transition on byte _c_ of the state of entry _t_ and
+     * return its entry - the threads that can consume the byte move on, a
+     * newline ends the line: a match may be complete at its end and an
+     * unanchored scan starts over */
+    struct reinst *inst = d->prog->inst;
+    int st = (t >> 1) / d->re->numclasses;
+    int n = 0, flags = 0;
+    int j;
+    dfaNewGen(d);
+    if (c == '\n') {
+        if (d->flags[st] & DFA_EOLMATCH) flags = DFA_MATCHPREV;
+        if (d->unanchored) dfaClosure(d, 0, 1, &n);
+    } else {
+        /* a carriage return may end the line too (the scan only uses this
+         * to find the line, the line itself is matched without it) */
+        if (c == '\r' && (d->flags[st] & DFA_EOLMATCH)) flags = DFA_MATCHPREV;
+        int *set = d->pool + d->setoff[st];
+        for (j = 0; j < d->setlen[st]; j++) {
+            int pc = set[j];
+            if (inst[pc].op == RE_BYTE && reSetHas(d->re->set[inst[pc].x], c))
+                dfaClosure(d, pc + 1, 0, &n);
+        }
+        if (d->unanchored) dfaClosure(d, 0, 0, &n);
+    }
+    int flushes = d->flushes;
+    int next = dfaEntry(d, dfaAdd(d, n, flags, c == '\n'));
+    /* st is gone if the cache was flushed */
+    if (d->flushes == flushes)
+        d->trans[st * d->re->numclasses + d->re->classof[c]] = next;
+    return next;
+}
+
+int dfaFlags(struct redfa *d, int t) {                                   // {{{2
+    /* flags of the state of entry _t_ */
+    return t & 1 ? d->flags[(t >> 1) / d->re->numclasses] : 0;
+}
+
+void dfaBuildSkip(struct redfa *d) {                                     // {{{2
+    /* find the bytes that lead from the start state back to it - most of
+     * them for a pattern that starts with something specific */
+    int flushes = d->flushes;
+    d->skipflushes = flushes;
+    d->skipentry = -1;
+    int t = dfaStart(d, 0);
+    if (t & 1) return;
+    int c;
+    for (c = 0; c < 256; c++) {
+        int next = d->trans[(t >> 1) + d->re->classof[c]];
+        if (next < 0) next = dfaCompute(d, t, c);
+        if (d->flushes != flushes) return;
+        d->skip[c] = next == t;
+    }
+    d->skipentry = t;
+}
+
+int regexScan(struct redfa *d, const char *s, const char *p,
+        const char *end, const char **e) {                               // {{{2
+    /* run the unanchored forward DFA over p[0..end) until some match is
+     * complete, sets _e_ to the position it ends at (within the line that
+     * has the match) and returns 1, returns 0 if there is no match
+     * _s_ is where the buffer starts, a line starts at p if p == s or after
+     * a newline, _end_ is a line end */
+    if (d->skipflushes != d->flushes) dfaBuildSkip(d);
+    int t = dfaStart(d, p == s || p[-1] == '\n');
+    if (dfaFlags(d, t) & DFA_MATCH) {
+        *e = p;
+        return 1;
+    }
+    const int *trans = d->trans;
+    const unsigned char *classof = d->re->classof;
+    int skipentry = d->skipentry;
+    for (; p < end; p++) {
+        if (t == skipentry) {
+            /* no dependency from byte to byte, much quicker than walking
+             * the transitions */
+            while (p < end && d->skip[(unsigned char)*p]) p++;
+            if (p == end) break;
+        }
+        unsigned char c = *p;
+        int next = trans[(t >> 1) + classof[c]];
+        if (next < 0) {
+            next = dfaCompute(d, t, c);
+            trans = d->trans;
+            skipentry = d->skipentry;
+        }
+        t = next;
+        if (t & 1) {
+            int flags = dfaFlags(d, t);
+            if (flags & (DFA_MATCH | DFA_MATCHPREV)) {
+                *e = flags & DFA_MATCHPREV ? p : p + 1;
+                return 1;
+            }
+        }
+    }
+    if (dfaFlags(d, t) & DFA_EOLMATCH) {
+        *e = end;
+        return 1;
+    }
+    return 0;
+}
+
+const char *regexLeftmost(struct redfa *d, const char *s, const char *ls,
+        const char *le) {                                                // {{{2
+    /* run the unanchored reverse DFA from the line end _le_ back to _ls_,
+     * every position it is in a match state at is where a match starts,
+     * returns the leftmost one or NULL */
+    const char *best = NULL;
+    int t = dfaStart(d, 1);
+    int flags = dfaFlags(d, t);
+    if ((flags & DFA_MATCH) ||
+            ((flags & DFA_EOLMATCH) && (le == s || le[-1] == '\n')))
+        best = le;
+    const unsigned char *classof = d->re->classof;
+    const char *p = le;
+    while (p > ls) {
+        unsigned char c = *--p;
+        int next = d->trans[(t >> 1) + classof[c]];
+        if (next < 0) next = dfaCompute(d, t, c);
+        t = next;
+        if (t & 1) {
+            flags = dfaFlags(d, t);
+            if ((flags & DFA_MATCH) || ((flags & DFA_EOLMATCH) &&
+                        (p == s || p[-1] == '\n')))
+                best = p;
+        }
+    }
+    return best;
+}
+
+int regexLongest(struct redfa *d, const char *s, const char *p,
+        const char *le) {                                                // {{{2
+    /* run the anchored forward DFA from _p_ towards the line end _le_,
+     * returns the length of the longest match starting at p or -1 */
+    int t = dfaStart(d, p == s || p[-1] == '\n');
+    const char *start = p;
+    int best = dfaFlags(d, t) & DFA_MATCH ? 0 : -1;
+    const unsigned char *classof = d->re->classof;
+    for (; p < le; p++) {
+        unsigned char c = *p;
+        int next = d->trans[(t >> 1) + classof[c]];
+        if (next < 0) next = dfaCompute(d, t, c);
+        t = next;
+        if (t & 1) {
+            int flags = dfaFlags(d, t);
+            if (flags & DFA_DEAD) return best;
+            if (flags & DFA_MATCH) best = p + 1 - start;
+        }
+    }
+    if (dfaFlags(d, t) & DFA_EOLMATCH) best = le - start;
+    return best;
+}
+
+struct rematcher *regexMatcher(struct regex *re, int slot) {             // {{{2
+    /* the automata of thread _slot_ (0 is the main thread), built on first
+     * use and kept with the compiled regex */
+    if (re->matcher[slot] == NULL) {
+        struct rematcher *m = kmalloc(sizeof(struct rematcher));
+        if (m == NULL) die("malloc");
+        m->re = re;
+        dfaInit(&m->fwd, re, &re->fwd, 1);
+        dfaInit(&m->rev, re, &re->rev, 1);
+        dfaInit(&m->anch, re, &re->fwd, 0);
+        re->matcher[slot] = m;
+    }
+    return re->matcher[slot];
+}
+
+const char *regexFind(struct rematcher *m, const char *s, const char *from,
+        const char *end, int *mlen) {                                    // {{{2
+    /* leftmost longest match starting at _from_ or after it, s[0..end) are
+     * whole lines (or the rest of one), returns NULL if there is none
+     * the forward DFA finds the line with the first match, the reverse DFA
+     * where in it the leftmost match starts and the anchored DFA how long
+     * it is, every byte is looked at a bounded number of times
+     * with a literal prefix the lines without it are skipped with the
+     * substring kernel */
+    struct regex *re = m->re;
+    const char *p = from;
+    /* past the newline at the end of the buffer is no line */
+    while (p < end || (p == end && (p == s || p[-1] != '\n'))) {
+        const char *e, *ls, *le, *nl;
+        if (re->prefixlen) {
+            const char *c = scanFindString(p, end - p, re->prefix,
+                    re->prefixlen);
+            if (c == NULL) return NULL;
+            nl = c > p ? memrchr(p, '\n', c - p) : NULL;
+            ls = nl ? nl + 1 : p;
+            nl = scanFindByte(c, end - c, '\n');
+            le = nl ? nl : end;
+            while (le > s && le[-1] == '\r') le--;
+            if (le < ls || !regexScan(&m->fwd, s, ls, le, &e)) {
+                p = nl ? nl + 1 : end + 1;
+                continue;
+            }
+        } else {
+            if (!regexScan(&m->fwd, s, p, end, &e)) return NULL;
+            nl = e > p ? memrchr(p, '\n', e - p) : NULL;
+            ls = nl ? nl + 1 : p;
+            nl = scanFindByte(e, end - e, '\n');
+            le = nl ? nl : end;
+        }
+        /* the line ends before the carriage returns, like its row, p may
+         * have been past that */
+        while (le > s && le[-1] == '\r') le--;
+        const char *start = le < ls ? NULL :
+            regexLeftmost(&m->rev, s, ls, le);
+        if (start) {
+            *mlen = regexLongest(&m->anch, s, start, le);
+            return start;
+        }
+        p = nl ? nl + 1 : end + 1;
+    }
+    return NULL;
+}
+
+// find ------------------------------------------------------------------- {{{1
+
+int editorBlockLineOf(int b, size_t off) {                               // {{{2
+    /* line of the unmodified block _b_ that byte _off_ (from base) is in,
+     * binary search in the line table */
+    struct rowblock *blk = &E.buf->block[b];
+    editorBlockTable(b);
+    int lo = 0, hi = blk->numrows - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (blk->lineoff[mid] <= off) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+size_t editorBlockOffset(int b, int line, int col) {                     // {{{2
+    /* byte offset (from base) of column _col_ of _line_ in the unmodified
+     * block _b_, a column past the end is the end of the line, line ==
+     * numrows is the end of the block */
+    struct rowblock *blk = &E.buf->block[b];
+    if (line >= blk->numrows) return blk->end - blk->base;
+    editorBlockTable(b);
+    return blk->lineoff[line] + (col < blk->linesize[line] ? col :
+                                                           blk->linesize[line]);
+}
+
+struct regex *editorRegexGet(const char *pattern, const char **error) {  // {{{2
+    /* the compiled regex for _pattern_ from the cache of recently used
+     * ones, compiled now if it is not there - returns NULL and sets _error_
+     * if the pattern is invalid */
+    int j;
+    for (j = 0; j < KILO_REGEX_CACHE; j++) {
+        if (E.regex[j] && strcmp(E.regex[j]->pattern, pattern) == 0) {
+            E.regex[j]->lastuse = ++E.regexuse;
+            return E.regex[j];
+        }
+    }
+    struct regex *re = regexCompile(pattern, error);
+    if (re == NULL) return NULL;
+
+    /* replace a free slot or the least recently used regex, but not the
+     * one the search threads are running */
+    int slot = -1;
+    for (j = 0; j < KILO_REGEX_CACHE; j++) {
+        if (E.regex[j] == NULL) {
+            slot = j;
+            break;
+        }
+        if (E.findall.active && E.regex[j] == E.findall.q.re) continue;
+        if (slot < 0 || E.regex[j]->lastuse < E.regex[slot]->lastuse)
+            slot = j;
+    }
+    if (E.regex[slot]) regexFree(E.regex[slot]);
+    E.regex[slot] = re;
+    re->lastuse = ++E.regexuse;
+    return re;
+}
+
+const char *editorMatch(struct searchQuery *q, const char *s,
+        const char *from, const char *end, int *mlen) {                  // {{{2
+    /* first match of _q_ starting at _from_ or after it, s[0..end) are
+     * whole lines (or the rest of one) with _from_ in them, sets _mlen_ to
+     * the length of the match, returns NULL if there is none */
+    if (q->re) return regexFind(q->m, s, from, end, mlen);
+    *mlen = q->len;
+    return scanFindString(from, end - from, q->str, q->len);
+}
+
+int editorMatchStep(struct searchQuery *q, int mlen) {                   // {{{2
+    /* distance from a match to where the next one may start - occurrences
+     * of a plain string may overlap, regex matches do not */
+    if (q->re == NULL) return 1;
+    return mlen > 0 ? mlen : 1;
+}
+
+int editorFindForward(struct searchQuery *q, int at, int col, int limit,
+        int *mrow, int *mcol, int *mlen) {                               // {{{2
+    /* find the first match of _q_ at row _at_, column _col_ or after it,
+     * in the rows before _limit_, returns -1 if there is none
+     * an unmodified block is searched as one piece of the mapping with the
+     * vector kernel (or the regex automata), so a miss streams through the
+     * file at nearly memory speed, the rows of other blocks are searched
+     * one by one
+     * matches never span two lines */
+    if (at >= limit || at >= E.buf->numrows) return -1;
+    int start;
+    int b = editorFindBlock(at, &start);
+    int j0 = at - start;
+    int c0 = col;
+    for (; b < E.buf->numblocks && start < limit;
+            start += E.buf->block[b].numrows, b++) {
+        struct rowblock *blk = &E.buf->block[b];
+        if (blk->base && !blk->modified) {
+            size_t from = j0 || c0 ? editorBlockOffset(b, j0, c0) : 0;
+            editorGzPin(E.buf->gz, blk->base, blk->end);
+            const char *m = editorMatch(q, blk->base, blk->base + from,
+                    blk->end, mlen);
+            editorGzUnpin(E.buf->gz, blk->base, blk->end);
+            if (m) {
+                int line = editorBlockLineOf(b, m - blk->base);
+                if (start + line >= limit) return -1;
+                *mrow = start + line;
+                *mcol = m - blk->base - blk->lineoff[line];
+                return 0;
+            }
+        } else {
+            erow *rows = editorBlockRows(b);
+            int j;
+            for (j = j0; j < blk->numrows && start + j < limit; j++) {
+                erow *row = &rows[j];
+                int c = j == j0 ? c0 : 0;
+                if (c > row->size) continue;
+                const char *m = editorMatch(q, row->chars, row->chars + c,
+                        row->chars + row->size, mlen);
+                if (m) {
+                    *mrow = start + j;
+                    *mcol = m - row->chars;
+                    return 0;
+                }
+            }
+        }
+        /* the following blocks are searched from their start */
+        j0 = 0;
+        c0 = 0;
+    }
+    return -1;
+}
+
+const char *editorFindLast(struct searchQuery *q, const char *s, size_t n,
+        size_t before, int *mlen) {                                      // {{{2
+    /* last match of _q_ in the lines s[0..n) that starts before _before_,
+     * a plain string needs no more than the bytes up to there */
+    const char *end = s + n;
+    if (q->re == NULL && before + q->len - 1 < n) end = s + before + q->len - 1;
+    const char *p = s;
+    const char *hit = NULL;
+    const char *m;
+    int len;
+    while (p <= end && (m = editorMatch(q, s, p, end, &len)) != NULL &&
+            m < s + before) {
+        hit = m;
+        *mlen = len;
+        p = m + editorMatchStep(q, len);
+    }
+    return hit;
+}
+
+int editorFindBackward(struct searchQuery *q, int at, int col, int limit,
+        int *mrow, int *mcol, int *mlen) {                               // {{{2
+    /* find the last match of _q_ that starts before row _at_, column
+     * _col_ (at == numrows searches from the end of the file), in rows
+     * _limit_ and after, returns -1 if there is none */
+    if (E.buf->numblocks == 0 || at < limit) return -1;
+    int start, b, j0, c0;
+    if (at >= E.buf->numrows) {
+        b = E.buf->numblocks - 1;
+        start = E.buf->numrows - E.buf->block[b].numrows;
+        j0 = E.buf->block[b].numrows;
+        c0 = 0;
+    } else {
+        b = editorFindBlock(at, &start);
+        j0 = at - start;
+        c0 = col;
+    }
+    while (b >= 0 && start + E.buf->block[b].numrows > limit) {
+        struct rowblock *blk = &E.buf->block[b];
+        if (blk->base && !blk->modified) {
+            size_t before = editorBlockOffset(b, j0, c0);
+            editorGzPin(E.buf->gz, blk->base, blk->end);
+            const char *m = editorFindLast(q, blk->base, blk->end - blk->base,
+                    before, mlen);
+            editorGzUnpin(E.buf->gz, blk->base, blk->end);
+            if (m) {
+                int line = editorBlockLineOf(b, m - blk->base);
+                if (start + line < limit) return -1;
+                *mrow = start + line;
+                *mcol = m - blk->base - blk->lineoff[line];
+                return 0;
+            }
+        } else {
+            erow *rows = editorBlockRows(b);
+            int j = j0 < blk->numrows ? j0 : blk->numrows - 1;
+            for (; j >= 0 && start + j >= limit; j--) {
+                erow *row = &rows[j];
+                int before = j == j0 ? c0 : row->size + 1;
+                const char *m = editorFindLast(q, row->chars, row->size,
+                        before, mlen);
+                if (m) {
+                    *mrow = start + j;
+                    *mcol = m - row->chars;
+                    return 0;
+                }
+            }
+        }
+        /* the preceding blocks are searched up to their end */
+        b--;
+        if (b >= 0) {
+            start -= E.buf->block[b].numrows;
+            j0 = E.buf->block[b].numrows;
+            c0 = 0;
+        }
+    }
+    return -1;
+}
+
+size_t editorBlockBytes(int b) {                                         // {{{2
+    /* bytes of text in block _b_, the weight of the block when the rows are
+     * split into search tasks */
+    struct rowblock *blk = &E.buf->block[b];
+    if (blk->base && !blk->modified) return blk->end - blk->base;
+    size_t bytes = 0;
+    int j;
+    for (j = 0; j < blk->numrows; j++) bytes += blk->row[j].size + 1;
+    return bytes;
+}
+
+void editorFindAllAdd(struct findtask *t, int row, int col) {            // {{{2
+    /* record a match found by task _t_, the storage grows by doubling and
+     * each growth is taken from the budget shared by all tasks */
+    struct editorFindAll *f = &E.findall;
+    t->count++;
+    if (t->full) return;
+    if (t->nummatches == t->cap) {
+        int cap = t->cap ? t->cap * 2 : 64;
+        pthread_mutex_lock(&f->lock);
+        int ok = !f->truncated && f->budget >= cap - t->cap;
+        if (ok) f->budget -= cap - t->cap;
+        else f->truncated = 1;
+        pthread_mutex_unlock(&f->lock);
+        struct editorMatch *match = ok ?
+            krealloc(t->match, sizeof(struct editorMatch) * cap) : NULL;
+        if (match == NULL) {
+            t->full = 1;
+            pthread_mutex_lock(&f->lock);
+            f->truncated = 1;
+            pthread_mutex_unlock(&f->lock);
+            return;
+        }
+        t->match = match;
+        t->cap = cap;
+    }
+    t->match[t->nummatches].row = row;
+    t->match[t->nummatches].col = col;
+    t->nummatches++;
+}
+
+void editorFindAllTask(struct findtask *t, struct searchQuery *q) {      // {{{2
+    /* find every match of _q_ in the blocks of task _t_ -
+     * unmodified blocks are searched in the mapping, the lines are counted
+     * between two matches with the newline kernel, other blocks row by row
+     * runs on a search thread, the main thread does not change the rows of
+     * the searched buffer while the search is active */
+    int start = t->row0;
+    int len;
+    int b;
+    struct rowblock *block = E.findall.buf->block;
+    struct editorGzip *gz = E.findall.buf->gz;
+    for (b = t->b0; b < t->b1; start += block[b].numrows, b++) {
+        struct rowblock *blk = &block[b];
+        if (blk->base && !blk->modified) {
+            editorGzPin(gz, blk->base, blk->end);
+            const char *p = blk->base;
+            const char *end = blk->end;
+            /* line start and row of the last match */
+            const char *line = p;
+            const char *counted = p;
+            int row = start;
+            const char *m;
+            while (p <= end && (m = editorMatch(q, blk->base, p, end, &len))) {
+                size_t nl = scanCountByte(counted, m - counted, '\n');
+                if (nl) {
+                    row += nl;
+                    line = (const char *)memrchr(counted, '\n',
+                            m - counted) + 1;
+                }
+                counted = m;
+                editorFindAllAdd(t, row, m - line);
+                p = m + editorMatchStep(q, len);
+            }
+            editorGzUnpin(gz, blk->base, blk->end);
+        } else {
+            int j;
+            for (j = 0; j < blk->numrows; j++) {
+                erow *row = &blk->row[j];
+                const char *p = row->chars;
+                const char *end = row->chars + row->size;
+                const char *m;
+                while (p <= end &&
+                        (m = editorMatch(q, row->chars, p, end, &len))) {
+                    editorFindAllAdd(t, start + j, m - row->chars);
+                    p = m + editorMatchStep(q, len);
+                }
+            }
+        }
+    }
+}
+
+void *editorFindAllWorker(void *arg) {                                   // {{{2
+    /* search thread - take the next task until none are left, a regex is
+     * matched with automata of the thread's own */
+    struct editorFindAll *f = arg;
+    struct searchQuery q = f->q;
+    pthread_mutex_lock(&f->lock);
+    int slot = ++f->nextslot;
+    pthread_mutex_unlock(&f->lock);
+    if (q.re) q.m = regexMatcher(q.re, slot);
+    while (1) {
+        pthread_mutex_lock(&f->lock);
+        struct findtask *t = NULL;
+        if (!f->cancel && f->next < f->numtasks) t = &f->task[f->next++];
+        pthread_mutex_unlock(&f->lock);
+        if (t == NULL) break;
+
+        editorFindAllTask(t, &q);
+
+        pthread_mutex_lock(&f->lock);
+        f->done++;
+        pthread_mutex_unlock(&f->lock);
+        /* wake up the event loop */
+        write(f->notify[1], "t", 1);
+    }
+    return NULL;
+}
+
+void editorFindAllFinish() {                                             // {{{2
+    /* join the search threads and concatenate the matches of the tasks
+     * into the match index, the tasks cover the rows in order so the index
+     * is sorted without a merge pass */
+    struct editorFindAll *f = &E.findall;
+    int j;
+    for (j = 0; j < f->numthreads; j++) pthread_join(f->thread[j], NULL);
+    editorUnwatchFd(f->notify[0]);
+    close(f->notify[0]);
+    close(f->notify[1]);
+    pthread_mutex_destroy(&f->lock);
+    f->active = 0;
+
+    if (!f->cancel) {
+        f->count = 0;
+        f->nummatches = 0;
+        for (j = 0; j < f->numtasks; j++) {
+            f->count += f->task[j].count;
+            f->nummatches += f->task[j].nummatches;
+        }
+        f->match = f->truncated ? NULL :
+            kmalloc(sizeof(struct editorMatch) * (f->nummatches + 1));
+        if (f->match) {
+            struct editorMatch *m = f->match;
+            for (j = 0; j < f->numtasks; j++) {
+                if (f->task[j].nummatches == 0) continue;
+                memcpy(m, f->task[j].match,
+                        sizeof(struct editorMatch) * f->task[j].nummatches);
+                m += f->task[j].nummatches;
+            }
+        } else {
+            f->nummatches = 0;
+        }
+        f->ready = 1;
+    }
+    for (j = 0; j < f->numtasks; j++) free(f->task[j].match);
+    free(f->task);
+    f->task = NULL;
+    f->numtasks = 0;
+
+    /* data appended to a followed file meanwhile */
+    if (f->buf->follow.fd != -1) {
+        struct editorView *prev = editorEnterBuffer(f->buf);
+        editorFollowRead();
+        editorSwitchView(prev);
+    }
+}
+
+void editorFindAllStop() {                                               // {{{2
+    /* cancel the whole-file search and drop its result */
+    struct editorFindAll *f = &E.findall;
+    if (f->active) {
+        pthread_mutex_lock(&f->lock);
+        f->cancel = 1;
+        pthread_mutex_unlock(&f->lock);
+        editorFindAllFinish();
+    }
+    free(f->query);
+    f->query = NULL;
+    f->q.re = NULL;
+    free(f->match);
+    f->match = NULL;
+    f->nummatches = 0;
+    f->count = 0;
+    f->ready = 0;
+}
+
+void editorFindAllProgress(int fd) {                                     // {{{2
+    /* event loop callback for the search pipe - show the progress and the
+     * count once all tasks are done */
+    char buf[256];
+    while (read(fd, buf, sizeof(buf)) > 0);
+
+    struct editorFindAll *f = &E.findall;
+    pthread_mutex_lock(&f->lock);
+    int done = f->done == f->numtasks;
+    pthread_mutex_unlock(&f->lock);
+    if (done) editorFindAllFinish();
+    editorFindUpdatePrompt();
+    E.redraw = 1;
+}
+
+void editorFindAllWait() {                                               // {{{2
+    /* block until the whole-file search is done */
+    struct editorFindAll *f = &E.findall;
+    while (f->active) {
+        struct pollfd pfd = {f->notify[0], POLLIN, 0};
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR) die("poll");
+        char buf[256];
+        while (read(f->notify[0], buf, sizeof(buf)) > 0);
+        pthread_mutex_lock(&f->lock);
+        int done = f->done == f->numtasks;
+        pthread_mutex_unlock(&f->lock);
+        if (done) editorFindAllFinish();
+    }
+}
+
+void editorFindAllStart(struct searchQuery *q) {                         // {{{2
+    /* count all matches of _q_ in the background - the rows are
+     * split into tasks of about KILO_FIND_TASK bytes at block boundaries and
+     * searched on up to one thread per core, the result is picked up
+     * through the event loop */
+    struct editorFindAll *f = &E.findall;
+    editorFindAllStop();
+    memset(f, 0, sizeof(*f));
+    f->query = strdup(q->str);
+    if (f->query == NULL) die("strdup");
+    f->q = *q;
+    f->q.str = f->query;
+    f->q.m = NULL;
+    f->budget = KILO_FIND_MAX_MATCHES;
+    f->buf = E.buf;
+    f->partial = E.buf->load.active;
+
+    size_t total = 0;
+    int b;
+    for (b = 0; b < E.buf->numblocks; b++) total += editorBlockBytes(b);
+    int n = total / KILO_FIND_TASK + 1;
+    if (n > E.buf->numblocks) n = E.buf->numblocks;
+    if (n < 1) n = 1;
+    f->task = kcalloc(n, sizeof(struct findtask));
+    if (f->task == NULL) die("calloc");
+
+    /* a task ends with the block that reaches its share of the bytes */
+    size_t bytes = 0;
+    int row = 0;
+    int k = 0;
+    for (b = 0; b < E.buf->numblocks; b++) {
+        bytes += editorBlockBytes(b);
+        row += E.buf->block[b].numrows;
+        if (k < n - 1 && bytes >= total / n * (k + 1)) {
+            f->task[k].b1 = b + 1;
+            k++;
+            f->task[k].b0 = b + 1;
+            f->task[k].row0 = row;
+        }
+    }
+    f->task[k].b1 = E.buf->numblocks;
+    f->numtasks = k + 1;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = f->numtasks;
+    if (threads > cpus) threads = cpus;
+    if (threads > KILO_FIND_THREADS) threads = KILO_FIND_THREADS;
+    if (threads < 1) threads = 1;
+
+    pthread_mutex_init(&f->lock, NULL);
+    if (pipe(f->notify) == -1) die("pipe");
+    fcntl(f->notify[0], F_SETFL, O_NONBLOCK);
+    fcntl(f->notify[1], F_SETFL, O_NONBLOCK);
+    f->active = 1;
+    for (f->numthreads = 0; f->numthreads < threads; f->numthreads++) {
+        if (pthread_create(&f->thread[f->numthreads], NULL,
+                    editorFindAllWorker, f) != 0) die("pthread_create");
+    }
+    editorWatchFd(f->notify[0], editorFindAllProgress);
+}
+
+int editorFindAllLocate(int row, int col) {                              // {{{2
+    /* index of the first indexed match at row _row_, column _col_ or after
+     * it, binary search in the match index */
+    struct editorFindAll *f = &E.findall;
+    int lo = 0, hi = f->nummatches;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        struct editorMatch *m = &f->match[mid];
+        if (m->row < row || (m->row == row && m->col < col)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void editorFindUpdatePrompt() {                                          // {{{2
+    /* put the mode, the match count and the keys into the search prompt and
+     * show it */
+    struct editorSearch *s = &E.search;
+    struct editorFindAll *f = &E.findall;
+    char info[40] = "";
+    if (s->error) {
+        snprintf(info, sizeof(info), "[%s] ", s->error);
+    } else if (s->pending) {
+        snprintf(info, sizeof(info), "[indexing] ");
+    } else if (!s->countall) {
+    } else if (f->active) {
+        pthread_mutex_lock(&f->lock);
+        int percent = f->done * 100 / f->numtasks;
+        pthread_mutex_unlock(&f->lock);
+        snprintf(info, sizeof(info), "[%d%%] ", percent);
+    } else if (!f->ready) {
+    } else if (f->count == 0) {
+        snprintf(info, sizeof(info), "[no matches] ");
+    } else if (f->match == NULL || s->matchrow < 0) {
+        snprintf(info, sizeof(info), "[%lld found] ", f->count);
+    } else {
+        snprintf(info, sizeof(info), "[%d/%d] ",
+                editorFindAllLocate(s->matchrow, s->matchcol) + 1,
+                f->nummatches);
+    }
+    snprintf(s->prompt, sizeof(s->prompt), "%s: %%s %s(ESC/Arrows/Enter%s)",
+            s->regex ? "Regex" : "Search", info,
+            s->countall ? ", ^R = regex" : ", ^A = count, ^R = regex");
+    editorSetStatusMessage(s->prompt, s->query ? s->query : "");
+}
+
+int editorSearchQuery(struct searchQuery *q, const char *query) {        // {{{2
+    /* set up _q_ to look for the prompt input _query_ on the main thread,
+     * returns -1 if it is not a valid regex */
+    struct editorSearch *s = &E.search;
+    q->str = query;
+    q->len = strlen(query);
+    q->re = NULL;
+    q->m = NULL;
+    s->error = NULL;
+    if (!s->regex || q->len == 0) return 0;
+    q->re = editorRegexGet(query, &s->error);
+    if (q->re == NULL) return -1;
+    q->m = regexMatcher(q->re, 0);
+    return 0;
+}
+
+void editorFindShow(int found, int row, int col, int len) {              // {{{2
+    /* move to the match found at _row_, _col_ or, if none was _found_, back
+     * to where the search started */
+    struct editorSearch *s = &E.search;
+    if (!found) {
+        /* no match - back to where the search started */
+        s->matchrow = -1;
+        E.cx = s->cx;
+        E.cy = s->cy;
+        E.rowoff = s->rowoff;
+        E.rowsub = s->rowsub;
+        E.coloff = s->coloff;
+        return;
+    }
+    s->matchrow = row;
+    s->matchcol = col;
+    s->matchlen = len;
+    s->wrapped = row < s->cy || (row == s->cy && col < s->cx);
+    E.cy = row;
+    E.cx = col;
+    editorCenterCursor();
+}
+
+void editorFindStep(char *query, int key) {                              // {{{2
+    /* search as you type from the cursor position, arrows move to the next
+     * (right/down) or previous (left/up) match
+     * when a plain query was only extended the previous result is reused:
+     * no match for the shorter query means none for this one either, and a
+     * match of the longer query cannot come before the previous match
+     * once the matches are counted, arrows step through the match index */
+    struct editorSearch *s = &E.search;
+    struct editorFindAll *f = &E.findall;
+    struct searchQuery q;
+    int row = 0, col = 0, len = 0;
+    int found;
+    if (key == CTRL_KEY('r')) {
+        /* toggle regex mode, the query is searched for again */
+        s->regex = !s->regex;
+        free(s->query);
+        s->query = NULL;
+    }
+    int valid = editorSearchQuery(&q, query) == 0;
+    int qlen = q.len;
+
+    if (key == ARROW_RIGHT || key == ARROW_DOWN ||
+            key == ARROW_LEFT || key == ARROW_UP) {
+        int next = key == ARROW_RIGHT || key == ARROW_DOWN;
+        if (s->query == NULL || s->matchrow < 0 || !valid) return;
+        if (f->ready && f->match && f->nummatches > 0) {
+            int i;
+            if (next) {
+                i = editorFindAllLocate(s->matchrow, s->matchcol + 1);
+                if (i == f->nummatches) i = 0;
+            } else {
+                i = editorFindAllLocate(s->matchrow, s->matchcol) - 1;
+                if (i < 0) i = f->nummatches - 1;
+            }
+            row = f->match[i].row;
+            col = f->match[i].col;
+            len = 0;
+            /* the length is not indexed, the match is found again */
+            editorFindForward(&q, row, col, row + 1, &row, &col, &len);
+            found = 1;
+        } else if (next) {
+            found = editorFindForward(&q, s->matchrow,
+                    s->matchcol + editorMatchStep(&q, s->matchlen),
+                    E.buf->numrows, &row, &col, &len) == 0;
+            /* the next match may be in rows that are not indexed yet, the
+             * current one stays until they are */
+            if (!found && E.buf->load.active) return;
+            if (!found)
+                found = editorFindForward(&q, 0, 0, s->matchrow + 1,
+                        &row, &col, &len) == 0;
+        } else {
+            found = editorFindBackward(&q, s->matchrow, s->matchcol, 0,
+                    &row, &col, &len) == 0 ||
+                editorFindBackward(&q, E.buf->numrows, 0, s->matchrow,
+                    &row, &col, &len) == 0;
+        }
+    } else {
+        if (key == CTRL_KEY('a') && !s->countall) {
+            /* count the matches of this query and all following ones */
+            s->countall = 1;
+            if (s->query && valid) editorFindAllStart(&q);
+            return;
+        }
+        int prevlen = s->query ? (int)strlen(s->query) : 0;
+        /* a query that is still pending was not searched in all rows, so
+         * its result tells nothing about the extended one */
+        int extended = !s->regex && s->query && qlen > prevlen &&
+            strncmp(query, s->query, prevlen) == 0 && !s->pending;
+        /* a key that did not change the query */
+        if (s->query && strcmp(query, s->query) == 0) return;
+        s->pending = 0;
+        free(s->query);
+        s->query = qlen ? strdup(query) : NULL;
+        if (s->countall) {
+            if (qlen && valid) editorFindAllStart(&q);
+            else editorFindAllStop();
+        }
+
+        if (qlen == 0 || !valid) {
+            found = 0;
+        } else if (extended && s->matchrow < 0) {
+            found = 0;
+        } else {
+            int fromrow = extended ? s->matchrow : s->cy;
+            int fromcol = extended ? s->matchcol : s->cx;
+            found = editorFindForward(&q, fromrow, fromcol, E.buf->numrows,
+                    &row, &col, &len) == 0;
+            if (!found && E.buf->load.active) {
+                /* go on with the rows still to be indexed, see
+                 * editorFindResume() */
+                s->pending = 1;
+                s->searched = E.buf->numrows;
+                s->wraprow = s->cy + 1;
+            }
+            /* wrap around, nothing before a wrapped previous match */
+            if (!found && !s->pending && !(extended && s->wrapped))
+                found = editorFindForward(&q, 0, 0, s->cy + 1,
+                        &row, &col, &len) == 0;
+        }
+    }
+
+    editorFindShow(found, row, col, len);
+}
+
+void editorFindResume() {                                                // {{{2
+    /* a search of a file that is being indexed goes on with the rows that
+     * arrived since, called before every frame - a query that was still
+     * not found wraps around once all rows are there, and a match count
+     * of part of the file is started again */
+    struct editorSearch *s = &E.search;
+    struct editorFindAll *f = &E.findall;
+    if (s->countall && f->partial && f->buf == E.buf && !E.buf->load.active &&
+            s->query) {
+        struct searchQuery q;
+        if (editorSearchQuery(&q, s->query) == 0) editorFindAllStart(&q);
+        editorFindUpdatePrompt();
+    }
+    if (!s->pending) return;
+    if (E.buf->load.active && s->searched == E.buf->numrows) return;
+
+    struct searchQuery q;
+    int row = 0, col = 0, len = 0;
+    if (s->query == NULL || editorSearchQuery(&q, s->query) == -1) {
+        s->pending = 0;
+        return;
+    }
+    int found = editorFindForward(&q, s->searched, 0, E.buf->numrows,
+            &row, &col, &len) == 0;
+    s->searched = E.buf->numrows;
+    if (!found && E.buf->load.active) return;
+    s->pending = 0;
+    if (!found)
+        found = editorFindForward(&q, 0, 0, s->wraprow, &row, &col, &len) == 0;
+    editorFindShow(found, row, col, len);
+    editorFindUpdatePrompt();
+}
+
+void editorFindCallback(char *query, int key) {                          // {{{2
+    /* called by editorPrompt() after every key */
+    struct editorSearch *s = &E.search;
+    if (key == '\r' || key == '\x1b') {
+        s->pending = 0;
+        editorFindAllStop();
+        free(s->query);
+        s->query = NULL;
+        return;
+    }
+    editorFindStep(query, key);
+    editorFindUpdatePrompt();
+}
+
+void editorFind() {                                                      // {{{2
+    /* incremental search, escape restores the cursor and the view */
+    struct editorSearch *s = &E.search;
+    s->cx = E.cx;
+    s->cy = E.cy;
+    s->rowoff = E.rowoff;
+    s->rowsub = E.rowsub;
+    s->coloff = E.coloff;
+    s->query = NULL;
+    s->error = NULL;
+    s->matchrow = -1;
+    s->matchlen = 0;
+    s->wrapped = 0;
+    s->countall = 0;
+    s->pending = 0;
+    editorFindUpdatePrompt();
+
+    char *query = editorPrompt(s->prompt, editorFindCallback);
+    if (query) {
+        free(query);
+    } else {
+        E.cx = s->cx;
+        E.cy = s->cy;
+        E.rowoff = s->rowoff;
+        E.rowsub = s->rowsub;
+        E.coloff = s->coloff;
+    }
+}
+
+// append buffer ---------------------------------------------------------- {{{1
+
+/* struct for append buffer to print whole screen at once */
+struct abuf {                                                            // {{{2
+    char *b;
+    int len;
+    /* allocated size of b, always >= len */
+    int cap;
+};
+
+/* constructor for abuf type */
+#define ABUF_INIT {NULL, 0, 0}
+
+void abAppend(struct abuf *ab, const char *s, int len) {                 // {{{2
+    /* realloc() from <stdlib.h>
+     * first make sure to have enough memory - the capacity is doubled until
+     * the string fits, so a buffer that is reused reaches its steady state
+     * size after a few frames and is not reallocated any more
+     * realloc() either extends the current memory block or will take care of
+     * freeing the current memory block and allocating a new one */
+    if (ab->len + len > ab->cap) {
+        int cap = ab->cap ? ab->cap : 1024;
+        while (cap < ab->len + len) cap *= 2;
+        char *new = krealloc(ab->b, cap);
+
+        if (new == NULL) return;
+        ab->b = new;
+        ab->cap = cap;
+    }
+    /* copy string s to the end of the current string in the buffer */
+    memcpy(&ab->b[ab->len], s, len);
+    /* update abuf length */
+    ab->len += len;
+}
+
+void abReset(struct abuf *ab) {                                          // {{{2
+    /* empty the buffer but keep its memory for reuse */
+    ab->len = 0;
+}
+
+void abFree(struct abuf *ab) {                                           // {{{2
+    /* free() from <stdlib.h>
+     * destructor that deallocates the buffer dynamic memory */
+    free(ab->b);
+}
+
+/* one screen line before it is written out - its characters and runs of
+ * them drawn with the same attribute, the escape sequences are generated
+ * from the runs while the frame is put together, they depend on the
+ * attribute the line before left the terminal in */
+struct screenline {                                                      // {{{2
+    struct abuf text;
+    /* run j starts at offset runoff[j] of text and has attribute
+     * runattr[j] */
+    int *runoff;
+    int *runattr;
+    int numruns, runcap;
+};
+
+#define SL_INIT {ABUF_INIT, NULL, NULL, 0, 0}
+
+void slAppend(struct screenline *sl, const char *s, int len, int attr) { // {{{2
+    /* append _len_ characters drawn with attribute _attr_, they extend the
+     * last run if it has the same attribute */
+    if (len <= 0) return;
+    if (sl->numruns == 0 || sl->runattr[sl->numruns - 1] != attr) {
+        if (sl->numruns == sl->runcap) {
+            int cap = sl->runcap ? sl->runcap * 2 : 16;
+            int *off = krealloc(sl->runoff, sizeof(int) * cap);
+            if (off == NULL) die("realloc");
+            sl->runoff = off;
+            int *runattr = krealloc(sl->runattr, sizeof(int) * cap);
+            if (runattr == NULL) die("realloc");
+            sl->runattr = runattr;
+            sl->runcap = cap;
+        }
+        sl->runoff[sl->numruns] = sl->text.len;
+        sl->runattr[sl->numruns] = attr;
+        sl->numruns++;
+    }
+    abAppend(&sl->text, s, len);
+}
+
+void slReset(struct screenline *sl) {                                    // {{{2
+    /* empty the line but keep its memory for reuse */
+    abReset(&sl->text);
+    sl->numruns = 0;
+}
+
+/* everything written to the screen in headless mode */
+struct abuf headlessout = ABUF_INIT;
+
+void *editorTermWriter(void *arg) {                                      // {{{2
+    /* writer thread - sends the output handed over by editorOutput() to the
+     * terminal and tells the event loop through the pipe once it is gone,
+     * so that the writes block here while the editor goes on with keys */
+    struct editorTermOut *out = arg;
+    pthread_mutex_lock(&out->lock);
+    while (1) {
+        while (!out->busy && !out->stop)
+            pthread_cond_wait(&out->cond, &out->lock);
+        if (out->stop) break;
+        pthread_mutex_unlock(&out->lock);
+
+        int pos = 0;
+        while (pos < out->len) {
+            int n = write(out->fd, out->buf + pos, out->len - pos);
+            if (n == -1 && errno == EINTR) continue;
+            /* the terminal is gone, the output is dropped */
+            if (n <= 0) break;
+            pos += n;
+        }
+
+        pthread_mutex_lock(&out->lock);
+        out->busy = 0;
+        pthread_cond_broadcast(&out->cond);
+        write(out->notify[1], "o", 1);
+    }
+    out->stopped = 1;
+    pthread_cond_broadcast(&out->cond);
+    pthread_mutex_unlock(&out->lock);
+    return NULL;
+}
+
+void editorOutputDone(int fd) {                                          // {{{2
+    /* event loop callback for the writer pipe - a frame that was skipped
+     * while the terminal took the one before is drawn now, the pipe may be
+     * the one of a screen that is not active */
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0);
+    if (E.screen->out.running && E.screen->out.notify[0] == fd) {
+        if (E.framewait) {
+            E.framewait = 0;
+            E.redraw = 1;
+        }
+        return;
+    }
+    int j;
+    for (j = 0; j < E.numscreens; j++) {
+        struct editorScreen *s = E.screens[j];
+        if (s->out.notify[0] != fd || !s->framewait) continue;
+        s->framewait = 0;
+        s->redraw = 1;
+    }
+}
+
+void editorOutputStart(struct editorTermOut *out, int fd) {              // {{{2
+    /* start the writer thread of _out_, writing to _fd_ */
+    pthread_mutex_init(&out->lock, NULL);
+    pthread_cond_init(&out->cond, NULL);
+    out->fd = fd;
+    out->busy = 0;
+    out->stop = out->stopped = 0;
+    out->buf = NULL;
+    out->len = out->cap = 0;
+    if (pipe(out->notify) == -1) die("pipe");
+    fcntl(out->notify[0], F_SETFL, O_NONBLOCK);
+    fcntl(out->notify[1], F_SETFL, O_NONBLOCK);
+    /* the thread outlives the editor, exit() ends it after the last output
+     * was drained */
+    if (pthread_create(&out->thread, NULL, editorTermWriter, out) != 0)
+        die("pthread_create");
+    pthread_detach(out->thread);
+    out->running = 1;
+    editorWatchFd(out->notify[0], editorOutputDone);
+}
+
+void editorOutputStop(struct editorTermOut *out) {                       // {{{2
+    /* end the writer thread of _out_, output it did not write yet is
+     * dropped - a write blocked on a client has to be ended by shutting its
+     * socket down first */
+    if (!out->running) return;
+    pthread_mutex_lock(&out->lock);
+    out->stop = 1;
+    pthread_cond_broadcast(&out->cond);
+    while (!out->stopped) pthread_cond_wait(&out->cond, &out->lock);
+    pthread_mutex_unlock(&out->lock);
+    out->running = 0;
+    editorUnwatchFd(out->notify[0]);
+    close(out->notify[0]);
+    close(out->notify[1]);
+    pthread_mutex_destroy(&out->lock);
+    pthread_cond_destroy(&out->cond);
+    free(out->buf);
+    out->buf = NULL;
+}
+
+int editorOutputBusy() {                                                 // {{{2
+    /* non-zero while the terminal has not taken the last output yet */
+    if (!E.screen || !E.screen->out.running) return 0;
+    struct editorTermOut *out = &E.screen->out;
+    pthread_mutex_lock(&out->lock);
+    int busy = out->busy;
+    pthread_mutex_unlock(&out->lock);
+    return busy;
+}
+
+void editorDrainOutput() {                                               // {{{2
+    /* wait until the terminal took all of the output */
+    if (!E.screen || !E.screen->out.running) return;
+    struct editorTermOut *out = &E.screen->out;
+    pthread_mutex_lock(&out->lock);
+    while (out->busy) pthread_cond_wait(&out->cond, &out->lock);
+    pthread_mutex_unlock(&out->lock);
+}
+
+void editorOutput(const char *s, int len) {                              // {{{2
+    /* send output to the terminal, or collect it in memory when headless -
+     * the writer thread writes it, this only waits for output still in
+     * flight before it */
+    if (E.headless) {
+        abAppend(&headlessout, s, len);
+        return;
+    }
+    if (!E.screen || !E.screen->out.running) {
+        write(STDOUT_FILENO, s, len);
+        return;
+    }
+    struct editorTermOut *out = &E.screen->out;
+    editorDrainOutput();
+    if (len > out->cap) {
+        out->cap = len * 2;
+        out->buf = krealloc(out->buf, out->cap);
+        if (out->buf == NULL) die("realloc");
+    }
+    memcpy(out->buf, s, len);
+    out->len = len;
+    pthread_mutex_lock(&out->lock);
+    out->busy = 1;
+    pthread_cond_broadcast(&out->cond);
+    pthread_mutex_unlock(&out->lock);
+}
+
+// profiling -------------------------------------------------------------- {{{1
+
+/* the editor allocates through these, so that the profiler can count the
+ * allocations of a frame - memory the C library and zlib allocate on their
+ * own is not counted */
+void *kmalloc(size_t size) {                                             // {{{2
+    PROF_ALLOC();
+    return malloc(size);
+}
+
+void *kcalloc(size_t n, size_t size) {                                   // {{{2
+    PROF_ALLOC();
+    return calloc(n, size);
+}
+
+void *krealloc(void *p, size_t size) {                                   // {{{2
+    PROF_ALLOC();
+    return realloc(p, size);
+}
+
+#ifndef KILO_NO_PROFILE
+/* names of the timed sections in the HUD, the trace and the histograms */
+const char *profSpanName[PROF_SPANS] = {
+    "read key", "key", "scroll", "draw", "write"
+};
+
+void editorProfAlloc() {                                                 // {{{2
+    /* count an allocation, called by kmalloc() and friends from any
+     * thread */
+    if (__atomic_load_n(&E.prof.on, __ATOMIC_RELAXED))
+        __atomic_add_fetch(&E.prof.allocs, 1, __ATOMIC_RELAXED);
+}
+
+
+void editorProfEnable() {                                                // {{{2
+    /* time the sections while the HUD is shown or a trace is written */
+    int on = E.prof.hud || E.prof.trace;
+    if (on && !E.prof.used) {
+        E.prof.used = 1;
+        E.prof.epoch = editorNow();
+    }
+    __atomic_store_n(&E.prof.on, on, __ATOMIC_RELAXED);
+}
+
+void editorProfTrace(const char *path) {                                 // {{{2
+    /* write a Chrome trace (chrome://tracing, Perfetto) of the timed
+     * sections and the frames to _path_ */
+    E.prof.trace = fopen(path, "w");
+    if (E.prof.trace == NULL) die("fopen");
+    fputs("[\n", E.prof.trace);
+    editorProfEnable();
+}
+
+void editorProfToggleHud() {                                             // {{{2
+    E.prof.hud = !E.prof.hud;
+    editorProfEnable();
+}
+
+void editorProfBegin(int span) {                                         // {{{2
+    E.prof.start[span] = editorNow();
+}
+
+void editorProfEnd(int span) {                                           // {{{2
+    /* add the duration of the section to its histogram and the trace */
+    double now = editorNow();
+    double dur = now - E.prof.start[span];
+    E.prof.last[span] = dur;
+    E.prof.total[span] += dur;
+    E.prof.count[span]++;
+    int k = 0;
+    double us = dur * 1e6;
+    while (k < KILO_PROF_BUCKETS - 1 && us >= 2) {
+        us /= 2;
+        k++;
+    }
+    E.prof.hist[span][k]++;
+    if (E.prof.trace)
+        fprintf(E.prof.trace, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                "\"dur\":%.3f,\"pid\":1,\"tid\":1},\n", profSpanName[span],
+                (E.prof.start[span] - E.prof.epoch) * 1e6, dur * 1e6);
+}
+
+void editorProfFrame(size_t bytes) {                                     // {{{2
+    /* a frame of _bytes_ bytes was sent, it is charged with the allocations
+     * since the frame before it */
+    unsigned long allocs = __atomic_load_n(&E.prof.allocs, __ATOMIC_RELAXED);
+    E.prof.lastbytes = bytes;
+    E.prof.lastallocs = allocs - E.prof.frameallocs;
+    E.prof.frameallocs = allocs;
+    E.prof.frames++;
+    E.prof.totalbytes += bytes;
+    E.prof.totalallocs += E.prof.lastallocs;
+    if (E.prof.trace)
+        fprintf(E.prof.trace, "{\"name\":\"frame\",\"ph\":\"C\",\"ts\":%.3f,"
+                "\"pid\":1,\"args\":{\"bytes\":%zu,\"allocs\":%lu}},\n",
+                (editorNow() - E.prof.epoch) * 1e6, bytes, E.prof.lastallocs);
+}
+
+int editorProfHud(char *buf, size_t size) {                              // {{{2
+    /* the HUD line, the times of the last frame in microseconds - the key
+     * time leaves out the wait for the key */
+    struct editorProfile *p = &E.prof;
+    int len = snprintf(buf, size, "key %.0f scroll %.0f draw %.0f write %.0f"
+            " us | %zu B", (p->last[PROF_KEY] - p->last[PROF_READKEY]) * 1e6,
+            p->last[PROF_SCROLL] * 1e6, p->last[PROF_DRAW] * 1e6,
+            p->last[PROF_WRITE] * 1e6, p->lastbytes);
+    len += snprintf(buf + len, size - len, " %lu allocs", p->lastallocs);
+    return len < (int)size ? len : (int)size - 1;
+}
+
+void editorProfReport() {                                                // {{{2
+    /* atexit() handler - end the trace and print the histograms of the
+     * timed sections to stderr */
+    struct editorProfile *p = &E.prof;
+    if (!p->used) return;
+    if (p->trace) {
+        /* an empty event, the array cannot end with a comma */
+        fputs("{}\n]\n", p->trace);
+        fclose(p->trace);
+        p->trace = NULL;
+    }
+    fprintf(stderr, "kilo profile: %lu frames, %.0f bytes", p->frames,
+            p->frames ? (double)p->totalbytes / p->frames : 0.0);
+    fprintf(stderr, " and %.1f allocations", p->frames ?
+            (double)p->totalallocs / p->frames : 0.0);
+    fprintf(stderr, " per frame\n");
+    int span, k, j;
+    for (span = 0; span < PROF_SPANS; span++) {
+        if (!p->count[span]) continue;
+        fprintf(stderr, "%-8s %8lu times, mean %10.1f us\n",
+                profSpanName[span], p->count[span],
+                p->total[span] / p->count[span] * 1e6);
+        unsigned long most = 0;
+        for (k = 0; k < KILO_PROF_BUCKETS; k++)
+            if (p->hist[span][k] > most) most = p->hist[span][k];
+        for (k = 0; k < KILO_PROF_BUCKETS; k++) {
+            unsigned long n = p->hist[span][k];
+            if (!n) continue;
+            int bar = (int)((n * KILO_PROF_BAR + most - 1) / most);
+            fprintf(stderr, "  %8lu - %8lu us %8lu ",
+                    k ? 1UL << k : 0, 2UL << k, n);
+            for (j = 0; j < bar; j++) fputc('#', stderr);
+            fputc('\n', stderr);
+        }
+    }
+}
+#endif
+
+// output ----------------------------------------------------------------- {{{1
+
+int editorScreenLines(int at) {                                          // {{{2
+    /* number of screen lines row _at_ takes, rows past the end of the file
+     * are a line of their own */
+    if (!E.wrap || at >= E.buf->numrows) return 1;
+    return editorWrapLines(editorRenderRow(at));
+}
+
+void editorWrapMove(int *row, int *line, int n) {                        // {{{2
+    /* move the soft wrap position screen line _line_ of row _row_ by _n_
+     * screen lines, stopping at the top of the file and at the row after
+     * the last one - every row takes at least one screen line, so no more
+     * than _n_ rows are visited */
+    if (n < 0) {
+        n = -n;
+        while (n > *line && *row > 0) {
+            n -= *line + 1;
+            (*row)--;
+            *line = editorScreenLines(*row) - 1;
+        }
+        *line = n > *line ? 0 : *line - n;
+        return;
+    }
+    while (n > 0 && *row < E.buf->numrows) {
+        int left = editorScreenLines(*row) - 1 - *line;
+        if (n <= left) {
+            *line += n;
+            return;
+        }
+        n -= left + 1;
+        (*row)++;
+        *line = 0;
+    }
+}
+
+int editorWrapDistance(int fromrow, int fromline, int torow, int toline,
+        int limit) {                                                     // {{{2
+    /* screen lines from the soft wrap position (fromrow, fromline) down to
+     * (torow, toline), counting stops at _limit_ */
+    if (torow - fromrow >= limit) return limit;
+    int n = toline - fromline;
+    int j;
+    for (j = fromrow; j < torow && n < limit; j++) n += editorScreenLines(j);
+    return n < limit ? n : limit;
+}
+
+int editorCursorLine(int *x) {                                           // {{{2
+    /* screen line of its row the cursor is on in soft wrap mode, the column
+     * of the cursor on that line is stored to _x_ */
+    *x = 0;
+    if (E.cy >= E.buf->numrows) return 0;
+    erow *row = editorRenderRow(E.cy);
+    int rx = editorRowCxToRx(row, E.cx);
+    int line = editorWrapLine(row, rx);
+    int off;
+    *x = rx - editorWrapStart(row, line, &off);
+    return line;
+}
+
+void editorScrollWrapped() {                                             // {{{2
+    /* editorScroll() for soft wrap mode, the view starts at screen line
+     * rowsub of row rowoff and never scrolls horizontally */
+    int x;
+    int line = editorCursorLine(&x);
+    E.rx = 0;
+    if (E.cy < E.buf->numrows)
+        E.rx = editorRowCxToRx(editorRenderRow(E.cy), E.cx);
+    E.coloff = E.rx - x;
+    /* the row at the top may have lost screen lines since the last frame */
+    if (E.rowsub >= editorScreenLines(E.rowoff))
+        E.rowsub = editorScreenLines(E.rowoff) - 1;
+    /* if the cursor is above the visible window scroll to the cursor
+     * position */
+    if (E.cy < E.rowoff || (E.cy == E.rowoff && line < E.rowsub)) {
+        E.rowoff = E.cy;
+        E.rowsub = line;
+    }
+    /* if the cursor is below visible window, put it on the last screen
+     * row */
+    E.ry = editorWrapDistance(E.rowoff, E.rowsub, E.cy, line, E.screenrows);
+    if (E.ry >= E.screenrows) {
+        E.rowoff = E.cy;
+        E.rowsub = line;
+        editorWrapMove(&E.rowoff, &E.rowsub, -(E.screenrows - 1));
+        E.ry = editorWrapDistance(E.rowoff, E.rowsub, E.cy, line,
+                E.screenrows);
+    }
+}
+
+void editorScroll() {                                                    // {{{2
+    /* a jump or a search that waited for the index moves the cursor
+     * first */
+    editorJumpResume();
+    editorFindResume();
+    if (E.wrap) {
+        editorScrollWrapped();
+        return;
+    }
+    /* if the cursor is above the visible window scroll to the cursor
+     * position */
+    if (E.cy < E.rowoff) {
+        E.rowoff = E.cy;
+    }
+    /* if the cursor is below visible window, scroll accordingly */
+    if (E.cy >= E.rowoff + E.screenrows) {
+        E.rowoff = E.cy - E.screenrows + 1;
+    }
+    E.ry = E.cy - E.rowoff;
+    /* horizontal scrolling goes by the column of the cursor */
+    E.rx = 0;
+    if (E.cy < E.buf->numrows)
+        E.rx = editorRowCxToRx(editorRenderRow(E.cy), E.cx);
+    /* if the cursor is left of the visible window scroll to the cursor
      * position */
-    if (E.cx < E.coloff) {
-        E.coloff = E.cx;
+    if (E.rx < E.coloff) {
+        E.coloff = E.rx;
+    }
+    /* if the cursor is right of the visible window, scroll accordingly */
+    if (E.rx >= E.coloff + E.screencols) {
+        E.coloff = E.rx - E.screencols + 1;
+    }
+}
+
+void editorDrawRow(struct screenline *sl, int filerow, int line) {       // {{{2
+    /* write the contents of file row _filerow_ (without any cursor movement
+     * or line clearing), in soft wrap mode only its screen line _line_ */
+    /* check wheter we are drawing a row that is part of the text buffer
+     * or a row that comes after */
+    if (filerow >= E.buf->numrows) {
+        /* display the welcome message only if no file was supplied, rows
+         * and screen rows are the same then */
+        if (E.buf->numrows == 0 && filerow == E.screenrows / 3) {
+            char welcome[80];
+            /* snpfintf() form <stdio.h>, used to interpolate kilo version
+             * into the welcome message */
+            int welcomelen = snprintf(welcome, sizeof(welcome),
+                    "Kilo editor -- version %s", KILO_VERSION);
+            /* truncate the welcome message if it does not fit to screen */
+            if (welcomelen > E.screencols) welcomelen = E.screencols;
+            /* center the welcome message */
+            int padding = (E.screencols - welcomelen) / 2;
+            if (padding) {
+                slAppend(sl, "~", 1, ATTR_DEFAULT);
+                padding--;
+            }
+            /* fill the space up to string with space characters */
+            while (padding--) slAppend(sl, " ", 1, ATTR_DEFAULT);
+            slAppend(sl, welcome, welcomelen, ATTR_DEFAULT);
+        } else {
+            /* print tildes on each row of screen */
+           slAppend(sl, "~", 1, ATTR_DEFAULT);
+        }
+    } else {
+        erow *row = editorRenderRow(filerow);
+        /* the render bytes [off, off + len) are shown, columns of wide
+         * characters cut by the screen edges are spaces */
+        int off, len, lead = 0, trail = 0;
+        if (E.wrap) {
+            /* a screen line of the row, wide characters never straddle
+             * the screen edge */
+            editorWrapStart(row, line, &off);
+            int end = row->rsize;
+            if (line + 1 < editorWrapLines(row))
+                editorWrapStart(row, line + 1, &end);
+            len = end - off;
+        } else if (!row->wide) {
+            /* one byte per column */
+            off = E.coloff;
+            len = row->rsize - E.coloff;
+            /* in case the user scrolled horzontally past the end of line
+             * in that case set len to 0 so that nothing is displayed */
+            if (len < 0) len = 0;
+            /* truncate the rendered line if it goes beyond the screen */
+            if (len > E.screencols) len = E.screencols;
+        } else {
+            int col, w;
+            off = editorRowRenderAt(row, E.coloff, &col);
+            if (col < E.coloff) {
+                off += charNext(&row->render[off], row->rsize - off, col, &w);
+                lead = col + w - E.coloff;
+                col += w;
+            }
+            int end = off;
+            while (end < row->rsize) {
+                int n = charNext(&row->render[end], row->rsize - end, col, &w);
+                if (col + w > E.coloff + E.screencols) {
+                    trail = E.coloff + E.screencols - col;
+                    break;
+                }
+                end += n;
+                col += w;
+            }
+            len = end - off;
+        }
+        /* use off as an index to the character display */
+        char *c = &row->render[off];
+        if (lead) slAppend(sl, "  ", lead, ATTR_DEFAULT);
+        if (!E.buf->syntax) {
+            /* simply write out the chars fields of the erow */
+            slAppend(sl, c, len, ATTR_DEFAULT);
+        } else {
+            /* append runs of characters of the same highlight class, runs
+             * of classes with the same color are merged by slAppend() */
+            unsigned char *hl = &editorRowHighlight(filerow, row)[off];
+            int j = 0;
+            while (j < len) {
+                int run = j + 1;
+                while (run < len && hl[run] == hl[j]) run++;
+                slAppend(sl, &c[j], run - j, hl[j] == HL_NORMAL ?
+                        ATTR_DEFAULT : editorSyntaxToColor(hl[j]));
+                j = run;
+            }
+        }
+        if (trail) slAppend(sl, "  ", trail, ATTR_DEFAULT);
+    }
+}
+
+uint64_t editorHashLine(struct screenline *sl) {                         // {{{2
+    /* 64 bit FNV-1a hash of a screen line and its runs, used to detect
+     * changed lines */
+    uint64_t h = 14695981039346656037ULL;
+    int j;
+    for (j = 0; j < sl->text.len; j++) {
+        h ^= (unsigned char)sl->text.b[j];
+        h *= 1099511628211ULL;
+    }
+    for (j = 0; j < sl->numruns; j++) {
+        h ^= (uint64_t)sl->runoff[j] << 32 | (uint32_t)sl->runattr[j];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void editorSetAttr(struct abuf *ab, int attr) {                          // {{{2
+    /* switch the terminal from E.termattr to attribute _attr_ with a single
+     * SGR sequence that only names what changes, [m resets everything and
+     * is the shortest way back to the default */
+    if (attr == E.termattr) return;
+    char buf[32];
+    int len;
+    if (attr == ATTR_DEFAULT) {
+        len = snprintf(buf, sizeof(buf), "\x1b[m");
+    } else {
+        len = snprintf(buf, sizeof(buf), "\x1b[");
+        /* [7m = inverted colors, [27m = not inverted */
+        if ((attr ^ E.termattr) & ATTR_INVERSE)
+            len += snprintf(buf + len, sizeof(buf) - len, "%s",
+                    attr & ATTR_INVERSE ? "7" : "27");
+        /* [3Xm = foreground color X, [39m = default foreground */
+        int fg = attr & 0xff;
+        if (fg != (E.termattr & 0xff))
+            len += snprintf(buf + len, sizeof(buf) - len, "%s%d",
+                    len > 2 ? ";" : "", fg ? fg : 39);
+        len += snprintf(buf + len, sizeof(buf) - len, "m");
+    }
+    abAppend(ab, buf, len);
+    E.termattr = attr;
+}
+
+int editorScrollFrame(struct abuf *ab) {                                 // {{{2
+    /* if the viewport moved by less than a screen since the last frame, let
+     * the terminal move the rows that stay visible so that only the newly
+     * exposed rows have to be drawn
+     * returns non-zero if a scroll was emitted */
+    int delta = E.rowoff - E.framerowoff;
+    if (E.wrap && E.framevalid) {
+        /* count the screen lines between the two tops */
+        if (delta > 0 || (delta == 0 && E.rowsub >= E.framerowsub))
+            delta = editorWrapDistance(E.framerowoff, E.framerowsub,
+                    E.rowoff, E.rowsub, E.screenrows);
+        else
+            delta = -editorWrapDistance(E.rowoff, E.rowsub,
+                    E.framerowoff, E.framerowsub, E.screenrows);
+    }
+    int n = delta < 0 ? -delta : delta;
+    if (!E.framevalid || n == 0 || n >= E.screenrows) return 0;
+
+    /* [top;bottomr (DECSTBM) limits scrolling to the text rows of the
+     * view, the cursor is then placed at the top of the region and [nM
+     * deletes n lines (content moves up, blank lines appear at the bottom)
+     * or [nL inserts n lines (content moves down)
+     * insert/delete line is used instead of [nS / [nT for portability */
+    int top = E.view->top;
+    char buf[64];
+    int buflen = snprintf(buf, sizeof(buf),
+            "\x1b[%d;%dr\x1b[%d;1H\x1b[%d%c\x1b[r", top + 1,
+            top + E.screenrows, top + 1, n, delta > 0 ? 'M' : 'L');
+    abAppend(ab, buf, buflen);
+
+    /* shift the shadow frame the same way, exposed rows are blank on the
+     * terminal now */
+    int keep = E.screenrows - n;
+    uint64_t *hash = E.linehash + top;
+    struct screenline empty = SL_INIT;
+    uint64_t blank = editorHashLine(&empty);
+    int y;
+    if (delta > 0) {
+        memmove(hash, hash + n, keep * sizeof(uint64_t));
+        for (y = keep; y < E.screenrows; y++) hash[y] = blank;
+    } else {
+        memmove(hash + n, hash, keep * sizeof(uint64_t));
+        for (y = 0; y < n; y++) hash[y] = blank;
+    }
+    return 1;
+}
+
+void editorDrawStatusBar(struct screenline *sl) {                        // {{{2
+    /* status bar in inverted colors - file name, number of lines (or how
+     * many are indexed so far) and the current line */
+    char status[80], rstatus[80];
+    char num[32] = "";
+    /* with more than one buffer, which one of them this is */
+    if (E.numbufs > 1)
+        snprintf(num, sizeof(num), "[%d/%d] ", editorBufferIndex(E.buf) + 1,
+                E.numbufs);
+    int len = snprintf(status, sizeof(status), "%s%.20s - %d lines%s%s%s",
+            num, E.buf->filename ? E.buf->filename : "[No Name]",
+            E.buf->numrows,
+            E.buf->dirty ? " (modified)" : "",
+            E.buf->load.active ? " (indexing...)" : "",
+            E.buf->follow.fd != -1 ? " (following)" : "");
+    int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+            E.buf->syntax ? E.buf->syntax->filetype : "no ft", E.cy + 1,
+            E.buf->numrows);
+    if (len > E.screencols) len = E.screencols;
+    slAppend(sl, status, len, ATTR_INVERSE);
+    /* fill the rest with spaces and right align the line number */
+    while (len < E.screencols) {
+        if (E.screencols - len == rlen) {
+            slAppend(sl, rstatus, rlen, ATTR_INVERSE);
+            break;
+        }
+        slAppend(sl, " ", 1, ATTR_INVERSE);
+        len++;
+    }
+}
+
+void editorDrawMessageBar(struct screenline *sl) {                       // {{{2
+    /* message bar below the status bar, the message is only shown for
+     * KILO_MESSAGE_SECS after it was set */
+#ifndef KILO_NO_PROFILE
+    /* the HUD takes the place of the message */
+    if (E.prof.hud) {
+        char hud[128];
+        int hudlen = editorProfHud(hud, sizeof(hud));
+        if (hudlen > E.screencols) hudlen = E.screencols;
+        slAppend(sl, hud, hudlen, ATTR_DEFAULT);
+        return;
+    }
+#endif
+    int msglen = strlen(E.statusmsg);
+    if (msglen > E.screencols) msglen = E.screencols;
+    if (msglen && time(NULL) - E.statusmsg_time < KILO_MESSAGE_SECS)
+        slAppend(sl, E.statusmsg, msglen, ATTR_DEFAULT);
+}
+
+int editorDrawLine(struct abuf *ab, struct screenline *line, int y) {   // {{{2
+    /* send _line_ as screen line _y_ if it changed since the last frame, the
+     * line is positioned explicitly, so unchanged lines cost no output at
+     * all - returns non-zero if it was sent */
+    uint64_t h = editorHashLine(line);
+    if (E.framevalid && E.linehash[y] == h) return 0;
+    E.linehash[y] = h;
+
+    /* move the cursor to the beginning of the row */
+    char buf[32];
+    int buflen = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+    abAppend(ab, buf, buflen);
+    int j;
+    for (j = 0; j < line->numruns; j++) {
+        const char *run = &line->text.b[line->runoff[j]];
+        int end = j + 1 < line->numruns ? line->runoff[j + 1] : line->text.len;
+        int len = end - line->runoff[j];
+        /* spaces look the same in every foreground color, a run of
+         * them keeps the color the terminal has */
+        int k = 0;
+        if (!((line->runattr[j] ^ E.termattr) & ATTR_INVERSE))
+            while (k < len && run[k] == ' ') k++;
+        if (k < len) editorSetAttr(ab, line->runattr[j]);
+        abAppend(ab, run, len);
+    }
+    /* clear rest of the line after repainting
+     * [0K = clear line from cursor right (default)
+     * [1K = clear line up to cursor
+     * [2K = clear whole line
+     * the cleared part takes the background of the current attribute,
+     * it must not be inverted */
+    if (E.termattr & ATTR_INVERSE)
+        editorSetAttr(ab, E.termattr & ~ATTR_INVERSE);
+    abAppend(ab, "\x1b[K", 3);
+    return 1;
+}
+
+int editorDrawView(struct abuf *ab, struct screenline *line) {           // {{{2
+    /* draw the text rows and the status bar of the active view, returns the
+     * number of lines sent */
+    int drawn = 0;
+    int y;
+    /* the row and, in soft wrap mode, its screen line at screen row y */
+    int filerow = E.rowoff, sub = E.rowsub;
+    /* the rows above the last visible one are lexed far enough to know the
+     * state every visible row starts in */
+    editorSyntaxSync(E.rowoff + E.screenrows);
+    for (y = 0; y <= E.screenrows; y++) {
+        slReset(line);
+        if (y < E.screenrows) {
+            editorDrawRow(line, filerow, sub);
+            if (++sub >= editorScreenLines(filerow)) {
+                filerow++;
+                sub = 0;
+            }
+        } else editorDrawStatusBar(line);
+        drawn += editorDrawLine(ab, line, E.view->top + y);
+    }
+    E.framerowoff = E.rowoff;
+    E.framerowsub = E.rowsub;
+
+    /* drop render buffers of rows that scrolled far away */
+    editorTrimRenderCache();
+    return drawn;
+}
+
+int editorDrawRows(struct abuf *ab) {                                    // {{{2
+    /* draw only the screen rows whose contents changed since the last frame,
+     * view by view and the message bar below them
+     * attributes are only switched where a run needs another one than the
+     * terminal has, the attribute carries over from one line to the next
+     * and is reset once at the end of the frame
+     * returns the number of rows drawn */
+    /* scratch buffer for one screen line, kept between frames */
+    static struct screenline line = SL_INIT;
+    struct editorView *active = E.view;
+    int drawn = 0;
+    int j;
+    for (j = 0; j < E.numviews; j++) {
+        editorSwitchView(&E.views[j]);
+        /* the active view was scrolled to the cursor before */
+        if (E.view != active) editorScroll();
+        /* let the terminal scroll what stays visible */
+        drawn += editorScrollFrame(ab);
+        drawn += editorDrawView(ab, &line);
+    }
+    editorSwitchView(active);
+    slReset(&line);
+    editorDrawMessageBar(&line);
+    drawn += editorDrawLine(ab, &line, E.screenlines - 1);
+    /* leave the terminal with the default attribute between frames */
+    editorSetAttr(ab, ATTR_DEFAULT);
+    E.framevalid = 1;
+    return drawn;
+}
+
+int editorFrameDue() {                                                   // {{{2
+    /* non-zero if a frame may be drawn now - not before the terminal took
+     * the last one, so that a slow line only ever gets the latest state,
+     * and not more often than the frame rate limit, a frame that has to
+     * wait is drawn from the event loop when its time comes */
+    if (E.headless) return 1;
+    /* the daemon's own screen is not shown anywhere, a client gets frames
+     * once it said hello */
+    if (E.daemon && (E.screen->fd == -1 || !E.screen->ready)) return 0;
+    if (editorOutputBusy()) {
+        /* the frame is drawn once the writer reports the output gone (see
+         * editorOutputDone()), nothing wakes the event loop for it before -
+         * a pending redraw or a coalesced repaint would make it spin */
+        E.framewait = 1;
+        E.redraw = 0;
+        E.redrawat = 0;
+        return 0;
+    }
+    double due = E.lastframe + E.frametime;
+    if (editorNow() < due) {
+        if (!E.redrawat || E.redrawat > due) E.redrawat = due;
+        return 0;
+    }
+    return 1;
+}
+
+void editorRefreshScreen() {                                             // {{{2
+    if (!editorFrameDue()) return;
+    /* call scrolling function before each refresh */
+    PROF_BEGIN(PROF_SCROLL);
+    editorScroll();
+    PROF_END(PROF_SCROLL);
+    E.redraw = 0;
+    E.redrawat = 0;
+    E.lastframe = editorNow();
+
+    /* buffer ab is kept allocated between frames, it is only emptied here so
+     * that a steady state frame does not allocate at all */
+    static struct abuf ab = ABUF_INIT;
+    abReset(&ab);
+    /* escape sequence to hide the cursor while rows are drawn, it is
+     * removed again below if no row changed */
+    abAppend(&ab, "\x1b[?25l", 6);
+    /* control characters for positioning the cursor:
+     * [12;40H - positions the cursor to the middle of screen on 80x24 terminal
+     * [row;columnH, the indexes are 1 based, default is [1;1H = [H */
+    PROF_BEGIN(PROF_DRAW);
+    int drawn = editorDrawRows(&ab);
+    if (!drawn) abReset(&ab);
+
+    /* position the cursor */
+    char buf[32];
+    /* use snprintf() to inject cursor position into string in buf variable */
+    /* __ry__ is the row of the view editorScroll() put the cursor on */
+    /* subtract __coloff__ from __rx__ to get correct behavior when scrolling */
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.view->top + E.ry + 1,
+                                              (E.rx - E.coloff) + 1);
+    /* strlen() is form <string.h> */
+    abAppend(&ab, buf, strlen(buf));
+
+    /* escape sequence to show the cursor */
+    if (drawn) abAppend(&ab, "\x1b[?25h", 6);
+    PROF_END(PROF_DRAW);
+
+    /* write the buffer contents to standard output */
+    PROF_BEGIN(PROF_WRITE);
+    editorOutput(ab.b, ab.len);
+    PROF_END(PROF_WRITE);
+    PROF_FRAME(ab.len);
+}
+
+void editorRequestRedraw() {                                             // {{{2
+    /* ask for a repaint from an event callback, requests that come quicker
+     * than the frame rate limit are coalesced into a single frame */
+    if (E.redraw || E.redrawat || E.framewait) return;
+    double due = E.lastframe + E.frametime;
+    if (editorNow() >= due) E.redraw = 1;
+    else E.redrawat = due;
+}
+
+int editorRedrawTimeout() {                                              // {{{2
+    /* poll() timeout in milliseconds while waiting for a key, -1 unless a
+     * coalesced repaint is pending, sets E.redraw once the repaint is due */
+    if (!E.redrawat) return -1;
+    double left = E.redrawat - editorNow();
+    if (left <= 0) {
+        E.redraw = 1;
+        return 0;
+    }
+    return (int)(left * 1000) + 1;
+}
+
+void editorSetStatusMessage(const char *fmt, ...) {                      // {{{2
+    /* set the message bar text, printf() style */
+    /* va_list, va_start() and va_end() from <stdarg.h> */
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
+    va_end(ap);
+    E.statusmsg_time = time(NULL);
+}
+
+void editorResize(int rows, int cols) {                                  // {{{2
+    /* the screen is _rows_ x _cols_ now, repaint everything */
+    uint64_t *hash = krealloc(E.linehash, rows * sizeof(uint64_t));
+    if (hash == NULL) die("realloc");
+    E.linehash = hash;
+    E.screenlines = rows;
+    E.screencols = cols;
+
+    /* views that do not fit anymore are closed, from the bottom */
+    while (E.numviews > 1 && (rows - 1) / E.numviews < 2) {
+        editorSwitchView(&E.views[E.numviews - 1]);
+        editorCloseView();
+    }
+    /* the terminal contents are unknown after a resize */
+    editorLayout();
+    E.redraw = 1;
+}
+
+void editorHandleResize(int fd) {                                        // {{{2
+    /* event loop callback for the SIGWINCH self-pipe - read the new window
+     * size */
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0);
+
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1) return;
+    editorResize(rows, cols);
+}
+
+// input ------------------------------------------------------------------ {{{1
+
+void editorWrapCursor(int n) {                                           // {{{2
+    /* move the cursor by _n_ screen lines in soft wrap mode, keeping its
+     * column on the screen line where the line is long enough */
+    int x;
+    int row = E.cy, line = editorCursorLine(&x);
+    editorWrapMove(&row, &line, n);
+    E.cy = row;
+    E.cx = 0;
+    if (row >= E.buf->numrows) return;
+    erow *r = editorRenderRow(row);
+    int off;
+    int rx = editorWrapStart(r, line, &off) + x;
+    /* a line that wraps ends with the character before the wrap point */
+    if (line + 1 < editorWrapLines(r)) {
+        int next = editorWrapStart(r, line + 1, &off);
+        if (rx >= next) rx = next - 1;
     }
-    /* if the cursor is right of the visible window, scroll accordingly */
-    if (E.cx >= E.coloff + E.screencols) {
-        E.coloff = E.cx - E.screencols + 1;
+    E.cx = editorRowRxToCx(r, rx);
+}
+
+void editorMoveCursor(int key) {                                         // {{{2
+    /* check if the cursor is on the actual line. if so, the row will point
+     * to the erow the cursor is on */
+    erow *row = (E.cy >= E.buf->numrows) ? NULL : editorRowAt(E.cy);
+
+    /* use arrows for movement */
+    switch (key) {
+        case ARROW_UP:
+            /* soft wrapped rows are walked screen line by screen line */
+            if (E.wrap) {
+                editorWrapCursor(-1);
+            } else if (E.cy != 0) {
+                E.cy--;
+            }
+            break;
+        case ARROW_DOWN:
+            /* allow cursor to advance past the bottom of the screen */
+            if (E.wrap) {
+                editorWrapCursor(1);
+            } else if (E.cy < E.buf->numrows) {
+                E.cy++;
+            }
+            break;
+        case ARROW_RIGHT:
+            /* allow user to scroll past the right edge of the screen */
+            /* while limiting the movement to the length of the line + 1 */
+            if (row && E.cx < row->size) {
+                int w;
+                E.cx += charNext(&row->chars[E.cx], row->size - E.cx, 0, &w);
+            /* left arrow at the end of line goes to the start of next line */
+            } else if (row && E.cx == row->size) {
+                E.cy++;
+                E.cx = 0;
+            }
+            break;
+        case ARROW_LEFT:
+            if (E.cx != 0) {
+                E.cx = charStart(row->chars, row->size, E.cx - 1);
+            /* allow user to move to the end of line above if at the beginning
+             * of a line
+             * make sure we are not at the first line */
+            } else if (E.cy > 0) {
+                E.cy--;
+                E.cx = editorRowAt(E.cy)->size;
+            }
+            break;
+    }
+
+    /* fix vertical movement - snap to the length of line
+     * set row again as E.cy will be pointing to a different line */
+    row = (E.cy >= E.buf->numrows) ? NULL : editorRowAt(E.cy);
+    /* get length of row the cursor is on, consider NULL line to be of 0 length */
+    int rowlen = row ? row->size : 0;
+    /* if the cursor is to the right of the line end, set it to the end
+     * of the current line */
+    if (E.cx > rowlen) {
+        E.cx = rowlen;
+    }
+    /* and never in the middle of a character */
+    if (row) E.cx = charStart(row->chars, row->size, E.cx);
+}
+
+void editorCenterCursor() {                                              // {{{2
+    /* scroll so that the cursor row is in the middle of the screen */
+    if (E.wrap) {
+        int x;
+        E.rowoff = E.cy;
+        E.rowsub = editorCursorLine(&x);
+        editorWrapMove(&E.rowoff, &E.rowsub, -(E.screenrows / 2));
+        return;
+    }
+    E.rowoff = E.cy - E.screenrows / 2;
+    if (E.rowoff < 0) E.rowoff = 0;
+}
+
+void editorToggleWrap() {                                                // {{{2
+    /* switch soft wrap mode on or off, the cursor stays where it is and the
+     * view follows it */
+    E.wrap = !E.wrap;
+    E.rowsub = 0;
+    E.coloff = 0;
+    editorSetStatusMessage("Soft wrap %s", E.wrap ? "on" : "off");
+}
+
+char *editorPrompt(char *prompt, void (*callback)(char *, int)) {         // {{{2
+    /* read a line of input in the message bar, _prompt_ is a format string
+     * with one %s for the input so far, _callback_ (if not NULL) is called
+     * with the input and the key after every keypress
+     * returns the malloc()ed input, or NULL if the user pressed escape */
+    size_t bufsize = 128;
+    char *buf = kmalloc(bufsize);
+    size_t buflen = 0;
+    buf[0] = '\0';
+
+    while (1) {
+        editorSetStatusMessage(prompt, buf);
+        editorRefreshScreen();
+
+        int c = editorReadKey();
+        if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
+            if (buflen != 0) buf[--buflen] = '\0';
+        } else if (c == '\x1b') {
+            editorSetStatusMessage("");
+            if (callback) callback(buf, c);
+            free(buf);
+            return NULL;
+        } else if (c == '\r') {
+            if (buflen != 0) {
+                editorSetStatusMessage("");
+                if (callback) callback(buf, c);
+                return buf;
+            }
+        } else if (!iscntrl(c) && c < 128) {
+            /* double the buffer when it is full */
+            if (buflen == bufsize - 1) {
+                bufsize *= 2;
+                buf = krealloc(buf, bufsize);
+                if (buf == NULL) die("realloc");
+            }
+            buf[buflen++] = c;
+            buf[buflen] = '\0';
+        }
+
+        if (callback) callback(buf, c);
+    }
+}
+
+void editorJumpResume() {                                                // {{{2
+    /* finish a percentage jump of the active view if the rows it goes to
+     * are indexed, the row is the one holding that byte of the file */
+    if (!E.jumpwait) return;
+    int line;
+    if (E.buf->map == NULL) {
+        line = (int)((long long)E.buf->numrows * E.jumppct / 100);
+    } else {
+        /* the size of the text of a gzip file is only known at the end */
+        if (E.buf->load.active && E.buf->gz) return;
+        size_t off = E.buf->maplen / 100 * E.jumppct +
+            E.buf->maplen % 100 * E.jumppct / 100;
+        if (E.buf->load.active && off >= E.buf->load.indexed) return;
+        line = editorRowAtOffset(off);
+    }
+    E.jumpwait = 0;
+    if (line >= E.buf->numrows)
+        line = E.buf->numrows > 0 ? E.buf->numrows - 1 : 0;
+    E.cy = line;
+    E.cx = 0;
+    editorCenterCursor();
+}
+
+void editorJumpToLine() {                                                // {{{2
+    /* ask for a line number (1 based) or a percentage of the file and move
+     * the cursor there, the row is found through the block index, nothing
+     * between the old and the new position is touched */
+    char *input = editorPrompt("Go to line (N or N%%): %s", NULL);
+    if (input == NULL) return;
+
+    char *end;
+    long n = strtol(input, &end, 10);
+    int percent = *end == '%';
+    if (percent) end++;
+    int bad = end == input || *end != '\0' || n < 0;
+    free(input);
+    if (bad) {
+        editorSetStatusMessage("Not a line number or percentage");
+        return;
+    }
+
+    if (percent) {
+        /* a percentage of the bytes of the file, a file that is still being
+         * indexed is not waited for - the jump is finished once the index
+         * reaches that far */
+        E.jumpwait = 1;
+        E.jumppct = n > 100 ? 100 : n;
+        editorJumpResume();
+        if (E.jumpwait)
+            editorSetStatusMessage("Indexing... the cursor moves to %d%% "
+                    "once it is reached", E.jumppct);
+        return;
+    }
+
+    /* rows past the ones indexed so far may still be coming */
+    long line = n > 0 ? n - 1 : 0;
+    if (line + E.screenrows > INT_MAX) line = INT_MAX - E.screenrows;
+    editorLoadWait(line + E.screenrows);
+    if (line >= E.buf->numrows)
+        line = E.buf->numrows > 0 ? E.buf->numrows - 1 : 0;
+
+    E.cy = line;
+    E.cx = 0;
+    editorCenterCursor();
+}
+
+void editorProcessKey(int c) {                                           // {{{2
+    /* handle key _c_ */
+    /* quitting with unsaved changes takes KILO_QUIT_TIMES presses in a
+     * row */
+    static int quit_times = KILO_QUIT_TIMES;
+    /* so does closing a buffer with unsaved changes */
+    static int close_times = KILO_QUIT_TIMES;
+    int j;
+    /* a key pressed while a jump waits for the index cancels it */
+    E.jumpwait = 0;
+
+    switch (c) {
+        /* enter key */
+        case '\r':
+            editorInsertNewline();
+            break;
+
+        /* check whether pressed key = 'q' with bits 5-7 stripped off */
+        case CTRL_KEY('q'):
+            /* a client detaches, the buffers stay with the daemon */
+            if (E.daemon) {
+                E.screen->detach = 1;
+                return;
+            }
+            if (editorDirtyBuffers() && quit_times > 0) {
+                editorSetStatusMessage("WARNING!!! %d file(s) have unsaved "
+                        "changes. Press Ctrl-Q %d more times to quit.",
+                        editorDirtyBuffers(), quit_times);
+                quit_times--;
+                return;
+            }
+            /* quitting drops the unsaved changes, and their journals */
+            for (j = 0; j < E.numbufs; j++) {
+                editorEnterBuffer(E.bufs[j]);
+                editorSwapStop(1);
+            }
+            /* clear the screen and reposition the cursor at the start of screen */
+            editorOutput("\x1b[2J", 4);
+            editorOutput("\x1b[H", 3);
+            exit(0);
+            break;
+
+        /* check for movement keys */
+        case HOME_KEY:
+            /* set cursor to the beginning of line */
+            E.cx = 0;
+            break;
+        case END_KEY:
+            /* set cursor to the end of line */
+            if (E.cy < E.buf->numrows) E.cx = editorRowAt(E.cy)->size;
+            break;
+
+        case PAGE_UP:
+        case PAGE_DOWN:
+            /* move the cursor and the view by a screen at once, the cost
+             * does not depend on the page size or the file size */
+            {
+                int delta = c == PAGE_UP ? -E.screenrows : E.screenrows;
+                if (E.wrap) {
+                    /* by screen lines, the view moves along */
+                    editorWrapCursor(delta);
+                    editorWrapMove(&E.rowoff, &E.rowsub, delta);
+                    break;
+                }
+                E.cy += delta;
+                E.rowoff += delta;
+                if (E.cy < 0) E.cy = 0;
+                if (E.cy > E.buf->numrows) E.cy = E.buf->numrows;
+                if (E.rowoff < 0) E.rowoff = 0;
+                if (E.rowoff > E.cy) E.rowoff = E.cy;
+                /* snap to the length of the new line */
+                int rowlen = E.cy < E.buf->numrows ?
+                    editorRowAt(E.cy)->size : 0;
+                if (E.cx > rowlen) E.cx = rowlen;
+                if (E.cy < E.buf->numrows)
+                    E.cx = charStart(editorRowAt(E.cy)->chars, rowlen, E.cx);
+            }
+            break;
+
+        case CTRL_KEY('s'):
+            editorSave();
+            break;
+
+        case CTRL_KEY('g'):
+            editorJumpToLine();
+            break;
+
+        case CTRL_KEY('w'):
+            editorToggleWrap();
+            break;
+
+        /* buffers and views */
+        case CTRL_KEY('o'):
+            editorOpenPrompt();
+            break;
+        case CTRL_KEY('n'):
+        case CTRL_KEY('p'):
+            editorCycleBuffer(c == CTRL_KEY('n') ? 1 : -1);
+            break;
+        case CTRL_KEY('x'):
+            editorSplitView();
+            break;
+        case CTRL_KEY('v'):
+            editorCycleView();
+            break;
+        case CTRL_KEY('k'):
+            /* close the view, the only one left closes its buffer */
+            if (E.numviews > 1) {
+                editorCloseView();
+                break;
+            }
+            if (E.buf->dirty && close_times > 0) {
+                editorSetStatusMessage("WARNING!!! File has unsaved changes. "
+                        "Press Ctrl-K %d more times to close it.", close_times);
+                close_times--;
+                return;
+            }
+            /* closing drops the unsaved changes, and their journal */
+            editorCloseBuffer();
+            break;
+
+#ifndef KILO_NO_PROFILE
+        case CTRL_KEY('t'):
+            editorProfToggleHud();
+            break;
+#endif
+
+        /* raw mode turned off ISIG, Ctrl-Z arrives as a key */
+        case CTRL_KEY('z'):
+            editorUndo();
+            break;
+        case CTRL_KEY('y'):
+            editorRedo();
+            break;
+
+        case CTRL_KEY('f'):
+            editorFind();
+            break;
+
+        /* Ctrl-H sends 8, which is what backspace used to send */
+        case BACKSPACE:
+        case CTRL_KEY('h'):
+        case DEL_KEY:
+            /* delete deletes the character right of the cursor */
+            if (c == DEL_KEY) editorMoveCursor(ARROW_RIGHT);
+            editorDelChar();
+            break;
+
+        case ARROW_UP:
+        case ARROW_DOWN:
+        case ARROW_RIGHT:
+        case ARROW_LEFT:
+            editorMoveCursor(c);
+            break;
+
+        /* Ctrl-L is traditionally used to refresh the screen, ignore it and
+         * unrecognised escape sequences */
+        case CTRL_KEY('l'):
+        case '\x1b':
+            break;
+
+        /* any other key is inserted into the text */
+        default:
+            editorInsertChar(c);
+            break;
+    }
+
+    quit_times = KILO_QUIT_TIMES;
+    close_times = KILO_QUIT_TIMES;
+}
+
+void editorProcessKeypress() {                                           // {{{2
+    /* wait for keypress and handle it */
+    PROF_BEGIN(PROF_KEY);
+    PROF_BEGIN(PROF_READKEY);
+    int c = editorReadKey();
+    PROF_END(PROF_READKEY);
+    editorProcessKey(c);
+    PROF_END(PROF_KEY);
+}
+
+// clients ---------------------------------------------------------------- {{{1
+
+/* daemon mode (-d) keeps the buffers - rows, line indexes, highlight state -
+ * resident in one process, clients (-c) attach to it through a unix socket:
+ * a client forwards the keys and the size of its terminal and copies the
+ * frames the daemon draws for it to the terminal, so attaching to a file
+ * that is open already costs a hello and one frame
+ * a message is a type byte and a 4 byte payload length in host order,
+ * followed by the payload:
+ *   'h' hello - rows and cols of the terminal (int each), then the files to
+ *       show as absolute paths, each ending with a NUL
+ *   'k' keys - bytes typed on the terminal, at most KILO_INBUF_SIZE
+ *   'w' resize - rows and cols
+ * frames go back unframed, the bytes a terminal would get */
+
+struct editorScreen *editorScreenNew(int fd) {                           // {{{2
+    /* a new screen without views, added to the screen list */
+    struct editorScreen *s = kcalloc(1, sizeof(struct editorScreen));
+    if (s == NULL) die("calloc");
+    s->fd = fd;
+    s->infd = fd;
+    s->view = &s->views[0];
+    s->termattr = ATTR_DEFAULT;
+    struct editorScreen **screens =
+        krealloc(E.screens, sizeof(*screens) * (E.numscreens + 1));
+    if (screens == NULL) die("realloc");
+    E.screens = screens;
+    E.screens[E.numscreens++] = s;
+    return s;
+}
+
+void editorScreenSwitch(struct editorScreen *s) {                        // {{{2
+    /* make _s_ the active screen - the state of the active one is copied
+     * from E back to its struct and the state of _s_ into E, a cursor past
+     * text another client deleted is put back onto the text */
+    struct editorScreen *c = E.screen;
+    if (s == c) return;
+    editorViewSave();
+    c->numviews = E.numviews;
+    c->view = E.view;
+    c->screenlines = E.screenlines;
+    c->screencols = E.screencols;
+    memcpy(c->statusmsg, E.statusmsg, sizeof(c->statusmsg));
+    c->statusmsg_time = E.statusmsg_time;
+    c->search = E.search;
+    c->linehash = E.linehash;
+    c->framevalid = E.framevalid;
+    c->termattr = E.termattr;
+    /* only the keys not consumed yet */
+    c->inlen = E.inlen - E.inpos;
+    memcpy(c->inbuf, E.inbuf + E.inpos, c->inlen);
+    c->inpos = 0;
+    c->infd = E.infd;
+    c->redraw = E.redraw;
+    c->framewait = E.framewait;
+    c->lastframe = E.lastframe;
+    c->redrawat = E.redrawat;
+
+    E.screen = s;
+    E.views = s->views;
+    E.numviews = s->numviews;
+    E.screenlines = s->screenlines;
+    E.screencols = s->screencols;
+    memcpy(E.statusmsg, s->statusmsg, sizeof(E.statusmsg));
+    E.statusmsg_time = s->statusmsg_time;
+    E.search = s->search;
+    E.linehash = s->linehash;
+    E.framevalid = s->framevalid;
+    E.termattr = s->termattr;
+    memcpy(E.inbuf, s->inbuf + s->inpos, s->inlen - s->inpos);
+    E.inlen = s->inlen - s->inpos;
+    E.inpos = 0;
+    E.infd = s->infd;
+    E.redraw = s->redraw;
+    E.framewait = s->framewait;
+    E.lastframe = s->lastframe;
+    E.redrawat = s->redrawat;
+    editorViewLoad(s->view);
+}
+
+void editorScreenClose(struct editorScreen *s) {                         // {{{2
+    /* a client detached or went away - its views let go of their buffers,
+     * which stay open in the daemon, and its socket is closed */
+    struct editorScreen *home = E.screen;
+    int j;
+    editorScreenSwitch(s);
+    for (j = 0; j < E.numviews; j++) {
+        editorSwitchView(&E.views[j]);
+        editorViewLeave();
+    }
+    editorScreenSwitch(home);
+
+    for (j = 0; j < E.numscreens && E.screens[j] != s; j++);
+    memmove(&E.screens[j], &E.screens[j + 1],
+            sizeof(E.screens[0]) * (E.numscreens - j - 1));
+    E.numscreens--;
+    for (j = 0; j < s->numviews; j++) editorBufferUnref(s->views[j].buf);
+
+    editorUnwatchFd(s->fd);
+    /* a writer blocked on a client that does not read ends here */
+    shutdown(s->fd, SHUT_RDWR);
+    editorOutputStop(&s->out);
+    close(s->fd);
+    free(s->linehash);
+    free(s->msg);
+    free(s->search.query);
+    free(s);
+}
+
+int editorClientRecv() {                                                 // {{{2
+    /* take what the client of the active screen sent without waiting,
+     * returns the number of bytes, 0 if there were none - a client that
+     * closed the socket or announces a message that is too long detaches */
+    struct editorScreen *s = E.screen;
+    if (s->msgcap - s->msglen < KILO_INBUF_SIZE) {
+        int cap = s->msgcap ? s->msgcap * 2 : KILO_INBUF_SIZE * 2;
+        char *msg = krealloc(s->msg, cap);
+        if (msg == NULL) die("realloc");
+        s->msg = msg;
+        s->msgcap = cap;
+    }
+    ssize_t n = recv(s->fd, s->msg + s->msglen, s->msgcap - s->msglen,
+            MSG_DONTWAIT);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR)) return 0;
+    if (n <= 0) {
+        s->detach = 1;
+        return 0;
+    }
+    s->msglen += n;
+    uint32_t len;
+    if (s->msglen >= 5) {
+        memcpy(&len, s->msg + 1, sizeof(len));
+        if (len > KILO_MSG_MAX) s->detach = 1;
+    }
+    return n;
+}
+
+void editorClientHello(int rows, int cols, char *names, int len) {       // {{{2
+    /* the client of the active screen said hello - the screen gets the size
+     * of its terminal and shows the first of the files it names, files
+     * that are open already are not read again */
+    editorResize(rows, cols);
+    E.screen->ready = 1;
+    editorSetStatusMessage(
+            "HELP: Ctrl-S save | Ctrl-Q detach | Ctrl-F find | Ctrl-G line | "
+            "Ctrl-Z/Y undo");
+    struct editorBuffer *first = NULL;
+    char *p;
+    for (p = names; p < names + len; p += strlen(p) + 1) {
+        if (*p == '\0') continue;
+        if (editorOpenBuffer(p) == -1) {
+            editorSetStatusMessage("Can't open %.40s: %s", p, strerror(errno));
+            continue;
+        }
+        if (!first) first = E.buf;
+    }
+    if (first) editorShowBuffer(first);
+}
+
+int editorClientDecode() {                                               // {{{2
+    /* act on the next message the client of the active screen sent, keys
+     * go to the input buffer, which is empty before
+     * returns the number of keys, -1 if there is no complete message */
+    struct editorScreen *s = E.screen;
+    uint32_t len;
+    if (s->detach || s->msglen < 5) return -1;
+    memcpy(&len, s->msg + 1, sizeof(len));
+    if ((uint32_t)s->msglen - 5 < len) return -1;
+
+    int type = s->msg[0];
+    char *payload = s->msg + 5;
+    int rows = 0, cols = 0, n = 0;
+    char *names = NULL;
+    if (type == 'k' && len <= sizeof(E.inbuf)) {
+        /* keys before the hello have no screen to go to */
+        if (s->ready) {
+            memcpy(E.inbuf, payload, len);
+            n = len;
+        }
+    } else if ((type == 'h' || type == 'w') && len >= 2 * sizeof(int)) {
+        memcpy(&rows, payload, sizeof(int));
+        memcpy(&cols, payload + sizeof(int), sizeof(int));
+        if (rows < 2 || cols < 1 || rows > 4096 || cols > 4096) {
+            rows = KILO_HEADLESS_ROWS;
+            cols = KILO_HEADLESS_COLS;
+        }
+        if (type == 'h' && !s->ready) {
+            /* copied, opening a file may ask something and decode the
+             * answer while the hello runs */
+            int namelen = len - 2 * sizeof(int);
+            names = kmalloc(namelen + 1);
+            if (names == NULL) die("malloc");
+            memcpy(names, payload + 2 * sizeof(int), namelen);
+            names[namelen] = '\0';
+        }
+    } else {
+        s->detach = 1;
+        return -1;
+    }
+    s->msglen -= 5 + len;
+    memmove(s->msg, s->msg + 5 + len, s->msglen);
+    E.inpos = 0;
+    E.inlen = n;
+
+    if (type == 'w' && s->ready) editorResize(rows, cols);
+    if (names) {
+        editorClientHello(rows, cols, names, len - 2 * sizeof(int));
+        free(names);
+    }
+    return n;
+}
+
+int editorClientFill(int timeout) {                                      // {{{2
+    /* editorFillInput() in daemon mode - keys come in messages from the
+     * client of the active screen, waits at most _timeout_ milliseconds
+     * returns the number of keys, 0 if none arrived */
+    int n;
+    E.inpos = E.inlen = 0;
+    while ((n = editorClientDecode()) == -1) {
+        if (E.screen->detach || !editorWaitInput(timeout)) return 0;
+        editorClientRecv();
+    }
+    return n;
+}
+
+void editorClientInput(int fd) {                                         // {{{2
+    /* event loop callback for a client socket - its keys are processed on
+     * its screen, which is repainted, and so are the other screens, they
+     * may show the same buffers
+     * keys that arrive while another client waits in a prompt wait as well
+     * (pending), until the daemon's event loop takes them */
+    int j;
+    for (j = 0; j < E.numscreens && E.screens[j]->fd != fd; j++);
+    if (j == E.numscreens) return;
+    struct editorScreen *s = E.screens[j];
+    struct editorScreen *home = E.screen;
+    editorUnwatchFd(fd);
+    if (home->fd != -1) {
+        s->pending = 1;
+        return;
+    }
+
+    editorScreenSwitch(s);
+    int keys = 0;
+    while (!s->detach) {
+        if (E.inpos < E.inlen) {
+            editorProcessKeypress();
+            keys = 1;
+            continue;
+        }
+        E.inpos = E.inlen = 0;
+        if (editorClientDecode() != -1) continue;
+        if (!editorClientRecv()) break;
+    }
+    if (!s->detach) editorRefreshScreen();
+    editorScreenSwitch(home);
+
+    if (keys) {
+        for (j = 0; j < E.numscreens; j++)
+            if (E.screens[j] != s) E.screens[j]->redraw = 1;
+    }
+    if (s->detach) editorScreenClose(s);
+    else editorWatchFd(fd, editorClientInput);
+}
+
+void editorClientAccept(int fd) {                                        // {{{2
+    /* event loop callback for the daemon's socket - a client attaches, its
+     * screen shows the first buffer until the hello names files */
+    int c = accept(fd, NULL, NULL);
+    if (c == -1) return;
+    fcntl(c, F_SETFD, FD_CLOEXEC);
+    /* the socket and the pipe of the writer thread */
+    if (E.nwatch + 2 > KILO_MAX_WATCH) {
+        close(c);
+        return;
+    }
+    struct editorScreen *s = editorScreenNew(c);
+    struct editorBuffer *b = E.bufs[0];
+    b->refs++;
+    s->views[0] = b->park;
+    s->views[0].rendlo = s->views[0].rendhi = 0;
+    s->views[0].framerowoff = s->views[0].rowoff;
+    s->views[0].framerowsub = s->views[0].rowsub;
+    s->numviews = 1;
+    editorOutputStart(&s->out, c);
+    editorWatchFd(c, editorClientInput);
+}
+
+int editorSockAddr(const char *path, struct sockaddr_un *addr) {         // {{{2
+    /* fill _addr_ with _path_, -1 if the path is too long for it */
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int editorConnect(const char *path) {                                    // {{{2
+    /* connect to the daemon listening at _path_, returns the socket or -1 */
+    struct sockaddr_un addr;
+    if (editorSockAddr(path, &addr) == -1) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int editorListen(const char *path) {                                     // {{{2
+    /* listen for clients at _path_, a socket left there by a daemon that
+     * is gone is replaced - returns the socket, -1 if it cannot be bound or
+     * another daemon listens there */
+    struct sockaddr_un addr;
+    if (editorSockAddr(path, &addr) == -1) return -1;
+    int fd = editorConnect(path);
+    if (fd != -1) {
+        close(fd);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    unlink(path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            listen(fd, 16) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+char *editorSockPath() {                                                 // {{{2
+    /* the default socket - in the runtime directory of the user, or else in
+     * a directory below /tmp only the user may enter, NULL if that is not
+     * the user's */
+    static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir && *dir) {
+        snprintf(path, sizeof(path), "%s/kilo.sock", dir);
+        return path;
+    }
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "/tmp/kilo-%d", (int)getuid());
+    mkdir(tmp, 0700);
+    struct stat st;
+    if (lstat(tmp, &st) == -1 || !S_ISDIR(st.st_mode) ||
+            st.st_uid != getuid() || (st.st_mode & 077)) return NULL;
+    snprintf(path, sizeof(path), "%s/kilo.sock", tmp);
+    return path;
+}
+
+void editorServe() {                                                     // {{{2
+    /* the daemon's event loop - clients are accepted and their keys are
+     * processed by the callbacks, here the screens are repainted when
+     * something asked for it, background work on the daemon's own screen
+     * (e.g. indexing a file a client shows) repaints all of them */
+    struct editorScreen *home = E.screen;
+    editorWatchFd(E.listenfd, editorClientAccept);
+    while (1) {
+        int j;
+        /* keys that waited for a prompt of another client */
+        for (j = 0; j < E.numscreens; j++) {
+            if (!E.screens[j]->pending) continue;
+            E.screens[j]->pending = 0;
+            editorClientInput(E.screens[j]->fd);
+            j = -1;
+        }
+
+        int all = E.redraw || E.redrawat;
+        E.redraw = 0;
+        E.redrawat = 0;
+        int timeout = -1;
+        for (j = 0; j < E.numscreens; j++) {
+            struct editorScreen *s = E.screens[j];
+            if (s == home || !s->ready) continue;
+            if (all) s->redraw = 1;
+            if (!s->redraw && !s->redrawat) continue;
+            if (!s->redraw) {
+                /* a coalesced repaint, not due yet */
+                int left = (int)((s->redrawat - editorNow()) * 1000) + 1;
+                if (left > 0) {
+                    if (timeout == -1 || left < timeout) timeout = left;
+                    continue;
+                }
+            }
+            editorScreenSwitch(s);
+            E.redraw = 0;
+            E.redrawat = 0;
+            editorRefreshScreen();
+            editorScreenSwitch(home);
+            if (s->redrawat) j--;
+        }
+        editorWaitInput(timeout);
+    }
+}
+
+int editorWriteAll(int fd, const void *buf, size_t len) {                // {{{2
+    /* write all _len_ bytes of _buf_ to _fd_, -1 on error */
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int editorSendMessage(int fd, int type, const char *payload, int len) {  // {{{2
+    /* send one message of the client protocol, -1 on error */
+    char hdr[5];
+    uint32_t n = len;
+    hdr[0] = type;
+    memcpy(hdr + 1, &n, sizeof(n));
+    if (editorWriteAll(fd, hdr, sizeof(hdr)) == -1) return -1;
+    return editorWriteAll(fd, payload, len);
+}
+
+int editorAttach(char *path, char **files, int numfiles, char *argv0) {  // {{{2
+    /* the client - attach to the daemon at _path_, starting one if none
+     * listens there, and show _files_ in the terminal until the daemon
+     * closes the socket (Ctrl-Q detaches) */
+    int fd = editorConnect(path);
+    if (fd == -1) {
+        pid_t pid = fork();
+        if (pid == -1) die("fork");
+        if (pid == 0) {
+            /* the daemon outlives the client and its terminal */
+            setsid();
+            int null = open("/dev/null", O_RDWR);
+            dup2(null, STDIN_FILENO);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            execlp(argv0, argv0, "-d", "-S", path, (char *)NULL);
+            _exit(1);
+        }
+        int waited;
+        for (waited = 0; fd == -1 && waited < KILO_ATTACH_MS; waited += 10) {
+            usleep(10000);
+            fd = editorConnect(path);
+        }
+        if (fd == -1) die("connect");
     }
+
+    enableRawMode();
+    int size[2];
+    if (getWindowSize(&size[0], &size[1]) == -1) die("getWindowSize");
+
+    /* the daemon has another working directory, names go as absolute
+     * paths */
+    struct abuf hello = ABUF_INIT;
+    abAppend(&hello, (char *)size, sizeof(size));
+    int j;
+    for (j = 0; j < numfiles; j++) {
+        char *name = realpath(files[j], NULL);
+        if (name == NULL) {
+            char cwd[PATH_MAX];
+            if (getcwd(cwd, sizeof(cwd)) == NULL) die("getcwd");
+            abAppend(&hello, cwd, strlen(cwd));
+            abAppend(&hello, "/", 1);
+            abAppend(&hello, files[j], strlen(files[j]) + 1);
+            continue;
+        }
+        abAppend(&hello, name, strlen(name) + 1);
+        free(name);
+    }
+    if (editorSendMessage(fd, 'h', hello.b, hello.len) == -1)
+        die("kilo daemon");
+    abFree(&hello);
+
+    /* resizes come through the SIGWINCH self-pipe like in the editor */
+    if (pipe(E.winchpipe) == -1) die("pipe");
+    fcntl(E.winchpipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(E.winchpipe[1], F_SETFL, O_NONBLOCK);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleSigWinch;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGWINCH, &sa, NULL) == -1) die("sigaction");
+
+    struct pollfd pfd[3] = {
+        {STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}, {E.winchpipe[0], POLLIN, 0}
+    };
+    char buf[KILO_INBUF_SIZE];
+    while (1) {
+        if (poll(pfd, 3, -1) == -1) {
+            if (errno == EINTR) continue;
+            die("poll");
+        }
+        if (pfd[1].revents) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) break;
+            if (editorWriteAll(STDOUT_FILENO, buf, n) == -1) break;
+        }
+        if (pfd[0].revents) {
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n <= 0 || editorSendMessage(fd, 'k', buf, n) == -1) break;
+        }
+        if (pfd[2].revents) {
+            while (read(E.winchpipe[0], buf, sizeof(buf)) > 0);
+            if (getWindowSize(&size[0], &size[1]) == 0 &&
+                    editorSendMessage(fd, 'w', (char *)size,
+                        sizeof(size)) == -1) break;
+        }
+    }
+    /* clear the screen and reposition the cursor at the start of screen */
+    write(STDOUT_FILENO, "\x1b[2J", 4);
+    write(STDOUT_FILENO, "\x1b[H", 3);
+    return 0;
 }
 
-void editorDrawRows(struct abuf *ab) {                                   // {{{2
-    /* write tildes at the beginning of each line */
-    int y;
-    for (y = 0; y < E.screenrows; y++) {
-        /* actual file row */
-        int filerow = y + E.rowoff;
-        /* check wheter we are drawing a row that is part of the text buffer
-         * or a row that comes after */
-        if (filerow >= E.numrows) {
-            /* display the welcome message only if no file was supplied */
-            if (E.numrows == 0 && y == E.screenrows / 3) {
-                char welcome[80];
-                /* snpfintf() form <stdio.h>, used to interpolate kilo version
-                 * into the welcome message */
-                int welcomelen = snprintf(welcome, sizeof(welcome),
-                        "Kilo editor -- version %s", KILO_VERSION);
-                /* truncate the welcome message if it does not fit to screen */
-                if (welcomelen > E.screencols) welcomelen = E.screencols;
-                /* center the welcome message */
-                int padding = (E.screencols - welcomelen) / 2;
-                if (padding) {
-                    abAppend(ab, "~", 1);
-                    padding--;
-                }
-                /* fill the space up to string with space characters */
-                while (padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
-            } else {
-                /* print tildes on each row of screen */
-               abAppend(ab, "~", 1);
-            }
+// init ------------------------------------------------------------------- {{{1
+
+void handleSigWinch(int sig) {                                           // {{{2
+    /* signal handler, only async-signal-safe work here */
+    (void)sig;
+    int saved = errno;
+    write(E.winchpipe[1], "w", 1);
+    errno = saved;
+}
+
+void initEditor() {                                                      // {{{2
+    /* initialise the cursor position to the top left of screen */
+    E.cx = 0;
+    E.cy = 0;
+    E.rx = 0;
+    /* initialise row offset to 0 - scrolled to the top as default */
+    E.rowoff = 0;
+    /* initialise column offset to 0 - scrolled to the left as default */
+    E.coloff = 0;
+    E.rowsub = 0;
+    E.ry = 0;
+    /* nothing rendered yet */
+    E.rendlo = 0;
+    E.rendhi = 0;
+    /* no message yet */
+    E.statusmsg[0] = '\0';
+    E.statusmsg_time = 0;
+    E.undolimit = KILO_UNDO_LIMIT;
+
+    /* nothing is watched by the event loop yet */
+    E.nwatch = 0;
+    E.redraw = 0;
+    E.lastframe = 0;
+    E.redrawat = 0;
+    E.frametime = 1.0 / KILO_MAX_FPS;
+    E.framewait = 0;
+
+    /* in headless mode the screen size is given on the command line, the
+     * daemon has no terminal of its own */
+    if (!E.headless && !E.daemon &&
+            getWindowSize(&E.screenlines, &E.screencols) == -1)
+        die("getWindowSize");
+
+    /* the terminal contents are unknown before the first frame */
+    E.linehash = kcalloc(E.screenlines, sizeof(uint64_t));
+    E.framevalid = 0;
+    E.framerowoff = 0;
+    E.framerowsub = 0;
+    E.termattr = ATTR_DEFAULT;
+
+    /* one view over the whole screen, showing an empty buffer - the view
+     * holds a reference to it besides the buffer list */
+    E.screen = editorScreenNew(-1);
+    E.views = E.screen->views;
+    E.numviews = 1;
+    E.view = &E.views[0];
+    E.screenrows = E.screenlines - 1;
+    E.views[0].buf = editorBufferNew();
+    E.views[0].buf->refs++;
+    E.views[0].screenrows = E.screenrows;
+    E.views[0].wrap = E.wrap;
+    editorViewLoad(&E.views[0]);
+    editorLayout();
+    /* input buffer is empty */
+    E.inpos = 0;
+    E.inlen = 0;
+    if (E.headless || E.daemon) return;
+
+    /* resize support - the SIGWINCH handler only writes to a pipe, the
+     * event loop picks that up and calls editorHandleResize() */
+    if (pipe(E.winchpipe) == -1) die("pipe");
+    fcntl(E.winchpipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(E.winchpipe[1], F_SETFL, O_NONBLOCK);
+    editorWatchFd(E.winchpipe[0], editorHandleResize);
+
+    /* frames are written by a thread, a slow terminal delays the next one
+     * instead of the keys (editorFrameDue()) */
+    editorOutputStart(&E.screen->out, STDOUT_FILENO);
+
+    /* sigaction() from <signal.h> */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleSigWinch;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGWINCH, &sa, NULL) == -1) die("sigaction");
+}
+
+void initHeadless(int rows, int cols) {                                   // {{{2
+    /* set up the editor without a terminal, the screen is rows x cols
+     * including the status bar */
+    E.headless = 1;
+    E.screenlines = rows;
+    E.screencols = cols;
+    initEditor();
+}
+
+void initDaemon() {                                                      // {{{2
+    /* set up the editor as a daemon - its own screen is never drawn, the
+     * screens of the clients get their size from them */
+    E.daemon = 1;
+    E.infd = -1;
+    E.screenlines = KILO_HEADLESS_ROWS;
+    E.screencols = KILO_HEADLESS_COLS;
+    initEditor();
+    /* a client that went away must not end the daemon with SIGPIPE */
+    signal(SIGPIPE, SIG_IGN);
+}
+
+#ifdef KILO_BENCH
+// benchmark -------------------------------------------------------------- {{{1
+
+/* benchmarks, built instead of the editor with -DKILO_BENCH (make bench),
+ * they compare the byte scanning kernels with the plain loops and time the
+ * editor core running headless on synthetic files */
+
+/* number of pages scrolled and full frames drawn per synthetic file */
+#define KILO_BENCH_PAGES 1000
+#define KILO_BENCH_FRAMES 200
+/* lines of the synthetic C file highlighting is timed on and keys typed
+ * into it */
+#define KILO_BENCH_C_LINES 200000
+#define KILO_BENCH_KEYS 200
+/* lines pasted into the middle of each synthetic file, then undone and
+ * redone */
+#define KILO_BENCH_PASTE_LINES 10000
+/* jumps to random lines of the synthetic gzip file */
+#define KILO_BENCH_JUMPS 100
+
+void benchUpdateRowLoop(erow *row) {                                     // {{{2
+    /* the byte by byte renderer editorUpdateRow() used before the kernels,
+     * kept as the baseline */
+    int tabs = 0;
+    int j;
+    for (j = 0; j < row->size; j++)
+        if (row->chars[j] == '\t') tabs++;
+
+    free(row->render);
+    row->render = kmalloc(row->size + tabs * (KILO_TAB_STOP - 1) + 1);
+
+    int idx = 0;
+    for (j = 0; j < row->size; j++) {
+        if (row->chars[j] == '\t') {
+            row->render[idx++] = ' ';
+            while (idx % KILO_TAB_STOP != 0) row->render[idx++] = ' ';
         } else {
-            int len = E.row[filerow].rsize - E.coloff;
-            /* in case the user scrolled horzontally past the end of line
-             * in that case set len to 0 so that nothing is displayed */
-            if (len < 0) len = 0;
-            /* truncate the rendered line if it goes beyond the screen */
-            if (len > E.screencols) len = E.screencols;
-            /* simply write out the chars fields of the erow */
-            /* use E.coloff as an index to the character display */
-            abAppend(ab, &E.row[filerow].render[E.coloff], len);
+            row->render[idx++] = row->chars[j];
         }
+    }
+    row->render[idx] = '\0';
+    row->rsize = idx;
+}
 
-        /* clear line before repainting
-         * [0K = clear line from cursor right (default)
-         * [1K = clear line up to cursor
-         * [2K = clear whole line */
-        abAppend(ab, "\x1b[K", 3);
-        /* do not print carriage return on last line of screen */
-        if (y < E.screenrows - 1) {
-            abAppend(ab, "\r\n", 2);
-        }
+int benchScanLoop(const char *s, size_t n) {                             // {{{2
+    /* the byte by byte newline scan, counts lines as a result */
+    int lines = 0;
+    size_t j;
+    for (j = 0; j < n; j++)
+        if (s[j] == '\n') lines++;
+    return lines;
+}
+
+int benchScanKernel(const char *s, size_t n) {                           // {{{2
+    /* newline scan the way editorOpenMapped() does it */
+    int lines = 0;
+    const char *p = s;
+    const char *end = s + n;
+    while (p < end) {
+        const char *nl = scanFindByte(p, end - p, '\n');
+        if (!nl) break;
+        lines++;
+        p = nl + 1;
     }
+    return lines;
 }
 
-void editorRefreshScreen() {                                             // {{{2
-    /* call scrolling function before each refresh */
-    editorScroll();
+char *benchMakeText(size_t n, int every, char sep) {                     // {{{2
+    /* n bytes of printable text with _sep_ after every _every_ bytes */
+    char *s = kmalloc(n);
+    size_t j;
+    for (j = 0; j < n; j++)
+        s[j] = (j % every == (size_t)every - 1) ? sep : (char)('a' + j % 26);
+    return s;
+}
 
-    /* initialise buffer ab */
-    struct abuf ab = ABUF_INIT;
-    /* escape sequence to hide the cursor */
-    abAppend(&ab, "\x1b[?25l", 6);
-    /* from <unistd.h>, write 4 bytes to standard output
-     * \x1b is an escape character (27, <esc>), the other 3 bytes are [2J
-     * control characters:
-     * [0J = clear screen from cursor down
-     * [1J = clear screen up to cursor
-     * [2J = clear whole screen */
-    /* escape sequence 3 bytes long
-     * control characters for positioning the cursor:
-     * [12;40H - positions the cursor to the middle of screen on 80x24 terminal
-     * [row;columnH, the indexes are 1 based, default is [1;1H = [H */
-    /* append to buffer */
-    abAppend(&ab, "\x1b[H", 3);
+void benchReport(const char *what, const char *impl, size_t bytes,
+        double secs) {                                                   // {{{2
+    printf("%-28s %-8s %9.1f MB/s\n", what, impl, bytes / secs / 1e6);
+}
 
-    editorDrawRows(&ab);
+/* kernel implementations to compare, filled by benchKernels() */
+struct benchImpl {
+    const char *name;
+    const char *(*find)(const char *s, size_t n, int c);
+    size_t (*count)(const char *s, size_t n, int c);
+    const char *(*findstr)(const char *s, size_t n, const char *q, size_t m);
+} benchImpls[4];
+int benchNumImpls = 0;
 
-    /* position the cursor */
-    char buf[32];
-    /* use snprintf() to inject cursor position into string in buf variable */
-    /* subtract __rowoff__ from __cy__ to get correct behavior when scrollup */
-    /* subtract __coloff__ from __cx__ to get correct behavior when scrolling */
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1,
-                                              (E.cx - E.coloff) + 1);
-    /* strlen() is form <string.h> */
-    abAppend(&ab, buf, strlen(buf));
+void benchAddImpl(const char *name,
+        const char *(*find)(const char *s, size_t n, int c),
+        size_t (*count)(const char *s, size_t n, int c),
+        const char *(*findstr)(const char *s, size_t n, const char *q,
+            size_t m)) {                                                 // {{{2
+    benchImpls[benchNumImpls].name = name;
+    benchImpls[benchNumImpls].find = find;
+    benchImpls[benchNumImpls].count = count;
+    benchImpls[benchNumImpls].findstr = findstr;
+    benchNumImpls++;
+}
 
-    /* escape sequence to show the cursor */
-    abAppend(&ab, "\x1b[?25h", 6);
+void benchUseImpl(int i) {                                               // {{{2
+    scanFindByte = benchImpls[i].find;
+    scanCountByte = benchImpls[i].count;
+    scanFindString = benchImpls[i].findstr;
+}
 
-    /* write the buffer contents to standard output */
-    write(STDOUT_FILENO, ab.b, ab.len);
-    /* free the buffer memory */
-    abFree(&ab);
+void benchRender(const char *what, char *text, size_t n, int reps) {     // {{{2
+    /* time rendering one long row with the old loop and every kernel */
+    erow row;
+    memset(&row, 0, sizeof(row));
+    row.chars = text;
+    row.size = n;
+    row.render = NULL;
+    int j;
+
+    double t = editorNow();
+    for (j = 0; j < reps; j++) benchUpdateRowLoop(&row);
+    benchReport(what, "loop", n * reps, editorNow() - t);
+    int rsize = row.rsize;
+
+    int i;
+    for (i = 0; i < benchNumImpls; i++) {
+        benchUseImpl(i);
+        t = editorNow();
+        for (j = 0; j < reps; j++) editorUpdateRow(&row);
+        benchReport(what, benchImpls[i].name, n * reps, editorNow() - t);
+        if (row.rsize != rsize) printf("  render size mismatch!\n");
+    }
+    editorFreeRender(&row);
 }
 
-// input ------------------------------------------------------------------ {{{1
+void benchScan(const char *what, char *text, size_t n, int reps) {       // {{{2
+    /* time the newline scan with the old loop and every kernel */
+    int lines = 0;
+    int j;
 
-void editorMoveCursor(int key) {                                         // {{{2
-    /* check if the cursor is on the actual line. if so, the row will point
-     * to the erow the cursor is on */
-    erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    double t = editorNow();
+    for (j = 0; j < reps; j++) lines = benchScanLoop(text, n);
+    benchReport(what, "loop", n * reps, editorNow() - t);
 
-    /* use arrows for movement */
-    switch (key) {
-        case ARROW_UP:
-            if (E.cy != 0) {
-                E.cy--;
-            }
-            break;
-        case ARROW_DOWN:
-            /* allow cursor to advance past the bottom of the screen */
-            if (E.cy < E.numrows) {
-                E.cy++;
-            }
-            break;
-        case ARROW_RIGHT:
-            /* allow user to scroll past the right edge of the screen */
-            /* while limiting the movement to the length of the line + 1 */
-            if (row && E.cx < row->size) {
-                E.cx++;
-            /* left arrow at the end of line goes to the start of next line */
-            } else if (row && E.cx == row->size) {
-                E.cy++;
-                E.cx = 0;
-            }
-            break;
-        case ARROW_LEFT:
-            if (E.cx != 0) {
-                E.cx--;
-            /* allow user to move to the end of line above if at the beginning
-             * of a line
-             * make sure we are not at the first line */
-            } else if (E.cy > 0) {
-                E.cy--;
-                E.cx = E.row[E.cy].size;
-            }
-            break;
+    int i;
+    for (i = 0; i < benchNumImpls; i++) {
+        benchUseImpl(i);
+        t = editorNow();
+        for (j = 0; j < reps; j++)
+            if (benchScanKernel(text, n) != lines) printf("  count mismatch!\n");
+        benchReport(what, benchImpls[i].name, n * reps, editorNow() - t);
     }
+}
 
-    /* fix vertical movement - snap to the length of line
-     * set row again as E.cy will be pointing to a different line */
-    row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
-    /* get length of row the cursor is on, consider NULL line to be of 0 length */
-    int rowlen = row ? row->size : 0;
-    /* if the cursor is to the right of the line end, set it to the end
-     * of the current line */
-    if (E.cx > rowlen) {
-        E.cx = rowlen;
+void benchFind(const char *what, char *text, size_t n, int reps) {       // {{{2
+    /* time a search that does not match, the text is ascending letters so
+     * the query's first byte is frequent but never followed by the rest */
+    int j;
+    int i;
+    for (i = 0; i < benchNumImpls; i++) {
+        benchUseImpl(i);
+        double t = editorNow();
+        for (j = 0; j < reps; j++)
+            if (scanFindString(text, n, "zyxw", 4)) printf("  false match!\n");
+        benchReport(what, benchImpls[i].name, n * reps, editorNow() - t);
     }
 }
 
-void editorProcessKeypress() {                                           // {{{2
-    /* wait for keypress and handle it */
-    int c = editorReadKey();
+void benchKernels() {                                                    // {{{2
+    size_t longline = 1 << 20;
+    size_t filesize = 64 << 20;
+    char *tabbed = benchMakeText(longline, 24, '\t');
+    char *untabbed = benchMakeText(longline, longline + 1, '\t');
+    char *shortlines = benchMakeText(filesize, 80, '\n');
+    char *longlines = benchMakeText(filesize, 4096, '\n');
 
-    switch (c) {
-        /* check whether pressed key = 'q' with bits 5-7 stripped off */
-        case CTRL_KEY('q'):
-            /* clear the screen and reposition the cursor at the start of screen */
-            write(STDOUT_FILENO, "\x1b[2J", 4);
-            write(STDOUT_FILENO, "\x1b[H", 3);
-            exit(0);
-            break;
+    printf("byte scanning kernels in use: %s\n", scanInit());
+    benchAddImpl("scalar", scanFindByteScalar, scanCountByteScalar,
+            scanFindStringScalar);
+#if defined(KILO_SIMD_X86)
+    if (__builtin_cpu_supports("sse2"))
+        benchAddImpl("sse2", scanFindByteSse2, scanCountByteSse2,
+                scanFindStringSse2);
+    if (__builtin_cpu_supports("avx2"))
+        benchAddImpl("avx2", scanFindByteAvx2, scanCountByteAvx2,
+                scanFindStringAvx2);
+#elif defined(KILO_SIMD_NEON)
+    benchAddImpl("neon", scanFindByteNeon, scanCountByteNeon,
+            scanFindStringNeon);
+#endif
 
-        /* check for movement keys */
-        case HOME_KEY:
-            /* set cursor to the beginning of line */
-            E.cx = 0;
-            break;
-        case END_KEY:
-            /* set cursor to the end of line */
-            E.cx = E.screencols - 1;
-            break;
+    benchRender("render 1 MB line, tabs", tabbed, longline, 100);
+    benchRender("render 1 MB line, no tabs", untabbed, longline, 100);
+    benchScan("scan 64 MB, 80 B lines", shortlines, filesize, 4);
+    benchScan("scan 64 MB, 4 KB lines", longlines, filesize, 4);
+    benchFind("find miss 64 MB, 80 B lines", shortlines, filesize, 4);
 
-        case PAGE_UP:
-        case PAGE_DOWN:
-            /* block of code in braces to declare the times variable
-             * the up and down arrow keys are simulated to move to the bottom
-             * or top of the screen
-             * this way of implementation is for further use with scrolling */
-            {
-                int times = E.screenrows;
-                while (times--)
-                    editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-            }
-            break;
+    free(tabbed);
+    free(untabbed);
+    free(shortlines);
+    free(longlines);
+    scanInit();
+}
 
-        case ARROW_UP:
-        case ARROW_DOWN:
-        case ARROW_RIGHT:
-        case ARROW_LEFT:
-            editorMoveCursor(c);
-            break;
+size_t benchParseSize(const char *s) {                                   // {{{2
+    /* parse a size like 64M or 4G */
+    char *end;
+    size_t n = strtoull(s, &end, 10);
+    switch (*end) {
+        case 'G': case 'g': n <<= 10; /* fall through */
+        case 'M': case 'm': n <<= 10; /* fall through */
+        case 'K': case 'k': n <<= 10;
     }
+    return n;
 }
 
-// init ------------------------------------------------------------------- {{{1
+int benchMakeFile(const char *path, size_t size, int linelen,
+        int tabs) {                                                      // {{{2
+    /* write a synthetic file of _size_ bytes to _path_, lines are _linelen_
+     * bytes long and, if _tabs_ is set, every fourth byte is a tab */
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
 
-void initEditor() {                                                      // {{{2
-    /* initialise the cursor position to the top left of screen */
+    /* the file is written in 1 MB chunks that consist of whole lines */
+    size_t chunk = (1 << 20) / linelen * linelen;
+    if (chunk == 0) chunk = linelen;
+    char *buf = kmalloc(chunk);
+    size_t j;
+    for (j = 0; j < chunk; j++) {
+        int col = j % linelen;
+        if (col == linelen - 1) buf[j] = '\n';
+        else if (tabs && col % 4 == 3) buf[j] = '\t';
+        else buf[j] = 'a' + (j / linelen + col) % 26;
+    }
+
+    size_t written = 0;
+    while (written < size) {
+        size_t n = size - written < chunk ? size - written : chunk;
+        if (fwrite(buf, 1, n, fp) != n) break;
+        written += n;
+    }
+    free(buf);
+    fclose(fp);
+    return written == size ? 0 : -1;
+}
+
+size_t benchFrame() {                                                    // {{{2
+    /* render one frame headless, returns the bytes it produced */
+    editorRefreshScreen();
+    size_t bytes = headlessout.len;
+    abReset(&headlessout);
+    return bytes;
+}
+
+void benchEditor(size_t size, const char *kind, int linelen, int tabs) { // {{{2
+    /* time opening the file, scrolling through it page by page and drawing
+     * full frames */
+    char path[256];
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/kilo-bench-%zu-%s.txt",
+            dir ? dir : "/tmp", size, kind);
+    if (benchMakeFile(path, size, linelen, tabs) == -1) {
+        printf("%s: cannot create benchmark file\n", path);
+        unlink(path);
+        return;
+    }
+
+    char what[64];
+    snprintf(what, sizeof(what), "%zuM %s", size >> 20, kind);
+
+    double t = editorNow();
+    editorOpen(path);
+    double open = editorNow() - t;
+
+    /* scroll through up to KILO_BENCH_PAGES pages */
+    int pages = 0;
+    size_t scrollbytes = 0;
+    t = editorNow();
+    while (pages < KILO_BENCH_PAGES && E.cy < E.buf->numrows) {
+        editorProcessKey(PAGE_DOWN);
+        scrollbytes += benchFrame();
+        pages++;
+    }
+    double scroll = editorNow() - t;
+
+    /* full frames, the shadow frame is invalidated before each one */
+    int frames = KILO_BENCH_FRAMES;
+    size_t framebytes = 0;
+    int j;
+    t = editorNow();
+    for (j = 0; j < frames; j++) {
+        E.framevalid = 0;
+        framebytes += benchFrame();
+    }
+    double frame = editorNow() - t;
+
+    /* a whole-file pass over the line tables */
+    t = editorNow();
+    editorMaxLineWidth();
+    double widest = editorNow() - t;
+
+    /* searching the whole file for something that is not there */
+    struct searchQuery q = {"zyxw", 4, NULL, NULL};
+    int row, col, len;
+    t = editorNow();
+    if (editorFindForward(&q, 0, 0, E.buf->numrows, &row, &col, &len) == 0)
+        printf("  false match!\n");
+    double search = editorNow() - t;
+
+    /* the same with a regex without a literal prefix, all of it goes
+     * through the DFA */
+    const char *error;
+    struct searchQuery rq = {"[xz]y\\d+w", 9, NULL, NULL};
+    rq.re = editorRegexGet(rq.str, &error);
+    rq.m = regexMatcher(rq.re, 0);
+    t = editorNow();
+    if (editorFindForward(&rq, 0, 0, E.buf->numrows, &row, &col, &len) == 0)
+        printf("  false match!\n");
+    double regex = editorNow() - t;
+
+    /* counting the matches on all cores */
+    t = editorNow();
+    editorFindAllStart(&q);
+    editorFindAllWait();
+    double count = editorNow() - t;
+    editorFindAllStop();
+
+    /* saving after a few lines at the top, in the middle and at the end
+     * were changed */
+    for (j = 0; j < 3; j++) {
+        E.cy = (E.buf->numrows - 1) / 2 * j;
+        E.cx = 0;
+        editorInsertChar('x');
+    }
+    t = editorNow();
+    editorSave();
+    double save = editorNow() - t;
+
+    /* pasting lines into the middle key by key, undoing all of it and
+     * redoing it again */
+    const char *line = "the quick brown fox jumps over the lazy dog\r";
+    int nkeys = KILO_BENCH_PASTE_LINES * strlen(line);
+    E.cy = E.buf->numrows / 2;
     E.cx = 0;
+    t = editorNow();
+    for (j = 0; j < nkeys; j++)
+        editorProcessKey(line[j % strlen(line)]);
+    double paste = editorNow() - t;
+    t = editorNow();
+    while (E.buf->undo.cur) editorUndo();
+    double undo = editorNow() - t;
+    t = editorNow();
+    struct undochunk *chunk = NULL;
+    int off = 0;
+    while (editorUndoNext(&chunk, &off)) {
+        editorRedo();
+        chunk = E.buf->undo.cur;
+        off = E.buf->undo.curoff;
+    }
+    double redo = editorNow() - t;
+
+    printf("%-16s open %8.1f ms %8.1f MB/s %9d rows | "
+           "page %7.1f us %6zu B | frame %7.1f us %6zu B | widest %7.1f ms | "
+           "search miss %8.1f MB/s | regex miss %8.1f MB/s | "
+           "count %8.1f MB/s | save %8.1f MB/s | "
+           "paste %5.2f us/key undo %7.1f ms redo %7.1f ms\n",
+            what, open * 1e3, size / open / 1e6, E.buf->numrows,
+            pages ? scroll / pages * 1e6 : 0.0, pages ? scrollbytes / pages : 0,
+            frame / frames * 1e6, framebytes / frames, widest * 1e3,
+            size / search / 1e6, size / regex / 1e6, size / count / 1e6,
+            size / save / 1e6, paste / nkeys * 1e6, undo * 1e3, redo * 1e3);
+
+    editorClose();
+    unlink(path);
+}
+
+void benchWrap(size_t size, int wide) {                                 // {{{2
+    /* time soft wrap mode on a file that is a single line of _size_ bytes,
+     * ASCII or with a wide character in every 16 bytes - the first frame,
+     * paging down through it and jumping to the end of the line */
+    char path[256];
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/kilo-bench-%zu-wrap.txt",
+            dir ? dir : "/tmp", size);
+    FILE *fp = fopen(path, "w");
+    if (!fp) return;
+    char piece[16];
+    int j;
+    for (j = 0; j < 16; j++) piece[j] = 'a' + j;
+    /* U+4E2D, 3 bytes and 2 columns */
+    if (wide) memcpy(piece + 8, "\xe4\xb8\xad", 3);
+    size_t n;
+    for (n = 0; n + 16 <= size; n += 16) fwrite(piece, 1, 16, fp);
+    fputc('\n', fp);
+    fclose(fp);
+
+    editorOpen(path);
+    editorLoadWait(-1);
+    E.wrap = 1;
+    E.cy = E.cx = 0;
+    double t = editorNow();
+    benchFrame();
+    double first = editorNow() - t;
+
+    int pages;
+    t = editorNow();
+    for (pages = 0; pages < KILO_BENCH_PAGES; pages++) {
+        editorProcessKey(PAGE_DOWN);
+        benchFrame();
+    }
+    double page = (editorNow() - t) / pages;
+
+    t = editorNow();
+    E.cx = editorRowAt(0)->size;
+    benchFrame();
+    double end = editorNow() - t;
+    E.wrap = 0;
+
+    char what[64];
+    snprintf(what, sizeof(what), "%zuM line %s", size >> 20,
+            wide ? "utf8" : "ascii");
+    printf("%-16s wrap first frame %8.1f ms | page %7.1f us | "
+           "to end %7.1f us\n", what, first * 1e3, page * 1e6, end * 1e6);
+
+    editorClose();
+    unlink(path);
+}
+
+void benchGzip(size_t size) {                                            // {{{2
+    /* time the index pass over a gzip file of _size_ bytes of text, jumps
+     * to random lines (mostly inflating a span each) and a search through
+     * all of it, and how many spans stay inflated */
+    char path[256], gzpath[260];
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/kilo-bench-%zu-gz.txt",
+            dir ? dir : "/tmp", size);
+    snprintf(gzpath, sizeof(gzpath), "%s.gz", path);
+    FILE *fp = NULL;
+    gzFile gzf = NULL;
+    if (benchMakeFile(path, size, 80, 0) == 0 &&
+            (fp = fopen(path, "r")) != NULL &&
+            (gzf = gzopen(gzpath, "wb6")) != NULL) {
+        char buf[1 << 16];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) gzwrite(gzf, buf, n);
+    }
+    if (fp) fclose(fp);
+    unlink(path);
+    if (gzf == NULL || gzclose(gzf) != Z_OK) {
+        printf("%s: cannot create benchmark file\n", gzpath);
+        unlink(gzpath);
+        return;
+    }
+    struct stat st;
+    stat(gzpath, &st);
+
+    double t = editorNow();
+    editorOpen(gzpath);
+    double open = editorNow() - t;
+
+    srand(1);
+    int j;
+    t = editorNow();
+    for (j = 0; j < KILO_BENCH_JUMPS; j++) {
+        E.cy = (long long)rand() * E.buf->numrows / RAND_MAX;
+        E.cx = 0;
+        benchFrame();
+    }
+    double jump = (editorNow() - t) / KILO_BENCH_JUMPS;
+
+    struct searchQuery q = {"zyxw", 4, NULL, NULL};
+    int row, col, len;
+    t = editorNow();
+    if (editorFindForward(&q, 0, 0, E.buf->numrows, &row, &col, &len) == 0)
+        printf("  false match!\n");
+    double search = editorNow() - t;
+
+    char what[64];
+    snprintf(what, sizeof(what), "%zuM gzip", size >> 20);
+    printf("%-16s open %8.1f ms %8.1f MB/s (%.1fx) | jump %7.1f ms | "
+           "search miss %7.1f MB/s | %d of %d spans inflated\n",
+            what, open * 1e3, size / open / 1e6, (double)size / st.st_size,
+            jump * 1e3, size / search / 1e6, E.buf->gz->resident,
+            E.buf->gz->numspans);
+
+    editorClose();
+    unlink(gzpath);
+}
+
+double benchKeys(const char *keys, int n) {                              // {{{2
+    /* type _n_ keys cycling through _keys_ at the cursor, drawing a frame
+     * after each one like the editor does, returns the seconds per key */
+    double t = editorNow();
+    int j;
+    for (j = 0; j < n; j++) {
+        editorProcessKey(keys[j % strlen(keys)]);
+        benchFrame();
+    }
+    return (editorNow() - t) / n;
+}
+
+void benchSyntax(int lines) {                                            // {{{2
+    /* time highlighting a C file of _lines_ lines - the first frame, a
+     * jump to the end (lexes the whole file once) and typing at the top of
+     * the file, with keys that do and do not change the state the rows
+     * below start in */
+    char path[256];
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/kilo-bench-%d.c", dir ? dir : "/tmp",
+            lines);
+    FILE *fp = fopen(path, "w");
+    if (!fp) return;
+    int j;
+    for (j = 0; j < lines; j++) {
+        switch (j % 8) {
+        case 0: fprintf(fp, "/* block comment %d\n", j); break;
+        case 1: fprintf(fp, " * spanning two lines */\n"); break;
+        case 2: fprintf(fp, "static int f%d(char *s, unsigned n) {\n", j); break;
+        case 3: fprintf(fp, "\tif (n > %d) return -1; // comment\n", j); break;
+        case 4: fprintf(fp, "\treturn strcmp(s, \"str\\\"%d\") + 'x';\n", j); break;
+        case 5: fprintf(fp, "}\n"); break;
+        default: fprintf(fp, "\n"); break;
+        }
+    }
+    fclose(fp);
+
+    double t = editorNow();
+    editorOpen(path);
+    editorLoadWait(-1);
+    benchFrame();
+    double first = editorNow() - t;
+
+    /* bytes of a full frame with and without colors */
+    E.framevalid = 0;
+    size_t colored = benchFrame();
+    struct editorSyntax *syntax = E.buf->syntax;
+    E.buf->syntax = NULL;
+    E.framevalid = 0;
+    size_t plainbytes = benchFrame();
+    E.buf->syntax = syntax;
+    E.framevalid = 0;
+    benchFrame();
+
+    t = editorNow();
+    E.cy = E.buf->numrows - 1;
+    benchFrame();
+    double sync = editorNow() - t;
+
+    /* typing at the top - letters, then opening and closing a comment
+     * that changes the state of every row below */
     E.cy = 0;
-    /* initialise row offset to 0 - scrolled to the top as default */
-    E.rowoff = 0;
-    /* initialise column offset to 0 - scrolled to the left as default */
-    E.coloff = 0;
-    /* initialise number of rows as 0 */
-    E.numrows = 0;
-    /* initialize E.row pointer to be NULL */
-    E.row = NULL;
+    E.cx = 0;
+    benchFrame();
+    double plain = benchKeys("abc", KILO_BENCH_KEYS);
+    double comment = benchKeys("/*\x7f", KILO_BENCH_KEYS);
+
+    char what[64];
+    snprintf(what, sizeof(what), "%dk lines c", lines / 1000);
+    printf("%-16s first frame %7.1f ms | frame %6zu B (%.2fx plain) | "
+           "to end %7.1f ms %8.1f MB/s | key %7.1f us | comment key %7.1f us\n",
+            what, first * 1e3, colored, (double)colored / plainbytes, sync * 1e3, E.buf->maplen / sync / 1e6,
+            plain * 1e6, comment * 1e6);
+
+    editorClose();
+    unlink(path);
+}
 
-    if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
+void benchBlockedOutput() {                                              // {{{2
+    /* a terminal that takes none of the output - while a frame is stuck the
+     * editor has to sleep until the writer thread reports it gone, not wake
+     * up again and again for the frame it holds back */
+    int fds[2];
+    if (pipe(fds) == -1) die("pipe");
+    E.headless = 0;
+    editorOutputStart(&E.screen->out, fds[1]);
+    /* more than the pipe holds, the writer blocks */
+    size_t len = 1 << 20;
+    char *junk = kmalloc(len);
+    if (junk == NULL) die("malloc");
+    memset(junk, 'x', len);
+    editorOutput(junk, len);
+    free(junk);
+
+    /* a repaint asked for right after a frame, so that it is coalesced,
+     * then the event loop of editorReadKey() for a while */
+    double waitfor = 0.2;
+    E.lastframe = editorNow();
+    editorRequestRedraw();
+    int wakeups = 0;
+    clock_t cpu = clock();
+    double t = editorNow();
+    double left;
+    while ((left = t + waitfor - editorNow()) > 0) {
+        int timeout = editorRedrawTimeout();
+        if (timeout == -1 || timeout > left * 1000) timeout = left * 1000 + 1;
+        struct pollfd pfd = {E.screen->out.notify[0], POLLIN, 0};
+        poll(&pfd, 1, timeout);
+        wakeups++;
+        if (pfd.revents & POLLIN) editorOutputDone(pfd.fd);
+        if (E.redraw) editorRefreshScreen();
+    }
+    double busy = (double)(clock() - cpu) / CLOCKS_PER_SEC;
+    printf("blocked output   %5d wakeups %6.1f ms cpu in %.0f ms\n",
+            wakeups, busy * 1e3, waitfor * 1e3);
+    if (busy > waitfor / 10) printf("  busy wait!\n");
+
+    /* let the writer finish, the frame held back is asked for then */
+    char buf[65536];
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    while (!E.redraw) {
+        struct pollfd pfd[2] = {{fds[0], POLLIN, 0},
+                                {E.screen->out.notify[0], POLLIN, 0}};
+        if (poll(pfd, 2, 1000) <= 0) break;
+        while (read(fds[0], buf, sizeof(buf)) > 0);
+        if (pfd[1].revents & POLLIN) editorOutputDone(pfd[1].fd);
+    }
+    if (!E.redraw) printf("  frame lost!\n");
+    E.redraw = 0;
+    editorOutputStop(&E.screen->out);
+    close(fds[0]);
+    close(fds[1]);
+    E.headless = 1;
 }
 
 int main(int argc, char *argv[]) {                                       // {{{2
-    /* simplified the main() function */
-    enableRawMode();
-    /* initialize all the fields inf the E struct */
-    initEditor();
+    /* arguments are the sizes of the synthetic files, e.g. 1M 64M 4G */
+    benchKernels();
+
+    initHeadless(KILO_HEADLESS_ROWS, KILO_HEADLESS_COLS);
+    printf("\neditor core, %dx%d screen\n", E.screenrows, E.screencols);
+    benchBlockedOutput();
+    int j;
+    for (j = 1; j < argc; j++) {
+        size_t size = benchParseSize(argv[j]);
+        benchEditor(size, "short", 80, 0);
+        benchEditor(size, "long", 16384, 0);
+        benchEditor(size, "tabs", 80, 1);
+        benchWrap(size, 0);
+        benchWrap(size, 1);
+        benchGzip(size);
+    }
+    benchSyntax(KILO_BENCH_C_LINES);
+    return 0;
+}
+
+#else
+void dumpHeadless() {                                                    // {{{2
+    /* atexit() handler - write everything rendered in headless mode to the
+     * output file given with -o, or to stdout */
+    FILE *fp = E.headlessfile ? fopen(E.headlessfile, "w") : stdout;
+    if (!fp) return;
+    fwrite(headlessout.b, 1, headlessout.len, fp);
+    if (fp != stdout) fclose(fp);
+}
+
+void usage() {                                                           // {{{2
+    fprintf(stderr, "usage: kilo [-f] [-w] [-x] [-r FPS] [-t file] [-u MB] "
+                    "[-s script [-o output] [-g ROWSxCOLS]] [file ...]\n"
+                    "       kilo -d [-S socket] [options] [file ...]\n"
+                    "       kilo -c [-S socket] [file ...]\n"
+                    "  -d  run as a daemon keeping the files open for "
+                    "clients\n"
+                    "  -c  attach to the daemon, starting one if there is "
+                    "none\n"
+                    "      (Ctrl-Q detaches, the files stay open)\n"
+                    "  -S  socket of the daemon (default "
+                    "$XDG_RUNTIME_DIR/kilo.sock),\n"
+                    "      whoever may connect to it may edit what the "
+                    "daemon may\n"
+                    "  -f  follow lines appended to the file (like tail -f)\n"
+                    "  -w  start in soft wrap mode (Ctrl-W toggles it)\n"
+                    "  -r  most frames drawn per second (default %d)\n"
+#ifndef KILO_NO_PROFILE
+                    "  -t  write a Chrome trace of the frames to file, "
+                    "Ctrl-T shows timings\n"
+#endif
+                    "  -x  keep the line index in a %s sidecar file\n"
+                    "  -u  memory for the undo log in megabytes "
+                    "(default %d)\n",
+                    KILO_MAX_FPS, KILO_INDEX_SUFFIX, KILO_UNDO_LIMIT >> 20);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {                                       // {{{2
+    /* pick the byte scanning kernels for this cpu */
+    scanInit();
+
+    /* command line options, -s runs headless: keys come from the script
+     * file, the rendered output goes to the -o file */
+    char *script = NULL;
+    char *trace = NULL;
+    int follow = 0;
+    int daemon = 0, client = 0;
+    char *sock = NULL;
+    int rows = KILO_HEADLESS_ROWS;
+    int cols = KILO_HEADLESS_COLS;
+    long undolimit = KILO_UNDO_LIMIT >> 20;
+    long fps = KILO_MAX_FPS;
+    char *end;
+    int opt;
+    E.infd = STDIN_FILENO;
+    /* getopt() from <unistd.h> */
+    while ((opt = getopt(argc, argv, "s:o:g:u:r:t:xfwdcS:")) != -1) {
+        switch (opt) {
+            case 'd': daemon = 1; break;
+            case 'c': client = 1; break;
+            case 'S': sock = optarg; break;
+            case 'x': E.indexsidecar = 1; break;
+            case 'f': follow = 1; break;
+            case 'w': E.wrap = 1; break;
+            case 's': script = optarg; break;
+            case 'o': E.headlessfile = optarg; break;
+            case 't': trace = optarg; break;
+            case 'u':
+                undolimit = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || undolimit < 0 ||
+                        undolimit > (long)(SIZE_MAX >> 21)) usage();
+                break;
+            case 'r':
+                fps = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || fps < 1 || fps > 1000)
+                    usage();
+                break;
+            case 'g':
+                if (sscanf(optarg, "%dx%d", &rows, &cols) != 2 ||
+                        rows < 1 || cols < 1) usage();
+                break;
+            default: usage();
+        }
+    }
+    if ((daemon || client) && script) usage();
+    if (daemon && client) usage();
+    if ((daemon || client) && sock == NULL) {
+        sock = editorSockPath();
+        if (sock == NULL) {
+            fprintf(stderr, "kilo: /tmp/kilo-%d is not a private directory\n",
+                    (int)getuid());
+            exit(1);
+        }
+    }
+    /* the client only passes keys and frames, the editor is the daemon */
+    if (client)
+        return editorAttach(sock, argv + optind, argc - optind, argv[0]);
+
+#ifndef KILO_NO_PROFILE
+    /* registered first so that it runs last, once the terminal is back to
+     * normal */
+    atexit(editorProfReport);
+    if (trace) editorProfTrace(trace);
+#else
+    if (trace) usage();
+#endif
+
+    if (script) {
+        E.infd = open(script, O_RDONLY);
+        if (E.infd == -1) die("open");
+        initHeadless(rows, cols);
+        atexit(dumpHeadless);
+    } else if (daemon) {
+        initDaemon();
+        E.listenfd = editorListen(sock);
+        if (E.listenfd == -1) die(sock);
+    } else {
+        /* simplified the main() function */
+        enableRawMode();
+        /* initialize all the fields inf the E struct */
+        initEditor();
+    }
+    E.undolimit = (size_t)undolimit << 20;
+    E.buf->undo.limit = E.undolimit;
+    E.frametime = 1.0 / fps;
+    /* set before the file is opened, messages about the file replace it */
+    editorSetStatusMessage(
+            "HELP: Ctrl-S save | Ctrl-Q quit | Ctrl-F find | Ctrl-G line | "
+            "Ctrl-Z/Y undo");
     /* editorOpen() will be for opening and reading a file from disk
      * if filename is supplied to kilo then open it, otherwise continue with
      * empty file */
-    if (argc >= 2) {
-        editorOpen(argv[1]);
+    int j;
+    for (j = optind; j < argc; j++) {
+        /* each file gets a buffer, the first one is shown */
+        if (editorBufferFind(argv[j])) continue;
+        if (j > optind) editorShowBuffer(editorBufferNew());
+        editorOpen(argv[j]);
+        if (follow && editorFollowStart() == -1)
+            editorSetStatusMessage("Cannot follow %.40s", argv[j]);
     }
+    if (optind < argc) editorShowBuffer(E.bufs[0]);
+    if (follow && optind == argc)
+        editorSetStatusMessage("Cannot follow without a file");
+    /* files given to the daemon are open before the first client comes */
+    if (daemon) editorServe();
 
     while (1) {
         editorRefreshScreen();
         editorProcessKeypress();
+        /* process every key that is already queued before repainting, so
+         * the repaint rate does not depend on the input rate */
+        while (editorInputPending()) editorProcessKeypress();
     }
 
     return 0;
 }
+#endif
 
 // vim: foldmethod=marker